@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace xr {
+  struct DiscoveryConfig final {
+    // How long to wait before searching again after a search came up empty (or a join failed).
+    uint32_t retry_ms;
+
+    // How long joining the other end's access point can take before it is given up on.
+    uint32_t join_timeout_ms;
+
+    // Once joined, how long to wait before leaving the access point, and then before starting esp-now;
+    // both give the radio time to settle.
+    uint32_t settle_ms;
+    uint32_t leave_ms;
+  };
+
+  // Walks through finding the other end over wifi (see `Pairing`), one step per `tick`, so that the owner
+  // keeps running its loop (and e.g rendering) while it waits. Like `LinkMonitor`, this does not touch the
+  // radio; events are fed in and the owner is told what to do through the action returned by `tick`:
+  //
+  // - `SEARCH`: start looking (the controller scans for the light host, the light host starts its
+  //   access point); report back with `found` or `missed`.
+  // - `GIVE_UP`: a join took too long and should be abandoned; a new search follows after `retry_ms`.
+  // - `LEAVE`: joined and settled; leave the access point (the light host keeps its own up).
+  // - `START`: start esp-now; discovery is over and we are `IDLE` again.
+  //
+  // Joining is reported with `joined`. Peers that are already known skip straight to `START` with
+  // `resume`.
+  class Discovery final {
+    public:
+      enum DiscoveryState {
+        IDLE,
+        SEARCHING,
+        JOINING,
+        SETTLING,
+        LEAVING,
+        READY,
+      };
+
+      enum DiscoveryAction {
+        NONE,
+        SEARCH,
+        GIVE_UP,
+        LEAVE,
+        START,
+      };
+
+      explicit Discovery(const DiscoveryConfig& config):
+        _config(config),
+        _state(DiscoveryState::IDLE),
+        _since(0),
+        _search_at(0),
+        _search_pending(false) {
+        }
+      ~Discovery() = default;
+
+      void begin(uint32_t now) {
+        enter(DiscoveryState::SEARCHING, now);
+        search_after(now, 0);
+      }
+
+      void resume(uint32_t now) {
+        _search_pending = false;
+        enter(DiscoveryState::READY, now);
+      }
+
+      // The search found the other end, and joining it has started.
+      void found(uint32_t now) {
+        if (_state == DiscoveryState::SEARCHING) {
+          enter(DiscoveryState::JOINING, now);
+        }
+      }
+
+      // The search came up empty; another is started after `retry_ms`.
+      void missed(uint32_t now) {
+        if (_state == DiscoveryState::SEARCHING) {
+          search_after(now, _config.retry_ms);
+        }
+      }
+
+      void joined(uint32_t now) {
+        if (_state == DiscoveryState::SEARCHING || _state == DiscoveryState::JOINING) {
+          enter(DiscoveryState::SETTLING, now);
+        }
+      }
+
+      DiscoveryAction tick(uint32_t now) {
+        switch (_state) {
+          case DiscoveryState::SEARCHING:
+            if (_search_pending && static_cast<int32_t>(now - _search_at) >= 0) {
+              _search_pending = false;
+              return DiscoveryAction::SEARCH;
+            }
+
+            return DiscoveryAction::NONE;
+          case DiscoveryState::JOINING:
+            if (now - _since < _config.join_timeout_ms) {
+              return DiscoveryAction::NONE;
+            }
+
+            enter(DiscoveryState::SEARCHING, now);
+            search_after(now, _config.retry_ms);
+            return DiscoveryAction::GIVE_UP;
+          case DiscoveryState::SETTLING:
+            if (now - _since < _config.settle_ms) {
+              return DiscoveryAction::NONE;
+            }
+
+            enter(DiscoveryState::LEAVING, now);
+            return DiscoveryAction::LEAVE;
+          case DiscoveryState::LEAVING:
+            if (now - _since < _config.leave_ms) {
+              return DiscoveryAction::NONE;
+            }
+
+            enter(DiscoveryState::IDLE, now);
+            return DiscoveryAction::START;
+          case DiscoveryState::READY:
+            enter(DiscoveryState::IDLE, now);
+            return DiscoveryAction::START;
+          default:
+            return DiscoveryAction::NONE;
+        }
+      }
+
+      DiscoveryState state() const {
+        return _state;
+      }
+
+    private:
+      void enter(DiscoveryState state, uint32_t now) {
+        _state = state;
+        _since = now;
+      }
+
+      void search_after(uint32_t now, uint32_t delay) {
+        _search_at = now + delay;
+        _search_pending = true;
+      }
+
+      DiscoveryConfig _config;
+      DiscoveryState _state;
+      uint32_t _since;
+      uint32_t _search_at;
+      bool _search_pending;
+  };
+}
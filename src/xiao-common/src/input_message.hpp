@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace xr {
+  // Controllers send their inputs to the light host as text, `[x|y|z|sequence|time]`: the x and y axes
+  // (0 when centered, 1 or 2 when pushed either way), the button, then the message's sequence number and
+  // the time the inputs were sampled at (on the controller's clock). Older controllers stop after the
+  // button, leaving the rest zero.
+  struct InputMessage final {
+    uint32_t x;
+    uint32_t y;
+    uint8_t z;
+    uint32_t sequence;
+    uint32_t time;
+  };
+
+  inline int format_input_message(char * buffer, size_t size, const InputMessage& message) {
+    return snprintf(
+      buffer,
+      size,
+      "[%u|%u|%u|%u|%u]",
+      static_cast<unsigned int>(message.x),
+      static_cast<unsigned int>(message.y),
+      static_cast<unsigned int>(message.z),
+      static_cast<unsigned int>(message.sequence),
+      static_cast<unsigned int>(message.time)
+    );
+  }
+
+  // Reads a message out of (at most) the first `max_len` bytes of `data`.
+  inline InputMessage parse_input_message(const char * data, int max_len) {
+    const char * head = data + 0;
+    const char * end = data + max_len;
+    uint32_t left = 0;
+    uint32_t right = 0;
+    uint32_t up = 0;
+    uint32_t sequence = 0;
+    uint32_t time = 0;
+    uint8_t stage = 0;
+
+    while (head < end && *head != ']') {
+      if (*head == '[' && stage == 0) {
+        stage = 1;
+      } else if (*head == '|' && stage >= 1 && stage < 5) {
+        stage += 1;
+      } else if (stage == 1) {
+        left = (left * 10) + (*head - '0');
+      } else if (stage == 2) {
+        right = (right * 10) + (*head - '0');
+      } else if (stage == 3) {
+        up = (up * 10) + (*head - '0');
+      } else if (stage == 4) {
+        sequence = (sequence * 10) + (*head - '0');
+      } else if (stage == 5) {
+        time = (time * 10) + (*head - '0');
+      }
+
+      head++;
+    }
+
+    return InputMessage { left, right, static_cast<uint8_t>(up), sequence, time };
+  }
+}
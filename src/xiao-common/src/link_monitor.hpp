@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdint.h>
+
+namespace xr {
+  // The channels we will look for each other on when the link is lost; the non-overlapping 2.4GHz
+  // channels, starting with the one the light host's access point uses by default.
+  constexpr static const std::array<uint8_t, 3> LINK_CHANNELS = { 1, 6, 11 };
+
+  constexpr uint8_t next_link_channel(uint8_t channel) {
+    for (uint32_t i = 0; i < LINK_CHANNELS.size(); i++) {
+      if (LINK_CHANNELS[i] == channel) {
+        return LINK_CHANNELS[(i + 1) % LINK_CHANNELS.size()];
+      }
+    }
+
+    return LINK_CHANNELS[0];
+  }
+
+  struct LinkConfig final {
+    // Delivery ratios (in permille) below which the link is considered degraded, and lost.
+    uint16_t degraded_delivery;
+    uint16_t lost_delivery;
+
+    // Signal strength below which the link is considered degraded.
+    int8_t weak_rssi;
+
+    // Without a single delivery for this long the link is lost, regardless of the ratio.
+    uint32_t silence_ms;
+
+    // Once lost, recovery attempts are spaced out starting at `base_backoff_ms` and doubling up to
+    // `max_backoff_ms`; after `retries_per_hop` attempts we move channel, and after `hops_before_repair`
+    // channel moves we give up on the link entirely.
+    uint32_t base_backoff_ms;
+    uint32_t max_backoff_ms;
+    uint8_t retries_per_hop;
+    uint8_t hops_before_repair;
+  };
+
+  // Supervises an esp-now link from the deliveries (and misses) observed on one end of it. Everything
+  // is fed in from the outside, so this does not touch the radio; the owner is told what to do about a
+  // lost link through the action returned by `tick`:
+  //
+  // - `RETRY`: try again (e.g send a probe); these are spaced out with an exponential backoff.
+  // - `HOP`: move to the next channel in `LINK_CHANNELS`.
+  // - `REPAIR`: give up and go back to discovery.
+  //
+  // Any delivery while lost brings the link back and resets the escalation.
+  class LinkMonitor final {
+    public:
+      enum LinkState {
+        GOOD,
+        DEGRADED,
+        LOST,
+      };
+
+      enum LinkAction {
+        NONE,
+        RETRY,
+        HOP,
+        REPAIR,
+      };
+
+      explicit LinkMonitor(const LinkConfig& config):
+        _config(config),
+        _state(LinkState::GOOD),
+        _delivery(1000),
+        _rssi(0),
+        _latency(0),
+        _last_delivery(0),
+        _next_attempt(0),
+        _backoff(config.base_backoff_ms),
+        _retries(0),
+        _hops(0) {
+        }
+      ~LinkMonitor() = default;
+
+      // Starts supervising from `now`, as if everything had been delivered up until then.
+      void reset(uint32_t now) {
+        _state = LinkState::GOOD;
+        _delivery = 1000;
+        _last_delivery = now;
+        escalation_reset();
+      }
+
+      void delivered(uint32_t now, uint32_t latency_us = 0) {
+        // A lost link only sees occasional retries, so a single delivery is enough to bring it back.
+        if (_state == LinkState::LOST) {
+          _delivery = std::max(_delivery, _config.degraded_delivery);
+        }
+
+        _delivery += (1000 - _delivery) / SMOOTHING;
+        _latency = _latency == 0 ? latency_us : _latency + (static_cast<int32_t>(latency_us - _latency) / SMOOTHING);
+        _last_delivery = std::max(_last_delivery, now);
+      }
+
+      void missed(uint32_t count = 1) {
+        for (uint32_t i = 0; i < count && _delivery > 0; i++) {
+          _delivery -= std::max<uint16_t>(_delivery / SMOOTHING, 1);
+        }
+      }
+
+      void rssi(int8_t value) {
+        _rssi = _rssi == 0 ? value : _rssi + (value - _rssi) / RSSI_SMOOTHING;
+      }
+
+      LinkAction tick(uint32_t now) {
+        bool silent = now > _last_delivery && now - _last_delivery > _config.silence_ms;
+
+        if (silent || _delivery < _config.lost_delivery) {
+          if (_state != LinkState::LOST) {
+            _state = LinkState::LOST;
+            _next_attempt = now + _backoff;
+            return LinkAction::NONE;
+          }
+
+          return escalate(now);
+        }
+
+        bool weak = _rssi != 0 && _rssi < _config.weak_rssi;
+        _state = weak || _delivery < _config.degraded_delivery ? LinkState::DEGRADED : LinkState::GOOD;
+        escalation_reset();
+        return LinkAction::NONE;
+      }
+
+      LinkState state() const {
+        return _state;
+      }
+
+      // The smoothed delivery ratio, in permille.
+      uint16_t delivery() const {
+        return _delivery;
+      }
+
+      // The smoothed signal strength, or zero when we haven't been told any.
+      int8_t rssi() const {
+        return _rssi;
+      }
+
+      // The smoothed delivery latency, in microseconds, or zero when we haven't been told any.
+      uint32_t latency() const {
+        return _latency;
+      }
+
+    private:
+      constexpr static const uint16_t SMOOTHING = 16;
+      constexpr static const int8_t RSSI_SMOOTHING = 4;
+
+      LinkAction escalate(uint32_t now) {
+        if (now < _next_attempt) {
+          return LinkAction::NONE;
+        }
+
+        _retries += 1;
+
+        if (_retries <= _config.retries_per_hop) {
+          _next_attempt = now + _backoff;
+          _backoff = std::min(_backoff * 2, _config.max_backoff_ms);
+          return LinkAction::RETRY;
+        }
+
+        _retries = 0;
+        _hops += 1;
+        _backoff = _config.base_backoff_ms;
+        _next_attempt = now + _backoff;
+
+        if (_hops > _config.hops_before_repair) {
+          _hops = 0;
+          return LinkAction::REPAIR;
+        }
+
+        return LinkAction::HOP;
+      }
+
+      void escalation_reset() {
+        _backoff = _config.base_backoff_ms;
+        _retries = 0;
+        _hops = 0;
+      }
+
+      LinkConfig _config;
+      LinkState _state;
+      uint16_t _delivery;
+      int8_t _rssi;
+      uint32_t _latency;
+      uint32_t _last_delivery;
+      uint32_t _next_attempt;
+      uint32_t _backoff;
+      uint8_t _retries;
+      uint8_t _hops;
+  };
+}
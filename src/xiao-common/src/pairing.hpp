@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace xr {
+  // Tracks whether we are talking to our peer, deciding when to fall back to discovery. The pairing
+  // only deals in time and events so that it can be driven by anything; it does not touch the radio.
+  //
+  // - Booting with a peer remembered from a previous run puts us in `RESUMING`; booting without one
+  //   puts us in `DISCOVERING`.
+  // - Hearing from the peer (a message, or an acknowledgement of one we sent) while resuming puts us
+  //   in `PAIRED`, as does completing discovery.
+  // - A resume that goes unanswered for `resume_timeout` moves us to `DISCOVERING`.
+  // - Once paired, supervising the link is left to a `LinkMonitor`; the link being given up on moves
+  //   us back to `DISCOVERING`.
+  class Pairing final {
+    public:
+      enum PairingState {
+        DISCOVERING,
+        RESUMING,
+        PAIRED,
+      };
+
+      explicit Pairing(uint32_t resume_timeout):
+        _resume_timeout(resume_timeout),
+        _state(PairingState::DISCOVERING),
+        _since(0),
+        _last_heard(0) {
+        }
+      ~Pairing() = default;
+
+      void boot(uint32_t now, bool has_stored_peer) {
+        enter(has_stored_peer ? PairingState::RESUMING : PairingState::DISCOVERING, now);
+      }
+
+      // Records hearing from the peer at `now`; anything older than what we have already heard (or than
+      // the start of a resume) is ignored, so callers can pass the time of the last message every tick.
+      void heard(uint32_t now) {
+        if (now <= _last_heard) {
+          return;
+        }
+
+        _last_heard = now;
+
+        if (_state == PairingState::RESUMING) {
+          enter(PairingState::PAIRED, now);
+        }
+      }
+
+      void discovered(uint32_t now) {
+        _last_heard = now;
+        enter(PairingState::PAIRED, now);
+      }
+
+      void lost(uint32_t now) {
+        enter(PairingState::DISCOVERING, now);
+      }
+
+      // Applies our resume timeout, returning the (possibly new) state.
+      PairingState tick(uint32_t now) {
+        if (_state == PairingState::RESUMING && elapsed(_since, now) > _resume_timeout) {
+          enter(PairingState::DISCOVERING, now);
+        }
+
+        return _state;
+      }
+
+      PairingState state() const {
+        return _state;
+      }
+
+    private:
+      static uint32_t elapsed(uint32_t since, uint32_t now) {
+        return now > since ? now - since : 0;
+      }
+
+      void enter(PairingState state, uint32_t now) {
+        _state = state;
+        _since = now;
+
+        if (state == PairingState::RESUMING) {
+          _last_heard = now;
+        }
+      }
+
+      uint32_t _resume_timeout;
+      PairingState _state;
+      uint32_t _since;
+      uint32_t _last_heard;
+  };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <Preferences.h>
+
+#include <array>
+#include <stdint.h>
+#include <string.h>
+
+namespace xr {
+  // The peers we were last paired with and the channel we talked to them on, as persisted in nvs.
+  struct PairingRecord final {
+    constexpr static const uint8_t MAX_PEERS = 8;
+
+    uint8_t channel;
+    uint8_t count;
+    std::array<std::array<uint8_t, 6>, MAX_PEERS> peers;
+
+    // Adds the peer, if it isn't already known and there is room; returns whether the record changed.
+    bool add(const uint8_t * mac) {
+      for (uint8_t i = 0; i < count; i++) {
+        if (memcmp(peers[i].data(), mac, 6) == 0) {
+          return false;
+        }
+      }
+
+      if (count == MAX_PEERS) {
+        return false;
+      }
+
+      memcpy(peers[count].data(), mac, 6);
+      count += 1;
+      return true;
+    }
+  };
+
+  // Reads and writes a `PairingRecord` to its own nvs namespace.
+  class PairingStore final {
+    public:
+      explicit PairingStore(const char * name): _name(name) {}
+      ~PairingStore() = default;
+
+      PairingStore(const PairingStore&) = delete;
+      PairingStore& operator=(const PairingStore&) = delete;
+
+      bool load(PairingRecord& record) {
+        Preferences preferences;
+
+        if (!preferences.begin(_name, true)) {
+          return false;
+        }
+
+        bool found = preferences.getBytesLength(RECORD_KEY) == sizeof(PairingRecord)
+          && preferences.getBytes(RECORD_KEY, &record, sizeof(PairingRecord)) == sizeof(PairingRecord)
+          && record.count > 0
+          && record.count <= PairingRecord::MAX_PEERS;
+
+        preferences.end();
+        return found;
+      }
+
+      bool save(const PairingRecord& record) {
+        Preferences preferences;
+
+        if (!preferences.begin(_name, false)) {
+          return false;
+        }
+
+        bool saved = preferences.putBytes(RECORD_KEY, &record, sizeof(PairingRecord)) == sizeof(PairingRecord);
+        preferences.end();
+        return saved;
+      }
+
+      void clear() {
+        Preferences preferences;
+
+        if (preferences.begin(_name, false)) {
+          preferences.remove(RECORD_KEY);
+          preferences.end();
+        }
+      }
+
+    private:
+      constexpr static const char * RECORD_KEY = "pairing";
+      const char * _name;
+  };
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace xr {
+  struct SampleSchedule final {
+    // How often inputs are sampled (and sent) while they are changing, and once they have been held
+    // still for `idle_after_ms`.
+    uint32_t active_interval_ms;
+    uint32_t idle_interval_ms;
+    uint32_t idle_after_ms;
+
+    // Waits shorter than this are not worth the cost of entering and leaving light sleep.
+    uint32_t min_sleep_ms;
+
+    // Rough current draw while awake (cpu and radio on) and in light sleep, used to estimate our
+    // average draw from the duty cycle.
+    uint32_t active_microamps;
+    uint32_t sleep_microamps;
+  };
+
+  struct PowerStats final {
+    // The fraction of time spent awake, in permille.
+    uint16_t duty_cycle;
+    uint32_t average_microamps;
+    uint32_t interval_ms;
+  };
+
+  // Decides when the controller next samples its inputs and whether to light sleep until then, and
+  // keeps track of how long it has spent asleep. Only deals in times it is given, so that it can be driven
+  // by any clock.
+  class SampleScheduler final {
+    public:
+      explicit SampleScheduler(const SampleSchedule& schedule):
+        _schedule(schedule),
+        _last_sample(0),
+        _last_change(0),
+        _window_start(0),
+        _slept(0) {
+        }
+      ~SampleScheduler() = default;
+
+      // Records a sample taken at `now`, and whether it differed from the one before it.
+      void sampled(uint32_t now, bool changed) {
+        _last_sample = now;
+
+        if (changed) {
+          _last_change = now;
+        }
+      }
+
+      uint32_t interval(uint32_t now) const {
+        return now - _last_change >= _schedule.idle_after_ms
+          ? _schedule.idle_interval_ms
+          : _schedule.active_interval_ms;
+      }
+
+      // How long until the next sample is due.
+      uint32_t wait(uint32_t now) const {
+        uint32_t due = _last_sample + interval(now);
+        return static_cast<int32_t>(due - now) > 0 ? due - now : 0;
+      }
+
+      bool should_sleep(uint32_t wait) const {
+        return wait >= _schedule.min_sleep_ms;
+      }
+
+      // Records `duration` spent in light sleep.
+      void slept(uint32_t duration) {
+        _slept += duration;
+      }
+
+      // Our power stats since the last call (or since `start`).
+      PowerStats take_stats(uint32_t now) {
+        uint32_t elapsed = now - _window_start;
+        uint32_t asleep = elapsed > _slept ? _slept : elapsed;
+        uint16_t duty = elapsed == 0 ? 1000 : static_cast<uint16_t>(1000 - ((uint64_t) asleep * 1000 / elapsed));
+
+        uint32_t average = static_cast<uint32_t>(
+          ((uint64_t) _schedule.active_microamps * duty + (uint64_t) _schedule.sleep_microamps * (1000 - duty)) / 1000
+        );
+
+        _window_start = now;
+        _slept = 0;
+        return PowerStats { duty, average, interval(now) };
+      }
+
+      void start(uint32_t now) {
+        _last_sample = now;
+        _last_change = now;
+        _window_start = now;
+        _slept = 0;
+      }
+
+    private:
+      SampleSchedule _schedule;
+      uint32_t _last_sample;
+      uint32_t _last_change;
+      uint32_t _window_start;
+      uint32_t _slept;
+  };
+}
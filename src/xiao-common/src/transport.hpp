@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+
+#ifdef ARDUINO
+#include "esp_now.h"
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#endif
+
+namespace xr {
+  // Called with the address of the sender and what it sent; like esp-now, callbacks happen on a task (or
+  // thread) of the transport's, not the one that started it.
+  using ReceiveCallback = void (*)(const uint8_t * address, const uint8_t * data, int size);
+
+  // Called once a message has gone out, with whether it was acknowledged.
+  using SentCallback = void (*)(const uint8_t * address, bool delivered);
+
+  constexpr static const std::array<uint8_t, 6> BROADCAST_ADDRESS = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+  // How controllers and light hosts talk to each other. Both firmwares use whichever `Transport` is
+  // built for their platform: esp-now on the devices and udp over localhost everywhere else, so that
+  // the input path can be run (and measured) on a development machine (see `xiao-host`).
+  //
+  // Everything about finding each other (access points, channels and so on) is still up to the firmware.
+#ifdef ARDUINO
+  // Esp-now, on whichever channel the radio is tuned to.
+  class EspNowTransport final {
+    public:
+      EspNowTransport() = default;
+      ~EspNowTransport() = default;
+
+      EspNowTransport(const EspNowTransport&) = delete;
+      EspNowTransport& operator=(const EspNowTransport&) = delete;
+
+      bool begin() {
+        return esp_now_init() == ESP_OK;
+      }
+
+      void end() {
+        esp_now_deinit();
+      }
+
+      bool add_peer(const uint8_t * address) {
+        if (esp_now_is_peer_exist(address)) {
+          return true;
+        }
+
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, address, 6);
+        peer.channel = 0;
+        peer.encrypt = false;
+        return esp_now_add_peer(&peer) == ESP_OK;
+      }
+
+      // Queues a message for `address`, which must have been added as a peer.
+      bool send(const uint8_t * address, const uint8_t * data, uint32_t size) {
+        return esp_now_send(address, data, size) == ESP_OK;
+      }
+
+      void on_receive(ReceiveCallback callback) {
+        _receive = callback;
+        esp_now_register_recv_cb(receive_cb);
+      }
+
+      void on_sent(SentCallback callback) {
+        _sent = callback;
+        esp_now_register_send_cb(sent_cb);
+      }
+
+    private:
+      // Since esp-idf 5, receive callbacks are given the whole packet header instead of just the sender.
+      static void receive_cb(const esp_now_recv_info_t * info, const uint8_t * data, int size) {
+        _receive(info->src_addr, data, size);
+      }
+
+      static void sent_cb(const uint8_t * address, esp_now_send_status_t status) {
+        _sent(address, status == ESP_NOW_SEND_SUCCESS);
+      }
+
+      inline static ReceiveCallback _receive = nullptr;
+      inline static SentCallback _sent = nullptr;
+  };
+
+  using Transport = EspNowTransport;
+#else
+  // Udp over localhost, standing in for esp-now. Every node is a port, addressed by the port wrapped in a
+  // locally administered mac address (see `udp_address`); broadcasts go to every port in
+  // [`broadcast_port`, `broadcast_port` + `broadcast_count`) but our own. There are no acknowledgements,
+  // so every message handed to the socket is taken to be delivered.
+  class UdpTransport final {
+    public:
+      constexpr static const uint16_t DEFAULT_PORT = 7070;
+
+      static std::array<uint8_t, 6> udp_address(uint16_t port) {
+        return std::array<uint8_t, 6> { 0x02, 'x', 'r', 0, static_cast<uint8_t>(port >> 8), static_cast<uint8_t>(port & 0xFF) };
+      }
+
+      explicit UdpTransport(uint16_t port = DEFAULT_PORT, uint16_t broadcast_port = DEFAULT_PORT, uint16_t broadcast_count = 8):
+        _port(port),
+        _broadcast_port(broadcast_port),
+        _broadcast_count(broadcast_count),
+        _socket(-1),
+        _running(false),
+        _receive(nullptr),
+        _sent(nullptr) {
+        }
+      ~UdpTransport() {
+        end();
+      }
+
+      UdpTransport(const UdpTransport&) = delete;
+      UdpTransport& operator=(const UdpTransport&) = delete;
+
+      bool begin() {
+        _socket = socket(AF_INET, SOCK_DGRAM, 0);
+
+        if (_socket < 0) {
+          return false;
+        }
+
+        // Reads time out now and again so that `end` is noticed.
+        timeval timeout { 0, 100000 };
+        setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_in local = to_socket_address(_port);
+
+        if (bind(_socket, reinterpret_cast<sockaddr *>(&local), sizeof(local)) != 0) {
+          close(_socket);
+          _socket = -1;
+          return false;
+        }
+
+        _running = true;
+        _thread = std::thread([this]() { receive(); });
+        return true;
+      }
+
+      void end() {
+        if (_socket < 0) {
+          return;
+        }
+
+        _running = false;
+        _thread.join();
+        close(_socket);
+        _socket = -1;
+      }
+
+      bool add_peer(const uint8_t * address) {
+        return true;
+      }
+
+      bool send(const uint8_t * address, const uint8_t * data, uint32_t size) {
+        bool sent = true;
+
+        if (memcmp(address, BROADCAST_ADDRESS.data(), 6) == 0) {
+          for (uint16_t port = _broadcast_port; port < _broadcast_port + _broadcast_count; port++) {
+            sent = (port == _port || send_to(port, data, size)) && sent;
+          }
+        } else {
+          sent = send_to((address[4] << 8) | address[5], data, size);
+        }
+
+        if (_sent != nullptr) {
+          _sent(address, sent);
+        }
+
+        return sent;
+      }
+
+      void on_receive(ReceiveCallback callback) {
+        _receive = callback;
+      }
+
+      void on_sent(SentCallback callback) {
+        _sent = callback;
+      }
+
+    private:
+      static sockaddr_in to_socket_address(uint16_t port) {
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+      }
+
+      bool send_to(uint16_t port, const uint8_t * data, uint32_t size) {
+        sockaddr_in destination = to_socket_address(port);
+        return sendto(_socket, data, size, 0, reinterpret_cast<sockaddr *>(&destination), sizeof(destination)) == static_cast<ssize_t>(size);
+      }
+
+      void receive() {
+        std::array<uint8_t, 250> buffer;
+
+        while (_running) {
+          sockaddr_in source {};
+          socklen_t length = sizeof(source);
+          ssize_t size = recvfrom(_socket, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr *>(&source), &length);
+
+          if (size <= 0 || _receive == nullptr) {
+            continue;
+          }
+
+          auto address = udp_address(ntohs(source.sin_port));
+          _receive(address.data(), buffer.data(), size);
+        }
+      }
+
+      uint16_t _port;
+      uint16_t _broadcast_port;
+      uint16_t _broadcast_count;
+      int _socket;
+      std::atomic<bool> _running;
+      std::thread _thread;
+      ReceiveCallback _receive;
+      SentCallback _sent;
+  };
+
+  using Transport = UdpTransport;
+#endif
+}
@@ -1,6 +1,20 @@
 #include <Arduino.h>
 #include "WiFi.h"
 #include "esp_now.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+
+#include <atomic>
+
+#include "pairing.hpp"
+#include "pairing_store.hpp"
+#include "link_monitor.hpp"
+#include "discovery.hpp"
+#include "transport.hpp"
+#include "input_message.hpp"
+#include "sample_scheduler.hpp"
 
 #define X_AXIS_PIN A0
 #define Y_AXIS_PIN A1
@@ -14,6 +28,22 @@
 #define X_TOLERANCE_UPPER 3200
 #endif
 
+// How often inputs are sampled while they are changing, and once they have been held still for a while.
+#ifndef SAMPLE_INTERVAL_MS
+#define SAMPLE_INTERVAL_MS 10
+#endif
+
+#ifndef IDLE_SAMPLE_INTERVAL_MS
+#define IDLE_SAMPLE_INTERVAL_MS 50
+#endif
+
+// The level the button pin is at while pressed, which wakes us from light sleep.
+#ifdef BUTTON_NORMAL_OPEN
+#define BUTTON_WAKE_LEVEL GPIO_INTR_LOW_LEVEL
+#else
+#define BUTTON_WAKE_LEVEL GPIO_INTR_HIGH_LEVEL
+#endif
+
 //
 // Beetle Controller
 //
@@ -37,135 +67,172 @@ enum ERuntimeMode {
 // This will be replaced with the parsed contents of the `LIGHTS_PHYSICAL_ADDRESS` environment variable that
 // is injected at compile into the `LIGHTS_PHYSICAL_ADDRESS` macro.
 static uint8_t broadcast_address[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-static const uint32_t max_failed_message_sends = 100;
-static const uint32_t max_failed_ap_connection_attempts = 30;
 
-esp_now_peer_info_t peer_info;
+// Without a stored pairing we find the light host by scanning for its access point (in the background,
+// sampling our inputs meanwhile) and joining it, which tells us its channel. We give up on a join after
+// fifteen seconds, and once joined leave again and let the radio settle for five before starting esp-now.
+static const xr::DiscoveryConfig discovery_config {
+  1000, 15000,  // retry, join timeout
+  0, 5000,      // settle, leave
+};
+
+// How long we try to resume our stored pairing on boot before falling back to discovery.
+static const uint32_t pairing_resume_timeout = 5000;
+
+// Once paired, the link is supervised from the acknowledgements of what we send. When it is lost we stop
+// sending every frame and probe with a backoff instead, cycling through channels (in case the light host
+// has moved) for a few seconds before going back to discovery.
+static const xr::LinkConfig link_config {
+  900, 500,  // degraded, lost delivery (permille)
+  -80,       // weak rssi
+  1000,      // silence
+  50, 800,   // base, max backoff
+  4,         // retries per hop
+  xr::LINK_CHANNELS.size() * 2,
+};
+
+// Between samples we light sleep (esp-now stays initialized, with the radio in modem sleep), waking on
+// a timer or as soon as the button is pressed.
+static const xr::SampleSchedule sample_schedule {
+  SAMPLE_INTERVAL_MS, IDLE_SAMPLE_INTERVAL_MS,
+  500,          // idle after
+  4,            // min sleep
+  80000, 350,   // active, sleep microamps
+};
+
+// The longest we wait for our last message to be sent before going to sleep.
+static const uint32_t max_send_wait_ms = 5;
+static const uint32_t power_stats_interval_ms = 5000;
+
 message_payload_t message_payload;
 uint32_t last_debug_log = 0;
-uint32_t failed_send_count = 0;
+uint32_t sequence = 0;
+uint32_t last_power_stats_log = 0;
+uint8_t channel = xr::LINK_CHANNELS[0];
 ERuntimeMode mode = ERuntimeMode::DISCONNECTED;
 
-// TODO: is this empty callback necessary?
-void sent_cb(const uint8_t* mac_addr, esp_now_send_status_t status) {}
-
-// cppcheck-suppress unusedFunction
-void setup(void) {
-  Serial.begin(115200);
-  delay(1000);
-  pinMode(Z_BUTTON_PIN, INPUT_PULLUP);
-  digitalWrite(Z_BUTTON_PIN, HIGH);
-
-  log_d("initializing wifi in station mode");
-  WiFi.mode(WIFI_MODE_STA);
-  Serial.println(WiFi.macAddress());
-  log_d("^-- my mac address");
+// The light host we last paired with is persisted so that we can go straight to esp-now on boot.
+xr::PairingStore pairing_store("xr-pairing");
+xr::PairingRecord pairing_record;
+xr::Pairing pairing(pairing_resume_timeout);
+xr::LinkMonitor link_monitor(link_config);
+xr::Discovery discovery(discovery_config);
+xr::SampleScheduler scheduler(sample_schedule);
+
+// Our inputs go out over esp-now (see `Transport`).
+xr::Transport transport;
+
+// The last inputs we sampled.
+int32_t last_x_position = -1;
+int32_t last_y_position = -1;
+uint8_t last_z = 0;
+
+// Whether a background scan for the light host is in flight.
+bool scanning = false;
+
+// A reading of our pins, along with what it was normalized to (see `last_x_position` and friends).
+struct InputSample final {
+  int32_t raw_x;
+  int32_t raw_y;
+  int32_t raw_z;
+  uint32_t sampled_at;
+  bool changed;
+};
 
-  last_debug_log = millis();
-  log_d("setup complete");
-}
+// Updated from the wifi task as the light host acknowledges (or fails to acknowledge) our messages, and
+// drained into the link monitor every frame.
+std::atomic<uint32_t> ack_count(0);
+std::atomic<uint32_t> miss_count(0);
+std::atomic<uint32_t> last_ack_time(0);
+std::atomic<uint32_t> last_ack_latency(0);
+std::atomic<int64_t> last_send_micros(0);
+std::atomic<bool> send_pending(false);
 
-// cppcheck-suppress unusedFunction
-void loop(void) {
-  auto now = millis();
+void sent_cb(const uint8_t* mac_addr, bool delivered) {
+  send_pending = false;
 
-  if (mode == ERuntimeMode::FAILED) {
-    log_e("failed");
-    delay(1000);
+  if (!delivered) {
+    miss_count += 1;
     return;
   }
 
-  if (mode == ERuntimeMode::DISCONNECTED) {
-    log_d("scanning for networks");
-    int n = WiFi.scanNetworks();
-    bool setup_complete = false;
-    log_d("found %d networks on initial scan", n);
-
-    for (int i = 0; i < n; ++i) {
-      auto ssid = WiFi.SSID(i);
-
-      if (ssid == "xiao-runner-light-host") {
-        auto addr_ptr = WiFi.BSSID(i);
-
-        for (uint8_t i = 0; i < 6; i++) {
-          broadcast_address[i] = *addr_ptr;
-
-          // TODO: for some reason the mac address provided by our scan is off by a value of one.
-          if (i == 5) {
-            broadcast_address[i] -= 1;
-          }
-
-          addr_ptr++;
-        }
+  last_ack_latency = esp_timer_get_time() - last_send_micros;
+  last_ack_time = millis();
+  ack_count += 1;
+}
 
-        WiFi.begin("xiao-runner-light-host", "lights-host");
-        uint32_t attempts = 0;
+void tune(uint8_t new_channel) {
+  channel = new_channel;
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
 
-        while (WiFi.status() != WL_CONNECTED) {
-          delay(500);
-          log_d("connecting...");
-          attempts += 1;
+// Starts esp-now on the current channel with the light host at `broadcast_address` as our only peer.
+bool start_esp_now(void) {
+  if (!transport.begin()) {
+    log_e("unable to initialize esp_now");
+    return false;
+  }
 
-          if (attempts > max_failed_ap_connection_attempts) {
-            log_e("too many connection attempts, exiting with re-scan next");
+  transport.on_sent(sent_cb);
 
-            return;
-          }
-        }
+  if (!transport.add_peer(broadcast_address)) {
+    log_e("Failed to add peer");
+    return false;
+  }
 
-        log_d("connection established with light host, swapping to esp-now");
-        WiFi.disconnect();
-        setup_complete = true;
-        break;
-      }
-    }
+  ack_count = 0;
+  miss_count = 0;
+  last_ack_time = 0;
+  send_pending = false;
+  link_monitor.reset(millis());
+  scheduler.start(millis());
 
-    if (!setup_complete) {
-      log_e("no light host network found, exiting");
-      return;
-    }
+  // Lets the radio sleep between our messages; esp-now keeps working across light sleep with it.
+  esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
+  return true;
+}
 
-    WiFi.scanDelete();
+// Waits until our next sample is due, in light sleep when that is long enough to be worth it.
+void wait_for_next_sample(void) {
+  uint32_t wait = scheduler.wait(millis());
 
-    log_d(
-      "final broadcast addr: %02X:%02X:%02X:%02X:%02X:%02X",
-      broadcast_address[0],
-      broadcast_address[1],
-      broadcast_address[2],
-      broadcast_address[3],
-      broadcast_address[4],
-      broadcast_address[5]
-    );
+  if (!scheduler.should_sleep(wait)) {
+    delay(wait);
+    return;
+  }
 
-    log_d("sleeping for a 5 seconds before initializing esp now");
-    delay(5000);
-    log_d("awake, starting esp-now");
+  // Let our last message go out (and be acknowledged) before the radio goes to sleep.
+  uint32_t send_start = millis();
 
-    if (esp_now_init() != ESP_OK) {
-      log_e("unable to initialize esp_now");
-      mode = ERuntimeMode::FAILED;
-      return;
-    }
+  while (send_pending && millis() - send_start < max_send_wait_ms) {
+    delay(1);
+  }
 
-    esp_now_register_send_cb(sent_cb);
+  wait = scheduler.wait(millis());
 
-    memcpy(peer_info.peer_addr, broadcast_address, 6);
-    peer_info.channel = 0;
-    peer_info.encrypt = false;
+  if (!scheduler.should_sleep(wait)) {
+    delay(wait);
+    return;
+  }
 
-    if (esp_now_add_peer(&peer_info) != ESP_OK){
-      mode = ERuntimeMode::FAILED;
-      log_e("Failed to add peer");
-      return;
-    }
+  esp_sleep_enable_timer_wakeup(static_cast<uint64_t>(wait) * 1000);
 
-    failed_send_count = 0;
-    mode = ERuntimeMode::CONNECTED;
-    return;
+  // While the button is held we would be woken right away; it is sampled on the timer instead.
+  if (last_z == 0) {
+    gpio_wakeup_enable(static_cast<gpio_num_t>(Z_BUTTON_PIN), BUTTON_WAKE_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
   }
 
-  delay(10);
+  int64_t sleep_start = esp_timer_get_time();
+  esp_light_sleep_start();
+  scheduler.slept((esp_timer_get_time() - sleep_start) / 1000);
+
+  gpio_wakeup_disable(static_cast<gpio_num_t>(Z_BUTTON_PIN));
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+}
 
+// Reads our pins, updating the last inputs we sampled.
+InputSample sample_inputs(void) {
 #ifndef SWAP_XY_POSITION
   int32_t raw_x = analogRead(X_AXIS_PIN);
   int32_t raw_y = analogRead(Y_AXIS_PIN);
@@ -174,6 +241,10 @@ void loop(void) {
   int32_t raw_x = analogRead(Y_AXIS_PIN);
 #endif
 
+  // When the input was sampled; the light host maps this onto its own clock to apply the input at the
+  // moment it happened rather than whenever it arrives.
+  uint32_t sampled_at = millis();
+
   auto y_position = raw_y > X_TOLERANCE_UPPER
     ? 1
     : (raw_y < X_TOLERANCE_LOWER ? 2 : 0);
@@ -199,27 +270,272 @@ void loop(void) {
   }
 #endif
 
-  memset(message_payload.content, '\0', 40);
-  sprintf(message_payload.content, "[%d|%d|%d]", x_position, y_position, normalized_z);
+  bool changed = x_position != last_x_position || y_position != last_y_position || normalized_z != last_z;
+  last_x_position = x_position;
+  last_y_position = y_position;
+  last_z = normalized_z;
+  return InputSample { raw_x, raw_y, z_position, sampled_at, changed };
+}
+
+// Looks through our background scan, once it has finished, for the light host's access point and starts
+// joining it.
+void poll_scan(uint32_t now) {
+  int n = WiFi.scanComplete();
+
+  if (n == WIFI_SCAN_RUNNING) {
+    return;
+  }
+
+  scanning = false;
+
+  if (n == WIFI_SCAN_FAILED) {
+    log_e("scan failed, scanning again");
+    discovery.missed(now);
+    return;
+  }
+
+  log_d("found %d networks", n);
+
+  for (int i = 0; i < n; ++i) {
+    auto ssid = WiFi.SSID(i);
+
+    if (ssid != "xiao-runner-light-host") {
+      continue;
+    }
+
+    auto addr_ptr = WiFi.BSSID(i);
 
-  esp_err_t result = esp_now_send(broadcast_address, (uint8_t *) &message_payload, sizeof(message_payload));
+    for (uint8_t i = 0; i < 6; i++) {
+      broadcast_address[i] = *addr_ptr;
 
-  failed_send_count += result == 0 ? 0 : failed_send_count + 1;
+      // TODO: for some reason the mac address provided by our scan is off by a value of one.
+      if (i == 5) {
+        broadcast_address[i] -= 1;
+      }
+
+      addr_ptr++;
+    }
+
+    channel = WiFi.channel(i);
+    link_monitor.rssi(WiFi.RSSI(i));
+    WiFi.scanDelete();
+
+    log_d("found light host on channel %d, connecting...", channel);
+    WiFi.begin("xiao-runner-light-host", "lights-host");
+    discovery.found(now);
+    return;
+  }
+
+  WiFi.scanDelete();
+  log_e("no light host network found, scanning again");
+  discovery.missed(now);
+}
+
+// Takes a step towards finding the light host (see `Discovery`), without waiting on the radio.
+void loop_disconnected(uint32_t now) {
+  if (discovery.state() == xr::Discovery::DiscoveryState::IDLE) {
+    discovery.begin(now);
+  }
+
+  switch (discovery.tick(now)) {
+    case xr::Discovery::DiscoveryAction::SEARCH:
+      log_d("scanning for networks");
+      scanning = WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING;
+
+      if (!scanning) {
+        log_e("unable to start scan");
+        discovery.missed(now);
+      }
+
+      break;
+    case xr::Discovery::DiscoveryAction::GIVE_UP:
+      log_e("too many connection attempts, re-scanning");
+      WiFi.disconnect();
+      break;
+    case xr::Discovery::DiscoveryAction::LEAVE:
+      log_d("connection established with light host, swapping to esp-now");
+      WiFi.disconnect();
+      log_d(
+        "final broadcast addr: %02X:%02X:%02X:%02X:%02X:%02X",
+        broadcast_address[0],
+        broadcast_address[1],
+        broadcast_address[2],
+        broadcast_address[3],
+        broadcast_address[4],
+        broadcast_address[5]
+      );
+      break;
+    case xr::Discovery::DiscoveryAction::START:
+      log_d("starting esp-now");
+
+      if (!start_esp_now()) {
+        mode = ERuntimeMode::FAILED;
+        return;
+      }
+
+      pairing_record.channel = channel;
+      pairing_record.count = 0;
+      pairing_record.add(broadcast_address);
+
+      if (!pairing_store.save(pairing_record)) {
+        log_e("unable to persist pairing");
+      }
+
+      pairing.discovered(now);
+      mode = ERuntimeMode::CONNECTED;
+      return;
+    default:
+      break;
+  }
+
+  if (scanning) {
+    poll_scan(now);
+  }
+
+  if (discovery.state() == xr::Discovery::DiscoveryState::JOINING && WiFi.status() == WL_CONNECTED) {
+    discovery.joined(now);
+  }
+}
+
+// cppcheck-suppress unusedFunction
+void setup(void) {
+  Serial.begin(115200);
+  pinMode(Z_BUTTON_PIN, INPUT_PULLUP);
+  digitalWrite(Z_BUTTON_PIN, HIGH);
+
+  log_d("initializing wifi in station mode");
+  WiFi.mode(WIFI_MODE_STA);
+  Serial.println(WiFi.macAddress());
+  log_d("^-- my mac address");
+
+  last_debug_log = millis();
+
+  // With a light host remembered from a previous run there is no need to scan or connect to its access
+  // point; tune to the channel we found it on and start sending right away.
+  bool has_pairing = pairing_store.load(pairing_record);
+  pairing.boot(last_debug_log, has_pairing);
+
+  if (has_pairing) {
+    memcpy(broadcast_address, pairing_record.peers[0].data(), 6);
+    tune(pairing_record.channel);
+    log_d("resuming pairing on channel %d", pairing_record.channel);
+    mode = start_esp_now() ? ERuntimeMode::CONNECTED : ERuntimeMode::FAILED;
+  }
 
-  if (failed_send_count > max_failed_message_sends) {
-    log_e("too many failed message attempts, moving to disconnect");
-    esp_now_deinit();
-    WiFi.disconnect();
+  log_d("setup complete");
+}
+
+// cppcheck-suppress unusedFunction
+void loop(void) {
+  auto now = millis();
+
+  // Neither of these wait on the radio; inputs keep being sampled while we look for the light host.
+  if (mode == ERuntimeMode::FAILED) {
+    if (now - last_debug_log > 1000) {
+      log_e("failed");
+      last_debug_log = now;
+    }
+
+    sample_inputs();
+    delay(SAMPLE_INTERVAL_MS);
+    return;
+  }
+
+  if (mode == ERuntimeMode::DISCONNECTED) {
+    loop_disconnected(now);
+    sample_inputs();
+    delay(SAMPLE_INTERVAL_MS);
+    return;
+  }
+
+  uint32_t acked = ack_count.exchange(0);
+
+  for (uint32_t i = 0; i < acked; i++) {
+    link_monitor.delivered(last_ack_time, last_ack_latency);
+  }
+
+  link_monitor.missed(miss_count.exchange(0));
+
+  if (acked != 0) {
+    pairing.heard(last_ack_time);
+  }
+
+  auto pairing_state = pairing.tick(now);
+  auto action = pairing_state == xr::Pairing::PairingState::PAIRED
+    ? link_monitor.tick(now)
+    : xr::LinkMonitor::LinkAction::NONE;
+
+  if (action == xr::LinkMonitor::LinkAction::REPAIR) {
+    pairing.lost(now);
+  }
+
+  if (pairing.state() == xr::Pairing::PairingState::DISCOVERING) {
+    log_e("light host silent, falling back to discovery");
+    transport.end();
     mode = ERuntimeMode::DISCONNECTED;
     return;
   }
 
+  if (action == xr::LinkMonitor::LinkAction::HOP) {
+    log_e("link lost, moving from channel %d to %d", channel, xr::next_link_channel(channel));
+    tune(xr::next_link_channel(channel));
+  }
+
+  // Remember where we found the light host again if we had to go looking for it.
+  if (link_monitor.state() != xr::LinkMonitor::LinkState::LOST && channel != pairing_record.channel) {
+    pairing_record.channel = channel;
+    pairing_store.save(pairing_record);
+  }
+
+  wait_for_next_sample();
+
+  auto sample = sample_inputs();
+  scheduler.sampled(sample.sampled_at, sample.changed);
+
+  // While the link is lost only the link monitor's retries are sent.
+  if (link_monitor.state() == xr::LinkMonitor::LinkState::LOST && action == xr::LinkMonitor::LinkAction::NONE) {
+    return;
+  }
+
+  // Messages are numbered so that the light host can tell how many of them went missing.
+  sequence += 1;
+  memset(message_payload.content, '\0', 40);
+  xr::InputMessage message {
+    static_cast<uint32_t>(last_x_position),
+    static_cast<uint32_t>(last_y_position),
+    last_z,
+    sequence,
+    sample.sampled_at,
+  };
+  xr::format_input_message(message_payload.content, sizeof(message_payload.content), message);
+
+  last_send_micros = esp_timer_get_time();
+  send_pending = true;
+  bool result = transport.send(broadcast_address, (uint8_t *) &message_payload, sizeof(message_payload));
+
+  if (!result) {
+    send_pending = false;
+    miss_count += 1;
+  }
+
+  if (now - last_power_stats_log > power_stats_interval_ms) {
+    auto stats = scheduler.take_stats(now);
+    log_d(
+      "power: awake %d.%d%% (~%duA), sampling every %dms",
+      stats.duty_cycle / 10,
+      stats.duty_cycle % 10,
+      stats.average_microamps,
+      stats.interval_ms
+    );
+    last_power_stats_log = now;
+  }
+
   if (now - last_debug_log > 500) {
     log_e(
       "frame (%d, %d, %d) '%s' result: %d (sent to %02X:%02X:%02X:%02X:%02X:%02X)",
-      raw_x,
-      raw_y,
-      z_position,
+      sample.raw_x,
+      sample.raw_y,
+      sample.raw_z,
       message_payload.content,
       result,
       broadcast_address[0],
@@ -229,6 +545,14 @@ void loop(void) {
       broadcast_address[4],
       broadcast_address[5]
     );
+    log_d(
+      "link state %d on channel %d (delivery %d, rssi %d, latency %dus)",
+      link_monitor.state(),
+      channel,
+      link_monitor.delivery(),
+      link_monitor.rssi(),
+      link_monitor.latency()
+    );
     last_debug_log = now;
   }
 }
@@ -0,0 +1,44 @@
+#pragma once
+
+// Just enough of the arduino core for the engine headers (see `xiao-lights/src`) to build on a host.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Both clocks count from the same point in every process, so that times sent between them (e.g by a
+// virtual controller) can be compared.
+inline uint32_t millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Critical sections keep the wifi task and the main loop apart on the light host; here they keep the
+// transport's thread and the main thread apart.
+struct portMUX_TYPE {
+  std::atomic<bool> locked { false };
+};
+
+#define portMUX_INITIALIZER_UNLOCKED portMUX_TYPE {}
+
+inline void portENTER_CRITICAL(portMUX_TYPE * mux) {
+  while (mux->locked.exchange(true, std::memory_order_acquire)) {
+  }
+}
+
+inline void portEXIT_CRITICAL(portMUX_TYPE * mux) {
+  mux->locked.store(false, std::memory_order_release);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdio.h>
+
+#ifndef CORE_DEBUG_LEVEL
+#define CORE_DEBUG_LEVEL 0
+#endif
+
+#define log_printf(...) printf(__VA_ARGS__)
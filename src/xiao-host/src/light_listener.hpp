@@ -0,0 +1,187 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "level.hpp"
+#include "peers.hpp"
+#include "transport.hpp"
+#include "input_message.hpp"
+
+namespace xr {
+  struct LightListenerConfig final {
+    uint16_t port;
+    uint32_t pixels;
+    uint32_t seconds;
+
+    // See `INPUT_DELAY_MS` in the light host.
+    uint32_t input_delay_ms;
+
+    // Draws the strip on the terminal while playing.
+    bool render;
+  };
+
+  struct LightListenerReport final {
+    uint32_t controllers;
+    uint32_t delivered;
+    uint32_t missed;
+    uint64_t frames;
+
+    // From a controller sampling a changed input to the first frame built with it, in ms.
+    uint32_t inputs;
+    double mean_latency_ms;
+    uint32_t p99_latency_ms;
+    uint32_t max_latency_ms;
+  };
+
+  // Runs the light host's input path off of the device: controller messages arrive over a `Transport`,
+  // are parsed and queued per controller (see `Peers`) and applied to the level in fixed ticks, a fixed
+  // delay behind the present, the same way the light host does it.
+  class LightListener final {
+    public:
+      constexpr static const uint32_t TICK_MS = 5;
+
+      // How often a frame is built, about as often as the light host can push out its strip.
+      constexpr static const uint32_t FRAME_US = 4500;
+
+      explicit LightListener(const LightListenerConfig& config): _config(config), _transport(config.port) {}
+      ~LightListener() = default;
+
+      LightListener(const LightListener&) = delete;
+      LightListener& operator=(const LightListener&) = delete;
+
+      bool run(const std::vector<std::pair<const char *, uint32_t>>& levels, LightListenerReport& report) {
+        _active = this;
+        _transport.on_receive(receive_cb);
+
+        if (!_transport.begin()) {
+          return false;
+        }
+
+        uint32_t level_index = 0;
+        auto level = std::make_unique<const Level>(levels[level_index], _config.pixels);
+        std::array<uint32_t, MAX_PLAYERS> input_times {};
+        std::array<std::optional<ControllerInput>, MAX_PLAYERS> applied {};
+        std::vector<uint32_t> latencies;
+        uint32_t started = millis();
+        uint32_t simulation_time = started - _config.input_delay_ms;
+        uint32_t last_render = 0;
+        report = LightListenerReport { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        while (millis() - started < _config.seconds * 1000) {
+          uint32_t target_time = millis() - _config.input_delay_ms;
+
+          while (static_cast<int32_t>(target_time - simulation_time) >= static_cast<int32_t>(TICK_MS)) {
+            simulation_time += TICK_MS;
+            auto inputs = _peers.take(simulation_time);
+            auto next = std::move(*level).frame(simulation_time, inputs);
+            level = std::make_unique<const Level>(std::move(next));
+            report.frames += 1;
+
+            // Inputs are timed when they are first taken, and only when they changed; held inputs are
+            // taken over and over.
+            for (uint8_t i = 0; i < _peers.count(); i++) {
+              uint32_t time = _peers.input_time(i);
+
+              if (time == input_times[i] || !inputs[i].has_value()) {
+                continue;
+              }
+
+              input_times[i] = time;
+
+              if (applied[i] != inputs[i]) {
+                latencies.push_back(millis() - time);
+              }
+
+              applied[i] = inputs[i];
+            }
+
+            if (level->state() == Level::LevelStateKind::FAILED) {
+              level->restart(true);
+            } else if (level->state() == Level::LevelStateKind::COMPLETE) {
+              level_index = (level_index + 1) % levels.size();
+              level = std::make_unique<const Level>(levels[level_index], _config.pixels);
+            }
+          }
+
+          if (_config.render && millis() - last_render >= 50) {
+            render(*level);
+            last_render = millis();
+          }
+
+          std::this_thread::sleep_for(std::chrono::microseconds(FRAME_US));
+        }
+
+        _transport.end();
+
+        if (_config.render) {
+          fprintf(stderr, "\n");
+        }
+
+        auto counts = _peers.take_link_counts();
+        report.controllers = _peers.count();
+        report.delivered = counts.delivered;
+        report.missed = counts.missed;
+        report.inputs = latencies.size();
+
+        if (!latencies.empty()) {
+          std::sort(latencies.begin(), latencies.end());
+          uint64_t total = 0;
+
+          for (auto latency = latencies.begin(); latency != latencies.end(); latency++) {
+            total += *latency;
+          }
+
+          report.mean_latency_ms = static_cast<double>(total) / latencies.size();
+          report.p99_latency_ms = latencies[latencies.size() * 99 / 100];
+          report.max_latency_ms = latencies.back();
+        }
+
+        return true;
+      }
+
+    private:
+      static void receive_cb(const uint8_t * address, const uint8_t * data, int size) {
+        char content[121] = {};
+        int length = std::min(size, 120);
+        memcpy(content, data, length);
+        auto message = parse_input_message(content, length);
+        auto input = std::make_tuple(message.x, message.y, message.z);
+        _active->_peers.receive(address, ControllerMessage { input, message.sequence, message.time }, millis());
+      }
+
+      // Every light as a colored block, on a single line.
+      void render(const Level& level) {
+        std::vector<std::array<uint8_t, 3>> strip(_config.pixels, std::array<uint8_t, 3> { 0, 0, 0 });
+
+        for (auto light = level.light_begin(); light != level.light_end(); light++) {
+          auto [position, red, green, blue] = *light;
+
+          if (position < strip.size()) {
+            strip[position] = std::array<uint8_t, 3> { red, green, blue };
+          }
+        }
+
+        fprintf(stderr, "\r");
+
+        for (auto color = strip.begin(); color != strip.end(); color++) {
+          fprintf(stderr, "\x1b[38;2;%u;%u;%um█", (*color)[0], (*color)[1], (*color)[2]);
+        }
+
+        fprintf(stderr, "\x1b[0m");
+      }
+
+      inline static LightListener * _active = nullptr;
+
+      LightListenerConfig _config;
+      UdpTransport _transport;
+      Peers _peers;
+  };
+}
@@ -0,0 +1,641 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "flash_region.hpp"
+#include "framebuffer.hpp"
+#include "level_pack.hpp"
+#include "level.hpp"
+#include "level_generator.hpp"
+#include "particles.hpp"
+#include "solver.hpp"
+#include "light_listener.hpp"
+#include "virtual_controller.hpp"
+#include "sync_simulation.hpp"
+#include "work_pool.hpp"
+
+// Runs the light host's engine headlessly, for things that are easier done off of the device:
+//
+// analyze <levels>  searches each level for a way through it (see `xr::Solver`), reporting whether it
+//                   could be beaten, how quickly and how hard it was to find a way through.
+// bench <levels>    plays levels with random inputs on every core, as fast as they will go, and reports
+//                   the engine's throughput; `--players` sets how many players are playing.
+// sync <levels>     plays the first level across a leading light host and its followers (see
+//                   `xr::SyncSimulation`) over a simulated radio, and reports how closely each follower
+//                   presented the leader's frames.
+// listen <levels>   runs the light host's input path (see `xr::LightListener`) over udp on localhost,
+//                   reporting message rates, drops and the latency from input to frame.
+// control <script>  sends inputs from a script (or the keyboard, for `-`) to `listen` the way a
+//                   controller would (see `xr::VirtualController`).
+// generate <seed>   prints the levels the light host generates from `seed` (see `xr::LevelGenerator`),
+//                   one per difficulty, in the same format as `embed/levels.txt`.
+// particles <count> keeps `count` particles alive (see `xr::Particles`), updating them and adding them to
+//                   a framebuffer every frame, and reports how long that takes per frame.
+// framebuffer <count> builds frames of `count` lights on strips of `pixels` (and two and four times
+//                   that), clearing, setting and writing them out (see `xr::Framebuffer`), and reports
+//                   what each of those stages costs per frame.
+// scripts <count>   plays a level of `count` pawns, then one of `count` scripted obstacles that patrol
+//                   the same way (see `xr::Script`), and reports what each kind of obstacle costs a frame.
+//
+// Levels are read from either a compiled pack (see `tools/pack_levels.py`) or the text it is compiled
+// from, e.g `embed/levels.txt`.
+
+struct Options final {
+  const char * command;
+  const char * levels;
+  uint32_t threads;
+  uint32_t pixels;
+  uint32_t beam;
+  uint32_t seconds;
+  uint32_t count;
+  uint32_t nodes;
+  uint32_t loss;
+  uint32_t port;
+  uint32_t peer;
+  uint32_t interval;
+  uint32_t render;
+  uint32_t players;
+};
+
+static void usage(const char * program) {
+  fprintf(stderr, "usage: %s <analyze|bench> <levels> [--threads N] [--pixels N] [--beam N] [--seconds N] [--players N]\n", program);
+  fprintf(stderr, "       %s sync <levels> [--pixels N] [--seconds N] [--nodes N] [--loss PERMILLE]\n", program);
+  fprintf(stderr, "       %s listen <levels> [--pixels N] [--seconds N] [--port N] [--render 1]\n", program);
+  fprintf(stderr, "       %s control <script|-> [--seconds N] [--port N] [--peer N] [--interval MS] [--loss PERMILLE]\n", program);
+  fprintf(stderr, "       %s generate <seed> [--pixels N] [--count N]\n", program);
+  fprintf(stderr, "       %s particles <count> [--pixels N] [--seconds N]\n", program);
+  fprintf(stderr, "       %s framebuffer <count> [--pixels N] [--seconds N]\n", program);
+  fprintf(stderr, "       %s scripts <count> [--pixels N] [--seconds N]\n", program);
+}
+
+static bool parse_options(int argc, char ** argv, Options& options) {
+  if (argc < 3) {
+    return false;
+  }
+
+  options.command = argv[1];
+  options.levels = argv[2];
+
+  for (int i = 3; i + 1 < argc; i += 2) {
+    uint32_t value = strtoul(argv[i + 1], nullptr, 10);
+
+    if (strcmp(argv[i], "--threads") == 0) {
+      options.threads = value;
+    } else if (strcmp(argv[i], "--pixels") == 0) {
+      options.pixels = value;
+    } else if (strcmp(argv[i], "--beam") == 0) {
+      options.beam = value;
+    } else if (strcmp(argv[i], "--seconds") == 0) {
+      options.seconds = value;
+    } else if (strcmp(argv[i], "--count") == 0) {
+      options.count = value;
+    } else if (strcmp(argv[i], "--nodes") == 0) {
+      options.nodes = value;
+    } else if (strcmp(argv[i], "--loss") == 0) {
+      options.loss = value;
+    } else if (strcmp(argv[i], "--port") == 0) {
+      options.port = value;
+    } else if (strcmp(argv[i], "--peer") == 0) {
+      options.peer = value;
+    } else if (strcmp(argv[i], "--interval") == 0) {
+      options.interval = value;
+    } else if (strcmp(argv[i], "--render") == 0) {
+      options.render = value;
+    } else if (strcmp(argv[i], "--players") == 0) {
+      options.players = value;
+    } else {
+      return false;
+    }
+  }
+
+  return (argc - 3) % 2 == 0;
+}
+
+// The layout of every level in a (mapped) pack or text file.
+static std::vector<std::pair<const char *, uint32_t>> read_levels(const xr::FlashRegion& region) {
+  std::vector<std::pair<const char *, uint32_t>> levels;
+  xr::LevelPack pack(region.data(), region.size());
+
+  if (pack.is_valid()) {
+    for (uint32_t i = 0; i < pack.count(); i++) {
+      levels.push_back(pack.level(i));
+    }
+
+    return levels;
+  }
+
+  auto start = reinterpret_cast<const char *>(region.data());
+  auto end = start + region.size();
+
+  for (auto cursor = start; cursor < end; cursor++) {
+    if (*cursor != '\n') {
+      continue;
+    }
+
+    if (cursor > start) {
+      levels.push_back(std::make_pair(start, static_cast<uint32_t>(cursor - start)));
+    }
+
+    start = cursor + 1;
+  }
+
+  if (end > start) {
+    levels.push_back(std::make_pair(start, static_cast<uint32_t>(end - start)));
+  }
+
+  return levels;
+}
+
+static int analyze(xr::WorkPool& pool, const Options& options, const std::vector<std::pair<const char *, uint32_t>>& levels) {
+  xr::SolverConfig config {
+    options.beam,  // beam_width
+    50,            // decision_ms
+    5,             // tick_ms
+    120000,        // time_limit_ms
+    8,             // states_per_task
+  };
+
+  std::vector<xr::Solution> solutions(levels.size());
+  xr::WorkPool::Group group;
+  auto started = std::chrono::steady_clock::now();
+
+  // Levels are searched side by side, and each search shares its own work out across the pool.
+  for (uint32_t i = 0; i < levels.size(); i++) {
+    pool.submit(group, [&, i]() {
+      xr::Solver solver(pool, config);
+      solutions[i] = solver.solve(levels[i], options.pixels);
+    });
+  }
+
+  pool.wait(group);
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  uint64_t frames = 0;
+  bool all_beatable = true;
+
+  printf("%-6s %-8s %-11s %-9s %-11s %-12s\n", "level", "length", "result", "time", "difficulty", "frames");
+
+  for (uint32_t i = 0; i < levels.size(); i++) {
+    const auto& solution = solutions[i];
+    char time[16] = "-";
+
+    if (solution.beatable) {
+      snprintf(time, sizeof(time), "%.2fs", solution.completion_ms / 1000.0);
+    }
+
+    auto [text, size] = levels[i];
+    auto scripts = std::find(text, text + size, xr::ScriptLibrary::SEPARATOR);
+
+    printf(
+      "%-6u %-8u %-11s %-9s %-11u %-12llu\n",
+      i,
+      static_cast<uint32_t>(scripts - text),
+      solution.beatable ? "beatable" : "unbeaten",
+      time,
+      solution.difficulty,
+      static_cast<unsigned long long>(solution.frames)
+    );
+
+    frames += solution.frames;
+    all_beatable = all_beatable && solution.beatable;
+  }
+
+  printf("\n%llu frames in %.2fs (%.2fM frames/s) on %u threads\n", static_cast<unsigned long long>(frames), elapsed, frames / elapsed / 1e6, pool.size());
+  return all_beatable ? 0 : 2;
+}
+
+// Every player gets inputs of their own, changing every 50ms.
+static int bench(xr::WorkPool& pool, const Options& options, const std::vector<std::pair<const char *, uint32_t>>& levels) {
+  uint32_t players = std::clamp<uint32_t>(options.players, 1, MAX_PLAYERS);
+  std::atomic<uint64_t> frames(0);
+  std::atomic<uint32_t> restarts(0);
+  xr::WorkPool::Group group;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.seconds);
+
+  for (uint32_t worker = 0; worker < pool.size(); worker++) {
+    pool.submit(group, [&, worker]() {
+      uint32_t seed = 0x9e3779b9 * (worker + 1);
+      uint32_t level_index = worker % levels.size();
+      uint32_t now = 1;
+      uint64_t count = 0;
+      PlayerInputs inputs {};
+      const Level level(levels[level_index], options.pixels);
+
+      while (std::chrono::steady_clock::now() < deadline) {
+        // A batch at a time, so that reading the clock does not show up in the numbers.
+        for (uint32_t i = 0; i < 4096; i++) {
+          for (uint32_t player = 0; i % 10 == 0 && player < players; player++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            inputs[player] = std::make_tuple(seed % 3, 0, (seed >> 8) % 8 == 0 ? 1 : 0);
+          }
+
+          now += 5;
+          auto next = std::move(level).frame(now, inputs);
+          level = std::move(next);
+          count++;
+
+          if (level.outcome() != Level::LevelStateKind::IN_PROGRESS) {
+            level.restart(false);
+            restarts.fetch_add(1);
+          }
+        }
+      }
+
+      frames.fetch_add(count);
+    });
+  }
+
+  pool.wait(group);
+
+  double per_thread = frames.load() / static_cast<double>(options.seconds) / pool.size();
+
+  printf(
+    "%llu frames in %us (%.2fM frames/s, %.2fM per thread, %.0fns per frame) on %u threads, %u players, %u restarts\n",
+    static_cast<unsigned long long>(frames.load()),
+    options.seconds,
+    frames.load() / static_cast<double>(options.seconds) / 1e6,
+    per_thread / 1e6,
+    1e9 / std::max(per_thread, 1.0),
+    pool.size(),
+    players,
+    restarts.load()
+  );
+
+  return 0;
+}
+
+static int sync(const Options& options, const std::vector<std::pair<const char *, uint32_t>>& levels) {
+  xr::SyncSimulationConfig config {
+    std::max(options.nodes, 2u), // nodes
+    options.pixels,              // pixels
+    options.seconds,             // seconds
+    options.loss,                // loss
+    1000,                        // margin_us
+  };
+
+  xr::SyncSimulation simulation(config);
+  std::vector<xr::SyncNodeReport> reports;
+  uint32_t frames = simulation.run(levels[0], reports);
+
+  uint32_t mismatched = 0;
+
+  printf("%-6s %-10s %-8s %-12s %-15s %-15s\n", "node", "presented", "late", "mismatched", "mean error (us)", "max error (us)");
+
+  for (uint32_t i = 0; i < reports.size(); i++) {
+    const auto& report = reports[i];
+    printf("%-6u %-10u %-8u %-12u %-15.0f %-15.0f\n", i + 1, report.presented, report.late, report.mismatched, report.mean_error_us, report.max_error_us);
+    mismatched += report.mismatched;
+  }
+
+  printf("\n%u frames presented by the leader in %us, %u lights dropped\n", frames, options.seconds, simulation.dropped());
+  return mismatched == 0 ? 0 : 2;
+}
+
+static int listen_for_controllers(const Options& options, const std::vector<std::pair<const char *, uint32_t>>& levels) {
+  xr::LightListenerConfig config {
+    static_cast<uint16_t>(options.port == 0 ? xr::UdpTransport::DEFAULT_PORT : options.port), // port
+    options.pixels,                                                                           // pixels
+    options.seconds,                                                                          // seconds
+    30,                                                                                       // input_delay_ms
+    options.render != 0,                                                                      // render
+  };
+
+  xr::LightListener listener(config);
+  xr::LightListenerReport report;
+
+  if (!listener.run(levels, report)) {
+    fprintf(stderr, "unable to listen on port %u\n", config.port);
+    return 1;
+  }
+
+  printf(
+    "%u controllers, %u messages (%.1f/s), %u missed, %llu frames\n",
+    report.controllers,
+    report.delivered,
+    report.delivered / static_cast<double>(options.seconds),
+    report.missed,
+    static_cast<unsigned long long>(report.frames)
+  );
+  printf(
+    "%u inputs, input to frame %.1fms mean, %ums p99, %ums max\n",
+    report.inputs,
+    report.mean_latency_ms,
+    report.p99_latency_ms,
+    report.max_latency_ms
+  );
+
+  return 0;
+}
+
+static int control(const Options& options) {
+  xr::VirtualControllerConfig config {
+    static_cast<uint16_t>(options.port == 0 ? xr::UdpTransport::DEFAULT_PORT + 1 : options.port), // port
+    static_cast<uint16_t>(options.peer == 0 ? xr::UdpTransport::DEFAULT_PORT : options.peer),     // light_port
+    options.interval,                                                                             // interval_ms
+    options.loss,                                                                                 // loss
+    options.seconds,                                                                              // seconds
+  };
+
+  xr::VirtualController controller(config);
+  xr::VirtualControllerReport report;
+  bool played = false;
+
+  if (strcmp(options.levels, "-") == 0) {
+    played = controller.play_keyboard(report);
+  } else {
+    FILE * file = fopen(options.levels, "r");
+    std::vector<xr::VirtualController::Step> steps;
+
+    if (file == nullptr || !xr::VirtualController::read_script(file, steps)) {
+      fprintf(stderr, "unable to read script '%s'\n", options.levels);
+      return 1;
+    }
+
+    fclose(file);
+    played = controller.play(steps, report);
+  }
+
+  if (!played) {
+    fprintf(stderr, "unable to send from port %u\n", config.port);
+    return 1;
+  }
+
+  printf(
+    "%u messages sent (%.1f/s), %u dropped, %u failed\n",
+    report.sent,
+    report.sent * 1000.0 / std::max(report.elapsed_ms, 1u),
+    report.dropped,
+    report.failed
+  );
+
+  return 0;
+}
+
+static int generate(const Options& options) {
+  uint32_t seed = strtoul(options.levels, nullptr, 10);
+  std::vector<xr::GeneratedLevel> levels(options.count);
+  auto started = std::chrono::steady_clock::now();
+
+  for (uint32_t difficulty = 0; difficulty < options.count; difficulty++) {
+    levels[difficulty] = xr::LevelGenerator::generate(seed, difficulty, options.pixels);
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+  for (auto level = levels.cbegin(); level != levels.cend(); level++) {
+    std::vector<char> line(level->length, ' ');
+    level->each([&line](char token, uint32_t position) {
+      line[position] = token;
+    });
+    printf("%.*s\n", static_cast<int>(line.size()), line.data());
+  }
+
+  fprintf(stderr, "generated %u levels in %.1fus each\n", options.count, elapsed * 1e6 / std::max(options.count, 1u));
+  return 0;
+}
+
+// Frames are simulated 5ms apart, like the light host's ticks; bursts are thrown out at random until
+// there are `count` particles alive, and then as often as particles fade out.
+static int particles(const Options& options) {
+  uint32_t target = std::min<uint32_t>(strtoul(options.levels, nullptr, 10), xr::Particles::CAPACITY);
+  const xr::Burst burst = { 16, 14, 900, std::make_tuple(255, 60, 0) };
+  xr::Particles pool;
+  xr::Camera camera(options.pixels, options.pixels);
+  xr::Framebuffer framebuffer(options.pixels, 20);
+  xr::Random random(target, 0);
+  uint32_t now = 1;
+  uint64_t frames = 0;
+  uint64_t live = 0;
+  uint64_t total_ns = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.seconds);
+
+  while (std::chrono::steady_clock::now() < deadline) {
+    while (pool.count() + burst.count <= target) {
+      pool.emit(random.below(options.pixels), burst);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    now += 5;
+    pool.update(now);
+    framebuffer.clear();
+    pool.render(camera, [&framebuffer](const Light& light, uint8_t intensity) {
+      framebuffer.add(light, intensity);
+    });
+    auto took = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started);
+
+    total_ns += took.count();
+    live += pool.count();
+    frames += 1;
+  }
+
+  double mean_live = static_cast<double>(live) / std::max<uint64_t>(frames, 1);
+  double mean_us = total_ns / 1e3 / std::max<uint64_t>(frames, 1);
+
+  printf(
+    "%llu frames with %.0f particles alive on average: %.2fus per frame (%.1fns per particle)\n",
+    static_cast<unsigned long long>(frames),
+    mean_live,
+    mean_us,
+    mean_us * 1e3 / std::max(mean_live, 1.0)
+  );
+
+  return 0;
+}
+
+// Frames are built the way the light host builds them: cleared, `count` lights set across the strip, then
+// written out, dithering down to 8 bits, into a strip's own buffer of packed colors (as a segment does).
+static int framebuffer(const Options& options) {
+  uint32_t count = strtoul(options.levels, nullptr, 10);
+
+  printf("%-8s %-8s %-12s %-12s %-12s %-12s\n", "pixels", "lights", "clear (us)", "set (us)", "write (us)", "frame (us)");
+
+  for (uint32_t scale = 1; scale <= 4; scale *= 2) {
+    uint32_t pixels = options.pixels * scale;
+    xr::Framebuffer framebuffer(pixels, 20);
+    std::vector<uint32_t> strip(pixels, 0);
+    std::vector<Light> lights;
+
+    for (uint32_t i = 0; i < count; i++) {
+      lights.push_back(std::make_tuple(static_cast<uint32_t>((static_cast<uint64_t>(i) * pixels) / count), i * 37, i * 11, 255 - i));
+    }
+
+    uint64_t frames = 0;
+    uint64_t clear_ns = 0;
+    uint64_t set_ns = 0;
+    uint64_t write_ns = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(options.seconds);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+      auto started = std::chrono::steady_clock::now();
+      framebuffer.clear();
+      auto cleared = std::chrono::steady_clock::now();
+
+      for (auto light = lights.cbegin(); light != lights.cend(); light++) {
+        framebuffer.set(*light);
+      }
+
+      auto set = std::chrono::steady_clock::now();
+      framebuffer.render(0, pixels, [&strip](uint32_t position, uint8_t red, uint8_t green, uint8_t blue) {
+        strip[position] = (static_cast<uint32_t>(green) << 16) | (static_cast<uint32_t>(red) << 8) | blue;
+      });
+      auto written = std::chrono::steady_clock::now();
+
+      clear_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(cleared - started).count();
+      set_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(set - cleared).count();
+      write_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(written - set).count();
+      frames += 1;
+    }
+
+    double per_frame = std::max<uint64_t>(frames, 1) * 1e3;
+    printf(
+      "%-8u %-8u %-12.2f %-12.2f %-12.2f %-12.2f\n",
+      pixels,
+      count,
+      clear_ns / per_frame,
+      set_ns / per_frame,
+      write_ns / per_frame,
+      (clear_ns + set_ns + write_ns) / per_frame
+    );
+  }
+
+  return 0;
+}
+
+// How long a frame of `layout` takes on average, in nanoseconds, with nobody playing.
+static double time_frames(const std::string& layout, const Options& options) {
+  const Level level(std::make_pair(layout.c_str(), static_cast<uint32_t>(layout.size())), options.pixels);
+  PlayerInputs inputs {};
+  uint32_t now = 1;
+  uint64_t frames = 0;
+  auto started = std::chrono::steady_clock::now();
+  auto deadline = started + std::chrono::seconds(options.seconds);
+
+  while (std::chrono::steady_clock::now() < deadline) {
+    for (uint32_t i = 0; i < 4096; i++) {
+      now += 5;
+      auto next = std::move(level).frame(now, inputs);
+      level = std::move(next);
+    }
+
+    frames += 4096;
+  }
+
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / frames;
+}
+
+// Pawns patrol ten lights either side of where they start, a light every 100ms; the script does the same.
+static int scripts(const Options& options) {
+  const char * patrol = "|0: killable color 255 20 0 set r0 10 out: wait 100 step loop r0 out turn "
+    "back: set r0 20 in: wait 100 step loop r0 in turn jump back";
+  uint32_t count = strtoul(options.levels, nullptr, 10);
+  std::string empty(std::max(options.pixels, 16 + count * 3), ' ');
+  empty.front() = 'p';
+  empty.back() = 'g';
+  std::string native = empty;
+  std::string scripted = empty;
+
+  for (uint32_t i = 0; i < count; i++) {
+    native[12 + i * 3] = 'x';
+    scripted[12 + i * 3] = '0';
+  }
+
+  double empty_ns = time_frames(empty, options);
+  double native_ns = time_frames(native, options);
+  double scripted_ns = time_frames(scripted + patrol, options);
+
+  printf("%-10s%-14s%-14s\n", "level", "ns/frame", "ns/obstacle");
+  printf("%-10s%-14.0f%-14s\n", "empty", empty_ns, "-");
+  printf("%-10s%-14.0f%-14.1f\n", "native", native_ns, (native_ns - empty_ns) / std::max(count, 1u));
+  printf("%-10s%-14.0f%-14.1f\n", "scripted", scripted_ns, (scripted_ns - empty_ns) / std::max(count, 1u));
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  Options options {
+    nullptr,                             // command
+    nullptr,                             // levels
+    std::thread::hardware_concurrency(), // threads
+    146,                                 // pixels
+    256,                                 // beam
+    5,                                   // seconds
+    16,                                  // count
+    4,                                   // nodes
+    0,                                   // loss
+    0,                                   // port
+    0,                                   // peer
+    10,                                  // interval
+    0,                                   // render
+    1,                                   // players
+  };
+
+  if (!parse_options(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (strcmp(options.command, "generate") == 0) {
+    return generate(options);
+  }
+
+  if (strcmp(options.command, "control") == 0) {
+    return control(options);
+  }
+
+  if (strcmp(options.command, "particles") == 0) {
+    return particles(options);
+  }
+
+  if (strcmp(options.command, "framebuffer") == 0) {
+    return framebuffer(options);
+  }
+
+  if (strcmp(options.command, "scripts") == 0) {
+    return scripts(options);
+  }
+
+  xr::FlashRegion region(options.levels);
+
+  if (!region.is_mapped()) {
+    fprintf(stderr, "unable to read levels from '%s'\n", options.levels);
+    return 1;
+  }
+
+  auto levels = read_levels(region);
+
+  if (levels.empty()) {
+    fprintf(stderr, "no levels in '%s'\n", options.levels);
+    return 1;
+  }
+
+  xr::WorkPool pool(options.threads);
+
+  if (strcmp(options.command, "analyze") == 0) {
+    return analyze(pool, options, levels);
+  }
+
+  if (strcmp(options.command, "bench") == 0) {
+    return bench(pool, options, levels);
+  }
+
+  if (strcmp(options.command, "sync") == 0) {
+    return sync(options, levels);
+  }
+
+  if (strcmp(options.command, "listen") == 0) {
+    return listen_for_controllers(options, levels);
+  }
+
+  usage(argv[0]);
+  return 1;
+}
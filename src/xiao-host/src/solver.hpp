@@ -0,0 +1,273 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "types.hpp"
+#include "level.hpp"
+#include "work_pool.hpp"
+
+namespace xr {
+  struct SolverConfig final {
+    // How many of the most promising states are kept after every decision.
+    uint32_t beam_width;
+
+    // How long each input is held for before the next decision, and the simulation tick (which should
+    // match the light host's).
+    uint32_t decision_ms;
+    uint32_t tick_ms;
+
+    // Levels not beaten within this much (simulated) time are given up on.
+    uint32_t time_limit_ms;
+
+    // How many states each task expands; tasks are the unit of work shared out across the pool.
+    uint32_t states_per_task;
+  };
+
+  struct Solution final {
+    bool beatable;
+
+    // The quickest completion found, in simulated ms.
+    uint32_t completion_ms;
+
+    // The share of explored moves that got the player hit, in percent; levels with fewer safe moves
+    // are harder to beat.
+    uint32_t difficulty;
+
+    uint64_t frames;
+    uint64_t states;
+  };
+
+  // Searches the inputs of a single player for a way through a level, by running the real engine: a beam
+  // search over the (deterministic) simulation, where every state in the beam is expanded with each of
+  // the moves a controller can make, held for `decision_ms`, and the states that got furthest are kept.
+  //
+  // The search is not exhaustive, so a level it cannot beat is only unbeatable as far as the beam could
+  // see; a wider beam looks harder.
+  class Solver final {
+    public:
+      // Every move a controller can make: right, idle or left, each with or without attacking.
+      constexpr static const std::array<std::tuple<uint32_t, uint32_t, uint8_t>, 6> MOVES = {
+        std::make_tuple(1, 0, 0),
+        std::make_tuple(1, 0, 1),
+        std::make_tuple(0, 0, 0),
+        std::make_tuple(0, 0, 1),
+        std::make_tuple(2, 0, 0),
+        std::make_tuple(2, 0, 1),
+      };
+
+      Solver(WorkPool& pool, const SolverConfig& config): _pool(pool), _config(config) {}
+      ~Solver() = default;
+
+      Solver(const Solver&) = delete;
+      Solver& operator=(const Solver&) = delete;
+
+      Solution solve(std::pair<const char *, uint32_t> layout, uint32_t bound) {
+        Level initial(layout, bound);
+        uint32_t obstacles = initial.obstacle_count();
+        uint32_t capacity = _config.beam_width * MOVES.size();
+
+        Generation beam(_config.beam_width, obstacles);
+        Generation children(capacity, obstacles);
+        std::vector<std::pair<uint64_t, uint32_t>> ranked;
+        std::unordered_set<uint64_t> seen;
+        ranked.reserve(capacity);
+        seen.reserve(capacity);
+
+        std::atomic<uint64_t> frames(0);
+        std::atomic<uint64_t> fatal(0);
+        std::atomic<uint32_t> best(UINT32_MAX);
+        uint64_t states = 0;
+
+        initial.save(beam.levels[0], beam.obstacles.data());
+        beam.size = 1;
+
+        // Engine timers treat a time of zero as never having been ticked.
+        for (uint32_t time = 1; beam.size > 0 && best.load() == UINT32_MAX && time < _config.time_limit_ms; time += _config.decision_ms) {
+          WorkPool::Group group;
+
+          for (uint32_t start = 0; start < beam.size; start += _config.states_per_task) {
+            uint32_t end = std::min(start + _config.states_per_task, beam.size);
+
+            _pool.submit(group, [&, start, end, time]() {
+              auto counts = expand(layout, bound, beam, children, start, end, time, best);
+              frames.fetch_add(counts.first);
+              fatal.fetch_add(counts.second);
+            });
+          }
+
+          _pool.wait(group);
+          states += beam.size * MOVES.size();
+
+          // Keep the furthest along of the distinct states that survived.
+          ranked.clear();
+          seen.clear();
+
+          for (uint32_t i = 0; i < beam.size * MOVES.size(); i++) {
+            if (children.alive[i] && seen.insert(children.keys[i]).second) {
+              ranked.push_back(std::make_pair(children.scores[i], i));
+            }
+          }
+
+          uint32_t kept = std::min(static_cast<uint32_t>(ranked.size()), _config.beam_width);
+          std::partial_sort(ranked.begin(), ranked.begin() + kept, ranked.end(), std::greater<std::pair<uint64_t, uint32_t>>());
+
+          for (uint32_t i = 0; i < kept; i++) {
+            beam.copy(i, children, ranked[i].second);
+          }
+
+          beam.size = kept;
+        }
+
+        return Solution {
+          best.load() != UINT32_MAX,
+          best.load() == UINT32_MAX ? 0 : best.load(),
+          states == 0 ? 0 : static_cast<uint32_t>(fatal.load() * 100 / states),
+          frames.load(),
+          states
+        };
+      }
+
+    private:
+      // A set of level states (and their obstacles), stored flat so that a whole generation is allocated
+      // once per level.
+      struct Generation final {
+        Generation(uint32_t capacity, uint32_t obstacle_count):
+          levels(capacity),
+          obstacles(std::max(capacity * obstacle_count, 1u)),
+          scores(capacity, 0),
+          keys(capacity, 0),
+          alive(capacity, 0),
+          obstacle_count(obstacle_count),
+          size(0) {
+          }
+
+        Obstacle::Snapshot * obstacles_of(uint32_t index) {
+          return obstacles.data() + index * obstacle_count;
+        }
+
+        void copy(uint32_t index, Generation& from, uint32_t source) {
+          levels[index] = from.levels[source];
+          std::copy(from.obstacles_of(source), from.obstacles_of(source) + obstacle_count, obstacles_of(index));
+        }
+
+        std::vector<Level::Snapshot> levels;
+        std::vector<Obstacle::Snapshot> obstacles;
+        std::vector<uint64_t> scores;
+        std::vector<uint64_t> keys;
+        std::vector<uint8_t> alive;
+        uint32_t obstacle_count;
+        uint32_t size;
+      };
+
+      // Expands the beam states in [start, end) with every move, returning the frames simulated and how
+      // many moves got the player hit. Each task builds its own level to simulate on.
+      std::pair<uint64_t, uint64_t> expand(
+        std::pair<const char *, uint32_t> layout,
+        uint32_t bound,
+        Generation& beam,
+        Generation& children,
+        uint32_t start,
+        uint32_t end,
+        uint32_t time,
+        std::atomic<uint32_t>& best
+      ) {
+        const Level level(layout, bound);
+        PlayerInputs inputs {};
+        uint64_t frames = 0, fatal = 0;
+
+        for (uint32_t state = start; state < end; state++) {
+          for (uint32_t move = 0; move < MOVES.size(); move++) {
+            uint32_t child = state * MOVES.size() + move;
+            uint32_t now = time;
+            inputs[0] = MOVES[move];
+            level.restore(beam.levels[state], beam.obstacles_of(state));
+
+            while (now < time + _config.decision_ms && level.outcome() == Level::LevelStateKind::IN_PROGRESS) {
+              now += _config.tick_ms;
+              auto next = std::move(level).frame(now, inputs);
+              level = std::move(next);
+              frames++;
+            }
+
+            auto outcome = level.outcome();
+            children.alive[child] = outcome == Level::LevelStateKind::IN_PROGRESS;
+            fatal += outcome == Level::LevelStateKind::FAILED ? 1 : 0;
+
+            if (outcome == Level::LevelStateKind::COMPLETE) {
+              // The first move to win may not be the quickest; keep whichever is.
+              uint32_t current = best.load();
+              while (now < current && !best.compare_exchange_weak(current, now)) {}
+              continue;
+            }
+
+            if (!children.alive[child]) {
+              continue;
+            }
+
+            level.save(children.levels[child], children.obstacles_of(child));
+            children.scores[child] = score(children.levels[child]);
+            children.keys[child] = key(children.levels[child], children.obstacles_of(child), children.obstacle_count);
+          }
+        }
+
+        return std::make_pair(frames, fatal);
+      }
+
+      // States are ranked by how far along the player is, then by whether they are ready to attack.
+      static uint64_t score(const Level::Snapshot& snapshot) {
+        const auto& player = snapshot.players[0];
+        return (static_cast<uint64_t>(player.position) << 8) | (player.kind == 0 ? 1 : 0);
+      }
+
+      // Identifies states that will play out the same, so that the beam is not filled with duplicates.
+      static uint64_t key(const Level::Snapshot& snapshot, const Obstacle::Snapshot * obstacles, uint32_t count) {
+        const auto& player = snapshot.players[0];
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) {
+          hash = (hash ^ value) * 1099511628211ull;
+        };
+
+        mix(player.position);
+        mix(player.direction);
+        mix(player.kind);
+        mix(player.movement_timer.remaining);
+        mix(player.idle_timer.remaining);
+
+        for (uint32_t i = 0; i < count; i++) {
+          mix(obstacles[i].kind);
+          mix(obstacles[i].state.position);
+          mix(obstacles[i].state.direction);
+          // When the obstacle next moves; movements count down from when they last ran (see
+          // `xr::Behavior::timer`), not from the snapshot.
+          mix(obstacles[i].timer.last_time + obstacles[i].timer.remaining);
+
+          // Everything a script can change while it runs; its shape and whether it can be defeated change
+          // how players collide with it.
+          const auto& script = obstacles[i].script;
+          mix(script.token);
+          mix(script.length);
+          mix(script.pc);
+          mix(script.waiting);
+          mix(script.killable);
+          mix(script.half);
+          mix((script.red << 16) | (script.green << 8) | script.blue);
+
+          for (auto value = script.registers.cbegin(); value != script.registers.cend(); value++) {
+            mix(static_cast<uint16_t>(*value));
+          }
+        }
+
+        return hash;
+      }
+
+      WorkPool& _pool;
+      SolverConfig _config;
+  };
+}
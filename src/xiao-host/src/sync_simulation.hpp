@@ -0,0 +1,268 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "types.hpp"
+#include "level.hpp"
+#include "level_generator.hpp"
+#include "frame_sync.hpp"
+
+namespace xr {
+  struct SyncSimulationConfig final {
+    // The leader plus its followers, each driving `pixels` of the track.
+    uint32_t nodes;
+    uint32_t pixels;
+
+    // How long to play for, in simulated seconds.
+    uint32_t seconds;
+
+    // The chance of any one packet not reaching any one follower, in permille.
+    uint32_t loss;
+
+    // See `SyncLeader`.
+    uint32_t margin_us;
+  };
+
+  struct SyncNodeReport final {
+    uint32_t presented;
+    uint32_t late;
+
+    // Frames whose lights (on the follower's part of the track) were not the ones the leader sent.
+    uint32_t mismatched;
+
+    // How far from the leader frames were presented, in microseconds.
+    double mean_error_us;
+    double max_error_us;
+  };
+
+  // Plays a level across a leader and several followers (see `SyncLeader` and `SyncFollower`), in
+  // simulated time, over a shared channel that delays, jitters and drops packets. Every node has a clock
+  // of its own, started at a random time and drifting by up to 50ppm, so followers have to recover the
+  // leader's clock the same way they would on the light hosts.
+  //
+  // Frames are built the way the leader builds them (the level's lights, then its particles), and every
+  // frame a follower presents is checked against what the leader put in it.
+  class SyncSimulation final {
+    public:
+      explicit SyncSimulation(const SyncSimulationConfig& config):
+        _config(config),
+        _random(config.nodes, 0),
+        _channel(*this),
+        _nodes(config.nodes) {
+          for (auto node = _nodes.begin(); node != _nodes.end(); node++) {
+            node->offset = _random.next();
+            node->drift = (static_cast<double>(_random.below(100001)) - 50000) / 1e9;
+            node->follower = std::make_unique<SyncFollower>();
+            node->report = SyncNodeReport { 0, 0, 0, 0, 0 };
+          }
+        }
+      ~SyncSimulation() = default;
+
+      SyncSimulation(const SyncSimulation&) = delete;
+      SyncSimulation& operator=(const SyncSimulation&) = delete;
+
+      // Reports every follower, and returns how many frames the leader presented.
+      uint32_t run(std::pair<const char *, uint32_t> layout, std::vector<SyncNodeReport>& reports) {
+        uint32_t track = _config.pixels * _config.nodes;
+        // Stretched across the whole track, so that every follower has some of the level to show.
+        const Level level(layout, track, true);
+        SyncLeader<Channel> leader(_channel, _config.margin_us, track);
+        PlayerInputs inputs {};
+        uint32_t simulation_time = 0;
+        uint32_t frames = 0;
+        auto& leader_node = _nodes[0];
+
+        // Pushing out a strip takes ~30us per pixel.
+        double show_us = _config.pixels * 30.0;
+
+        while (_now < _config.seconds * 1e6) {
+          while (simulation_time + 5 <= _now / 1000) {
+            simulation_time += 5;
+
+            // Mostly running right, so that levels get finished and their completion animations synced too.
+            if (simulation_time % 50 == 0) {
+              uint32_t value = _random.next();
+              inputs[0] = std::make_tuple(value % 4 == 0 ? 2 : 1, 0, (value >> 8) % 4 == 0 ? 1 : 0);
+            }
+
+            auto next = std::move(level).frame(simulation_time, inputs);
+            level = std::move(next);
+
+            // Levels are only restarted once their completion animation (which spans the track) is over.
+            if (level.state() != Level::LevelStateKind::IN_PROGRESS) {
+              level.restart(false);
+            }
+          }
+
+          leader.clear();
+          std::vector<Light> lights(level.light_begin(), level.light_end());
+
+          level.render_particles([&lights](const Light& light, uint8_t intensity) {
+            auto [position, red, green, blue] = light;
+            lights.push_back(Light {
+              position,
+              static_cast<uint8_t>((red * intensity) >> 8),
+              static_cast<uint8_t>((green * intensity) >> 8),
+              static_cast<uint8_t>((blue * intensity) >> 8)
+            });
+          });
+
+          for (auto light = lights.cbegin(); light != lights.cend(); light++) {
+            leader.add(*light);
+          }
+
+          uint32_t local_now = leader_node.local(_now);
+          uint32_t present_at = leader.send();
+          double presented = _now + static_cast<int32_t>(present_at - local_now) / (1 + leader_node.drift);
+          _presented.push_back(presented);
+          _frames.push_back(std::move(lights));
+          frames += 1;
+
+          deliver(presented);
+          _now = presented + show_us;
+        }
+
+        deliver(_now + 1e6);
+        _dropped = leader.take_dropped();
+
+        for (uint32_t i = 1; i < _nodes.size(); i++) {
+          auto& report = _nodes[i].report;
+          report.mean_error_us = report.presented == 0 ? 0 : report.mean_error_us / report.presented;
+          reports.push_back(report);
+        }
+
+        return frames;
+      }
+
+      // How many lights the leader had to leave out of its frames.
+      uint32_t dropped() const {
+        return _dropped;
+      }
+
+    private:
+      struct Node final {
+        uint32_t offset;
+        double drift;
+        std::unique_ptr<SyncFollower> follower;
+        SyncNodeReport report;
+
+        uint32_t local(double time) const {
+          return offset + static_cast<uint32_t>(static_cast<uint64_t>(time * (1 + drift)));
+        }
+      };
+
+      struct Delivery final {
+        double arrival;
+        uint32_t node;
+        std::vector<uint8_t> packet;
+      };
+
+      // The air between our nodes: one packet at a time, each waiting a little for the channel to be
+      // clear, then reaching every follower that does not drop it.
+      class Channel final {
+        public:
+          explicit Channel(SyncSimulation& simulation): _simulation(simulation), _free(0) {}
+
+          uint32_t micros() {
+            return _simulation._nodes[0].local(_simulation._now);
+          }
+
+          void send(const uint8_t * data, uint32_t size) {
+            auto& random = _simulation._random;
+            double start = std::max(_simulation._now + 50 + random.below(300), _free);
+            double end = start + SyncPacket::airtime(size);
+            _free = end;
+
+            for (uint32_t node = 1; node < _simulation._nodes.size(); node++) {
+              if (random.below(1000) < _simulation._config.loss) {
+                continue;
+              }
+
+              _simulation._inflight.push_back(Delivery { end + 20 + random.below(40), node, std::vector<uint8_t>(data, data + size) });
+            }
+          }
+
+        private:
+          SyncSimulation& _simulation;
+          double _free;
+      };
+
+      // Delivers every packet that arrives before `until`, and has followers present every frame they
+      // have by then.
+      void deliver(double until) {
+        std::sort(_inflight.begin(), _inflight.end(), [](const Delivery& left, const Delivery& right) {
+          return left.arrival < right.arrival;
+        });
+
+        auto end = std::find_if(_inflight.begin(), _inflight.end(), [until](const Delivery& delivery) {
+          return delivery.arrival >= until;
+        });
+
+        for (auto delivery = _inflight.begin(); delivery != end; delivery++) {
+          auto& node = _nodes[delivery->node];
+          node.follower->receive(delivery->packet.data(), delivery->packet.size(), node.local(delivery->arrival));
+          auto due = node.follower->due_at();
+
+          if (due == std::nullopt) {
+            continue;
+          }
+
+          // Followers present as soon as a frame is due, or right away for frames that arrive late.
+          int32_t wait = static_cast<int32_t>(*due - node.local(delivery->arrival));
+          double presented = delivery->arrival + std::max(wait, 0) / (1 + node.drift);
+          SyncFrame frame;
+          node.follower->take(*due, frame);
+
+          double error = std::abs(presented - _presented[frame.sequence - 1]);
+          node.report.presented += 1;
+          node.report.late += wait < 0 ? 1 : 0;
+          node.report.mismatched += matches(delivery->node, frame) ? 0 : 1;
+          node.report.mean_error_us += error;
+          node.report.max_error_us = std::max(node.report.max_error_us, error);
+        }
+
+        _inflight.erase(_inflight.begin(), end);
+      }
+
+      // Whether `frame` shows exactly the lights the leader put in it, on `node`'s part of the track. Later
+      // lights replace earlier ones at the same position, as they do in a framebuffer.
+      bool matches(uint32_t node, const SyncFrame& frame) const {
+        uint32_t start = node * _config.pixels;
+        std::vector<int32_t> expected(_config.pixels, -1);
+        std::vector<int32_t> shown(_config.pixels, -1);
+
+        auto paint = [this, start](std::vector<int32_t>& strip, const Light& light) {
+          auto [position, red, green, blue] = light;
+
+          if (position >= start && position < start + _config.pixels) {
+            strip[position - start] = (red << 16) | (green << 8) | blue;
+          }
+        };
+
+        for (auto light = _frames[frame.sequence - 1].cbegin(); light != _frames[frame.sequence - 1].cend(); light++) {
+          paint(expected, *light);
+        }
+
+        frame.each([&paint, &shown](const Light& light) {
+          paint(shown, light);
+        });
+
+        return expected == shown;
+      }
+
+      SyncSimulationConfig _config;
+      Random _random;
+      Channel _channel;
+      std::vector<Node> _nodes;
+      std::vector<Delivery> _inflight;
+      std::vector<double> _presented;
+      std::vector<std::vector<Light>> _frames;
+      uint32_t _dropped = 0;
+      double _now = 0;
+  };
+}
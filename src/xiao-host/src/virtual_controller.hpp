@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "transport.hpp"
+#include "input_message.hpp"
+#include "random.hpp"
+
+namespace xr {
+  struct VirtualControllerConfig final {
+    uint16_t port;
+    uint16_t light_port;
+
+    // How often inputs are sampled and sent; see `SAMPLE_INTERVAL_MS` in the controller.
+    uint32_t interval_ms;
+
+    // The chance of any one message being dropped instead of sent, in permille.
+    uint32_t loss;
+
+    // How long to play for when reading the keyboard.
+    uint32_t seconds;
+  };
+
+  struct VirtualControllerReport final {
+    uint32_t sent;
+    uint32_t dropped;
+    uint32_t failed;
+    uint32_t elapsed_ms;
+  };
+
+  // Stands in for a controller, sending the same messages (see `InputMessage`) to a light host over a
+  // `Transport`. Inputs are either read from a script, one `x y z ms` line per input that is held for `ms`,
+  // or from the keyboard: `a` and `d` push left and right, space presses the button and `q` stops.
+  // Terminals only tell us when a key is pressed, so a direction is held until another key is pressed;
+  // any other key (e.g enter) lets go.
+  class VirtualController final {
+    public:
+      struct Step final {
+        InputMessage input;
+        uint32_t duration_ms;
+      };
+
+      explicit VirtualController(const VirtualControllerConfig& config):
+        _config(config),
+        _transport(config.port),
+        _random(config.port, 0) {
+        }
+      ~VirtualController() = default;
+
+      VirtualController(const VirtualController&) = delete;
+      VirtualController& operator=(const VirtualController&) = delete;
+
+      // Reads a script, returning false if it has anything but `x y z ms` lines (or blank ones).
+      static bool read_script(FILE * file, std::vector<Step>& steps) {
+        char line[128];
+
+        while (fgets(line, sizeof(line), file) != nullptr) {
+          unsigned int x, y, z, duration;
+
+          if (line[0] == '\n' || line[0] == '#') {
+            continue;
+          }
+
+          if (sscanf(line, "%u %u %u %u", &x, &y, &z, &duration) != 4) {
+            return false;
+          }
+
+          steps.push_back(Step { InputMessage { x, y, static_cast<uint8_t>(z), 0, 0 }, duration });
+        }
+
+        return true;
+      }
+
+      bool play(const std::vector<Step>& steps, VirtualControllerReport& report) {
+        if (!_transport.begin()) {
+          return false;
+        }
+
+        report = VirtualControllerReport { 0, 0, 0, 0 };
+        uint32_t started = millis();
+
+        for (auto step = steps.begin(); step != steps.end(); step++) {
+          uint32_t step_started = millis();
+
+          while (millis() - step_started < step->duration_ms) {
+            send(step->input, report);
+          }
+        }
+
+        report.elapsed_ms = millis() - started;
+        _transport.end();
+        return true;
+      }
+
+      bool play_keyboard(VirtualControllerReport& report) {
+        if (!_transport.begin()) {
+          return false;
+        }
+
+        termios original;
+        tcgetattr(STDIN_FILENO, &original);
+        termios raw = original;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+        report = VirtualControllerReport { 0, 0, 0, 0 };
+        InputMessage input { 0, 0, 0, 0, 0 };
+        uint32_t started = millis();
+        bool stopping = false;
+
+        while (!stopping && millis() - started < _config.seconds * 1000) {
+          char key;
+          input.z = 0;
+
+          while (read(STDIN_FILENO, &key, 1) == 1) {
+            stopping = stopping || key == 'q';
+            input.x = key == 'd' ? 1 : (key == 'a' ? 2 : (key == ' ' ? input.x : 0));
+            input.z = key == ' ' ? 1 : input.z;
+          }
+
+          send(input, report);
+        }
+
+        tcsetattr(STDIN_FILENO, TCSANOW, &original);
+        report.elapsed_ms = millis() - started;
+        _transport.end();
+        return true;
+      }
+
+    private:
+      // Sends one sample, then waits for the next one to be due.
+      void send(InputMessage input, VirtualControllerReport& report) {
+        char content[120] = {};
+        input.sequence = ++_sequence;
+        input.time = millis();
+        format_input_message(content, sizeof(content), input);
+
+        if (_random.below(1000) < _config.loss) {
+          report.dropped += 1;
+        } else if (_transport.send(UdpTransport::udp_address(_config.light_port).data(), reinterpret_cast<uint8_t *>(content), sizeof(content))) {
+          report.sent += 1;
+        } else {
+          report.failed += 1;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(_config.interval_ms));
+      }
+
+      VirtualControllerConfig _config;
+      UdpTransport _transport;
+      Random _random;
+      uint32_t _sequence = 0;
+  };
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xr {
+  // A fixed set of worker threads, each with its own deque of tasks. Workers run their newest task
+  // first and, once out of work, steal the oldest task of another worker. Tasks are submitted as part of
+  // a `Group`, and a thread waiting on a group runs tasks (its own, or stolen) until the group is done,
+  // so tasks can submit and wait on groups of their own without tying up a worker.
+  class WorkPool final {
+    public:
+      using Task = std::function<void()>;
+
+      class Group final {
+        public:
+          Group(): _pending(0) {}
+          ~Group() = default;
+
+          Group(const Group&) = delete;
+          Group& operator=(const Group&) = delete;
+
+        private:
+          friend class WorkPool;
+          std::atomic<uint32_t> _pending;
+      };
+
+      explicit WorkPool(uint32_t threads): _stopping(false), _next(0) {
+        threads = threads == 0 ? 1 : threads;
+
+        for (uint32_t i = 0; i < threads; i++) {
+          _queues.push_back(std::make_unique<Queue>());
+        }
+
+        for (uint32_t i = 0; i < threads; i++) {
+          _threads.emplace_back([this, i]() { work(i); });
+        }
+      }
+      ~WorkPool() {
+        _stopping = true;
+        _wake.notify_all();
+
+        for (auto thread = _threads.begin(); thread != _threads.end(); thread++) {
+          thread->join();
+        }
+      }
+
+      WorkPool(const WorkPool&) = delete;
+      WorkPool& operator=(const WorkPool&) = delete;
+
+      uint32_t size() const {
+        return _queues.size();
+      }
+
+      // Workers push onto their own deque; anyone else spreads tasks across every worker.
+      void submit(Group& group, Task&& task) {
+        auto self = current();
+        uint32_t target = self >= 0 ? self : _next.fetch_add(1) % _queues.size();
+
+        group._pending.fetch_add(1);
+        {
+          std::lock_guard<std::mutex> lock(_queues[target]->lock);
+          _queues[target]->tasks.emplace_back(&group, std::move(task));
+        }
+        _wake.notify_one();
+      }
+
+      // Runs tasks until every task submitted to `group` has finished.
+      void wait(Group& group) {
+        while (group._pending.load() > 0) {
+          if (!run_one(current())) {
+            std::this_thread::yield();
+          }
+        }
+      }
+
+    private:
+      struct Queue final {
+        std::mutex lock;
+        std::deque<std::pair<Group *, Task>> tasks;
+      };
+
+      // The index of the worker we are running on, if any.
+      static int32_t& current() {
+        static thread_local int32_t index = -1;
+        return index;
+      }
+
+      void work(uint32_t index) {
+        current() = index;
+
+        while (!_stopping) {
+          if (run_one(index)) {
+            continue;
+          }
+
+          std::unique_lock<std::mutex> lock(_idle);
+          _wake.wait_for(lock, std::chrono::milliseconds(1));
+        }
+      }
+
+      bool run_one(int32_t self) {
+        std::pair<Group *, Task> task(nullptr, nullptr);
+
+        if (self >= 0) {
+          std::lock_guard<std::mutex> lock(_queues[self]->lock);
+
+          if (!_queues[self]->tasks.empty()) {
+            task = std::move(_queues[self]->tasks.back());
+            _queues[self]->tasks.pop_back();
+          }
+        }
+
+        // Victims are tried starting from our neighbour, so thieves spread out.
+        uint32_t start = self >= 0 ? self + 1 : 0;
+
+        for (uint32_t i = 0; task.first == nullptr && i < _queues.size(); i++) {
+          uint32_t index = (start + i) % _queues.size();
+
+          if (static_cast<int32_t>(index) == self) {
+            continue;
+          }
+
+          auto& victim = *_queues[index];
+          std::lock_guard<std::mutex> lock(victim.lock);
+
+          if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+          }
+        }
+
+        if (task.first == nullptr) {
+          return false;
+        }
+
+        task.second();
+        task.first->_pending.fetch_sub(1);
+        return true;
+      }
+
+      std::vector<std::unique_ptr<Queue>> _queues;
+      std::vector<std::thread> _threads;
+      std::atomic<bool> _stopping;
+      std::atomic<uint32_t> _next;
+      std::mutex _idle;
+      std::condition_variable _wake;
+  };
+}
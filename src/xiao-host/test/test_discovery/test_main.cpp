@@ -0,0 +1,153 @@
+#include <unity.h>
+
+#include "discovery.hpp"
+
+using DiscoveryState = xr::Discovery::DiscoveryState;
+using DiscoveryAction = xr::Discovery::DiscoveryAction;
+
+static const xr::DiscoveryConfig config {
+  1000, 15000,  // retry, join timeout
+  200, 5000,    // settle, leave
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_idle_until_begun(void) {
+  xr::Discovery discovery(config);
+
+  TEST_ASSERT_EQUAL(DiscoveryState::IDLE, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(100));
+}
+
+void test_searches_once_when_begun(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+
+  TEST_ASSERT_EQUAL(DiscoveryAction::SEARCH, discovery.tick(100));
+
+  // The search is in flight until it is reported `found` or `missed`.
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(101));
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(100 + config.retry_ms * 5));
+  TEST_ASSERT_EQUAL(DiscoveryState::SEARCHING, discovery.state());
+}
+
+void test_missed_search_retries_later(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.tick(100);
+  discovery.missed(400);
+
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(400 + config.retry_ms - 1));
+  TEST_ASSERT_EQUAL(DiscoveryAction::SEARCH, discovery.tick(400 + config.retry_ms));
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(400 + config.retry_ms + 1));
+}
+
+void test_join_walks_through_settle_and_leave(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.tick(100);
+  discovery.found(300);
+
+  TEST_ASSERT_EQUAL(DiscoveryState::JOINING, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(1000));
+
+  discovery.joined(2000);
+  TEST_ASSERT_EQUAL(DiscoveryState::SETTLING, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(2000 + config.settle_ms - 1));
+  TEST_ASSERT_EQUAL(DiscoveryAction::LEAVE, discovery.tick(2000 + config.settle_ms));
+
+  uint32_t left = 2000 + config.settle_ms;
+  TEST_ASSERT_EQUAL(DiscoveryState::LEAVING, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(left + config.leave_ms - 1));
+  TEST_ASSERT_EQUAL(DiscoveryAction::START, discovery.tick(left + config.leave_ms));
+  TEST_ASSERT_EQUAL(DiscoveryState::IDLE, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(left + config.leave_ms + 1));
+}
+
+void test_slow_join_is_given_up(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.tick(100);
+  discovery.found(300);
+
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(300 + config.join_timeout_ms - 1));
+  TEST_ASSERT_EQUAL(DiscoveryAction::GIVE_UP, discovery.tick(300 + config.join_timeout_ms));
+  TEST_ASSERT_EQUAL(DiscoveryState::SEARCHING, discovery.state());
+
+  uint32_t gave_up = 300 + config.join_timeout_ms;
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(gave_up + config.retry_ms - 1));
+  TEST_ASSERT_EQUAL(DiscoveryAction::SEARCH, discovery.tick(gave_up + config.retry_ms));
+}
+
+void test_joined_while_searching_settles(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.tick(100);
+
+  // The light host does not join anything; controllers joining it are reported straight away.
+  discovery.joined(700);
+  TEST_ASSERT_EQUAL(DiscoveryState::SETTLING, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::LEAVE, discovery.tick(700 + config.settle_ms));
+}
+
+void test_late_reports_are_ignored(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.tick(100);
+  discovery.found(300);
+  discovery.joined(400);
+
+  discovery.missed(500);
+  discovery.found(500);
+  TEST_ASSERT_EQUAL(DiscoveryState::SETTLING, discovery.state());
+
+  discovery.tick(400 + config.settle_ms);
+  discovery.joined(800);
+  TEST_ASSERT_EQUAL(DiscoveryState::LEAVING, discovery.state());
+}
+
+void test_resume_starts_right_away(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.resume(100);
+
+  TEST_ASSERT_EQUAL(DiscoveryAction::START, discovery.tick(100));
+  TEST_ASSERT_EQUAL(DiscoveryState::IDLE, discovery.state());
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(100 + config.retry_ms));
+}
+
+void test_begin_again_after_start(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(100);
+  discovery.resume(100);
+  discovery.tick(100);
+
+  discovery.begin(9000);
+  TEST_ASSERT_EQUAL(DiscoveryAction::SEARCH, discovery.tick(9000));
+}
+
+void test_search_due_across_clock_wrap(void) {
+  xr::Discovery discovery(config);
+  discovery.begin(0xFFFFFF00);
+  discovery.tick(0xFFFFFF00);
+  discovery.missed(0xFFFFFF00);
+
+  TEST_ASSERT_EQUAL(DiscoveryAction::NONE, discovery.tick(0xFFFFFFFF));
+  TEST_ASSERT_EQUAL(DiscoveryAction::SEARCH, discovery.tick(0xFFFFFF00 + config.retry_ms));
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_idle_until_begun);
+  RUN_TEST(test_searches_once_when_begun);
+  RUN_TEST(test_missed_search_retries_later);
+  RUN_TEST(test_join_walks_through_settle_and_leave);
+  RUN_TEST(test_slow_join_is_given_up);
+  RUN_TEST(test_joined_while_searching_settles);
+  RUN_TEST(test_late_reports_are_ignored);
+  RUN_TEST(test_resume_starts_right_away);
+  RUN_TEST(test_begin_again_after_start);
+  RUN_TEST(test_search_due_across_clock_wrap);
+  return UNITY_END();
+}
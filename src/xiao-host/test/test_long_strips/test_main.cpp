@@ -0,0 +1,108 @@
+#include <unity.h>
+
+#include <string>
+
+#include "level.hpp"
+
+// Strips of several thousand lights: every buffer a level uses is sized when it is built (see
+// `Level::Capacities`), so playing one for a while (completion animations included) must never grow them.
+
+static const uint32_t long_strip = 4000;
+static const char * scripts = "|0: killable color 255 0 80 top: set r0 6 out: wait 120 step loop r0 out turn jump top";
+
+// A level of `length` with an obstacle every `spacing` lights (cycling through every kind, scripted ones
+// included), every tenth of them a checkpoint instead, and the goal (itself an obstacle) at the end.
+static std::string busy_layout(uint32_t length, uint32_t spacing) {
+  const char kinds[] = { 'x', 's', '0' };
+  std::string layout(length, ' ');
+  layout.front() = Level::PLAYER_TOKEN;
+  layout.back() = 'g';
+
+  for (uint32_t position = spacing, i = 0; position + 1 < length; position += spacing, i++) {
+    layout[position] = i % 10 == 9 ? Level::CHECKPOINT_TOKEN : kinds[i % 3];
+  }
+
+  return layout + scripts;
+}
+
+static void assert_capacities(const Level::Capacities& expected, const Level::Capacities& actual) {
+  TEST_ASSERT_EQUAL_UINT32(expected.lights, actual.lights);
+  TEST_ASSERT_EQUAL_UINT32(expected.obstacles, actual.obstacles);
+  TEST_ASSERT_EQUAL_UINT32(expected.obstacle_lights, actual.obstacle_lights);
+  TEST_ASSERT_EQUAL_UINT32(expected.checkpoints, actual.checkpoints);
+  TEST_ASSERT_EQUAL_UINT32(expected.obstacle_snapshots, actual.obstacle_snapshots);
+}
+
+// Plays `level` for a couple of simulated minutes with every player moving at random, restarting it each
+// time it finishes, and returns how many times it did.
+static uint32_t play(const Level& level, const Level::Capacities& built) {
+  PlayerInputs inputs {};
+  uint32_t seed = 0x2545f491;
+  uint32_t finished = 0;
+
+  for (uint32_t now = 5; now < 120000; now += 5) {
+    if (now % 50 == 0) {
+      for (auto input = inputs.begin(); input != inputs.end(); input++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        // Mostly running right, so that players get through (and the camera sweeps) the whole level.
+        *input = std::make_tuple(seed % 4 == 0 ? 2 : 1, 0, (seed >> 8) % 4 == 0 ? 1 : 0);
+      }
+    }
+
+    auto next = std::move(level).frame(now, inputs);
+    level = std::move(next);
+
+    TEST_ASSERT_LESS_OR_EQUAL(built.lights, static_cast<uint32_t>(level.light_end() - level.light_begin()));
+
+    if (level.state() != Level::LevelStateKind::IN_PROGRESS) {
+      finished += 1;
+      level.restart(finished % 2 == 0);
+    }
+  }
+
+  assert_capacities(built, level.capacities());
+  return finished;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_unstretched_level_keeps_its_buffers(void) {
+  auto layout = busy_layout(long_strip, 40);
+  const Level level(std::make_pair(layout.c_str(), static_cast<uint32_t>(layout.size())), long_strip);
+  auto built = level.capacities();
+
+  TEST_ASSERT_EQUAL_UINT32(91, level.obstacle_count());
+  TEST_ASSERT_GREATER_THAN(long_strip - 1, built.lights);
+  TEST_ASSERT_GREATER_THAN(0, play(level, built));
+}
+
+void test_stretched_level_keeps_its_buffers(void) {
+  auto layout = busy_layout(400, 4);
+  const Level level(std::make_pair(layout.c_str(), static_cast<uint32_t>(layout.size())), long_strip, true);
+  auto built = level.capacities();
+
+  TEST_ASSERT_EQUAL_UINT32(91, level.obstacle_count());
+  TEST_ASSERT_GREATER_THAN(long_strip - 1, built.lights);
+  TEST_ASSERT_GREATER_THAN(0, play(level, built));
+}
+
+void test_level_longer_than_strip_keeps_its_buffers(void) {
+  auto layout = busy_layout(long_strip * 2, 40);
+  const Level level(std::make_pair(layout.c_str(), static_cast<uint32_t>(layout.size())), long_strip);
+  auto built = level.capacities();
+
+  TEST_ASSERT_EQUAL_UINT32(181, level.obstacle_count());
+  TEST_ASSERT_GREATER_THAN(0, play(level, built));
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unstretched_level_keeps_its_buffers);
+  RUN_TEST(test_stretched_level_keeps_its_buffers);
+  RUN_TEST(test_level_longer_than_strip_keeps_its_buffers);
+  return UNITY_END();
+}
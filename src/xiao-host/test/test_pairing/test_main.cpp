@@ -0,0 +1,116 @@
+#include <unity.h>
+
+#include "pairing.hpp"
+
+using PairingState = xr::Pairing::PairingState;
+
+static const uint32_t resume_timeout = 5000;
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_boot_without_stored_peer_discovers(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, false);
+
+  TEST_ASSERT_EQUAL(PairingState::DISCOVERING, pairing.state());
+  TEST_ASSERT_EQUAL(PairingState::DISCOVERING, pairing.tick(100 + resume_timeout * 2));
+}
+
+void test_boot_with_stored_peer_resumes(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, true);
+
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.state());
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.tick(100 + resume_timeout));
+}
+
+void test_hearing_peer_while_resuming_pairs(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, true);
+  pairing.heard(250);
+
+  TEST_ASSERT_EQUAL(PairingState::PAIRED, pairing.state());
+
+  // Once paired the resume timeout no longer applies.
+  TEST_ASSERT_EQUAL(PairingState::PAIRED, pairing.tick(100 + resume_timeout * 2));
+}
+
+void test_stale_hearing_is_ignored(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, true);
+
+  // The last message time from before the resume started (e.g left over from a previous pairing).
+  pairing.heard(50);
+  pairing.heard(100);
+
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.state());
+}
+
+void test_unanswered_resume_times_out(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, true);
+
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.tick(100 + resume_timeout - 1));
+  TEST_ASSERT_EQUAL(PairingState::DISCOVERING, pairing.tick(100 + resume_timeout + 1));
+
+  // Hearing from the peer after giving up on it does not resume the pairing; discovery has to finish.
+  pairing.heard(100 + resume_timeout + 10);
+  TEST_ASSERT_EQUAL(PairingState::DISCOVERING, pairing.state());
+}
+
+void test_discovery_pairs(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, false);
+  pairing.discovered(2000);
+
+  TEST_ASSERT_EQUAL(PairingState::PAIRED, pairing.tick(2000 + resume_timeout * 2));
+}
+
+void test_losing_link_falls_back_to_discovery(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, true);
+  pairing.heard(200);
+  pairing.lost(3000);
+
+  TEST_ASSERT_EQUAL(PairingState::DISCOVERING, pairing.tick(3001));
+
+  pairing.discovered(4000);
+  TEST_ASSERT_EQUAL(PairingState::PAIRED, pairing.state());
+}
+
+void test_resume_ignores_messages_from_before_it(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(100, false);
+  pairing.discovered(1000);
+  pairing.lost(2000);
+  pairing.boot(2500, true);
+
+  // Resuming starts listening afresh from the time of the boot.
+  pairing.heard(2400);
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.state());
+
+  pairing.heard(2600);
+  TEST_ASSERT_EQUAL(PairingState::PAIRED, pairing.state());
+}
+
+void test_clock_going_backwards_does_not_time_out(void) {
+  xr::Pairing pairing(resume_timeout);
+  pairing.boot(10000, true);
+
+  TEST_ASSERT_EQUAL(PairingState::RESUMING, pairing.tick(500));
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_boot_without_stored_peer_discovers);
+  RUN_TEST(test_boot_with_stored_peer_resumes);
+  RUN_TEST(test_hearing_peer_while_resuming_pairs);
+  RUN_TEST(test_stale_hearing_is_ignored);
+  RUN_TEST(test_unanswered_resume_times_out);
+  RUN_TEST(test_discovery_pairs);
+  RUN_TEST(test_losing_link_falls_back_to_discovery);
+  RUN_TEST(test_resume_ignores_messages_from_before_it);
+  RUN_TEST(test_clock_going_backwards_does_not_time_out);
+  return UNITY_END();
+}
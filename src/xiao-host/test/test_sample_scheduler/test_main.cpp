@@ -0,0 +1,126 @@
+#include <unity.h>
+
+#include "sample_scheduler.hpp"
+
+static const xr::SampleSchedule schedule {
+  10, 100,      // active, idle interval
+  500,          // idle after
+  4,            // min sleep
+  80000, 350,   // active, sleep microamps
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_active_until_held_still(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(1000);
+
+  TEST_ASSERT_EQUAL_UINT32(schedule.active_interval_ms, scheduler.interval(1000));
+  TEST_ASSERT_EQUAL_UINT32(schedule.active_interval_ms, scheduler.interval(1000 + schedule.idle_after_ms - 1));
+  TEST_ASSERT_EQUAL_UINT32(schedule.idle_interval_ms, scheduler.interval(1000 + schedule.idle_after_ms));
+
+  // Unchanged samples keep us idle; a change makes us active again straight away.
+  scheduler.sampled(1600, false);
+  TEST_ASSERT_EQUAL_UINT32(schedule.idle_interval_ms, scheduler.interval(1600));
+  scheduler.sampled(1700, true);
+  TEST_ASSERT_EQUAL_UINT32(schedule.active_interval_ms, scheduler.interval(1700));
+}
+
+void test_wait_counts_down_to_the_next_sample(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(1000);
+  scheduler.sampled(1000, true);
+
+  TEST_ASSERT_EQUAL_UINT32(10, scheduler.wait(1000));
+  TEST_ASSERT_EQUAL_UINT32(3, scheduler.wait(1007));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.wait(1010));
+
+  // Samples that are overdue are due now, not in four billion milliseconds.
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.wait(1400));
+}
+
+void test_wait_across_clock_wrap(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(0xFFFFFFF0);
+  scheduler.sampled(0xFFFFFFFC, true);
+
+  TEST_ASSERT_EQUAL_UINT32(10, scheduler.wait(0xFFFFFFFC));
+  TEST_ASSERT_EQUAL_UINT32(7, scheduler.wait(0xFFFFFFFF));
+  TEST_ASSERT_EQUAL_UINT32(4, scheduler.wait(2));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.wait(6));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler.wait(50));
+
+  // Going idle is timed across the wrap too.
+  TEST_ASSERT_EQUAL_UINT32(schedule.active_interval_ms, scheduler.interval(0xFFFFFFFC + schedule.idle_after_ms - 1));
+  TEST_ASSERT_EQUAL_UINT32(schedule.idle_interval_ms, scheduler.interval(0xFFFFFFFC + schedule.idle_after_ms));
+}
+
+void test_short_waits_are_not_slept(void) {
+  xr::SampleScheduler scheduler(schedule);
+
+  TEST_ASSERT_FALSE(scheduler.should_sleep(0));
+  TEST_ASSERT_FALSE(scheduler.should_sleep(schedule.min_sleep_ms - 1));
+  TEST_ASSERT_TRUE(scheduler.should_sleep(schedule.min_sleep_ms));
+  TEST_ASSERT_TRUE(scheduler.should_sleep(schedule.idle_interval_ms));
+}
+
+void test_stats_from_time_asleep(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(1000);
+  scheduler.slept(500);
+  scheduler.slept(250);
+
+  auto stats = scheduler.take_stats(2000);
+  TEST_ASSERT_EQUAL_UINT16(250, stats.duty_cycle);
+  TEST_ASSERT_EQUAL_UINT32((80000 * 250 + 350 * 750) / 1000, stats.average_microamps);
+  TEST_ASSERT_EQUAL_UINT32(schedule.idle_interval_ms, stats.interval_ms);
+
+  // Every call starts a new window.
+  scheduler.slept(100);
+  stats = scheduler.take_stats(3000);
+  TEST_ASSERT_EQUAL_UINT16(900, stats.duty_cycle);
+  TEST_ASSERT_EQUAL_UINT32((80000 * 900 + 350 * 100) / 1000, stats.average_microamps);
+}
+
+void test_stats_at_the_extremes(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(1000);
+
+  // No time has passed: we count as awake.
+  auto stats = scheduler.take_stats(1000);
+  TEST_ASSERT_EQUAL_UINT16(1000, stats.duty_cycle);
+  TEST_ASSERT_EQUAL_UINT32(schedule.active_microamps, stats.average_microamps);
+
+  // Sleep is measured on another clock, and can come out a little longer than the window.
+  scheduler.slept(1200);
+  stats = scheduler.take_stats(2000);
+  TEST_ASSERT_EQUAL_UINT16(0, stats.duty_cycle);
+  TEST_ASSERT_EQUAL_UINT32(schedule.sleep_microamps, stats.average_microamps);
+
+  // Never asleep.
+  stats = scheduler.take_stats(3000);
+  TEST_ASSERT_EQUAL_UINT16(1000, stats.duty_cycle);
+}
+
+void test_stats_window_across_clock_wrap(void) {
+  xr::SampleScheduler scheduler(schedule);
+  scheduler.start(0xFFFFFE0C);
+  scheduler.slept(500);
+
+  // 1000ms later, on the other side of the wrap.
+  auto stats = scheduler.take_stats(500);
+  TEST_ASSERT_EQUAL_UINT16(500, stats.duty_cycle);
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_active_until_held_still);
+  RUN_TEST(test_wait_counts_down_to_the_next_sample);
+  RUN_TEST(test_wait_across_clock_wrap);
+  RUN_TEST(test_short_waits_are_not_slept);
+  RUN_TEST(test_stats_from_time_asleep);
+  RUN_TEST(test_stats_at_the_extremes);
+  RUN_TEST(test_stats_window_across_clock_wrap);
+  return UNITY_END();
+}
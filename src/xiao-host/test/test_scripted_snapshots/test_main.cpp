@@ -0,0 +1,89 @@
+#include <unity.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "level.hpp"
+
+// Snapshots of scripted obstacles are restored into levels other than the one that took them (see
+// `Solver::expand`), which may be gone by then: the script must be run from the restoring level.
+
+using Color = std::tuple<uint8_t, uint8_t, uint8_t>;
+
+static const char * layout = "p                    0                    g";
+
+// Scripts of the same shape (so compiled to bytecode of the same length), differing only in their color.
+static std::string level_text(const char * color) {
+  return std::string(layout) + "|0: top: color " + color + " wait 100 step wait 100 turn step turn jump top";
+}
+
+static const Level * build(const std::string& text) {
+  return new Level(std::make_pair(text.c_str(), static_cast<uint32_t>(text.size())), strlen(layout));
+}
+
+// Plays the level from `start` to `end`, returning the positions of every light of `color`, frame by frame.
+static std::vector<uint32_t> play(const Level& level, uint32_t start, uint32_t end, Color color) {
+  PlayerInputs inputs {};
+  std::vector<uint32_t> positions;
+
+  for (uint32_t now = start; now < end; now += 5) {
+    auto next = std::move(level).frame(now, inputs);
+    level = std::move(next);
+
+    for (auto light = level.light_begin(); light != level.light_end(); light++) {
+      auto [position, red, green, blue] = *light;
+
+      if (std::make_tuple(red, green, blue) == color) {
+        positions.push_back(position);
+      }
+    }
+  }
+
+  return positions;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_restored_script_outlives_the_saving_level(void) {
+  std::string text = level_text("1 2 3");
+  std::unique_ptr<const Level> saving(build(text));
+  play(*saving, 5, 1000, std::make_tuple(1, 2, 3));
+
+  Level::Snapshot snapshot;
+  std::vector<Obstacle::Snapshot> obstacles(saving->obstacle_count());
+  saving->save(snapshot, obstacles.data());
+
+  auto expected = play(*saving, 1000, 3000, std::make_tuple(1, 2, 3));
+  saving.reset();
+
+  std::unique_ptr<const Level> restoring(build(text));
+  restoring->restore(snapshot, obstacles.data());
+
+  TEST_ASSERT_GREATER_THAN(0, expected.size());
+  TEST_ASSERT_TRUE(expected == play(*restoring, 1000, 3000, std::make_tuple(1, 2, 3)));
+}
+
+void test_restored_script_runs_the_restoring_levels_code(void) {
+  std::unique_ptr<const Level> saving(build(level_text("1 2 3")));
+  std::unique_ptr<const Level> restoring(build(level_text("4 5 6")));
+  play(*saving, 5, 1000, std::make_tuple(1, 2, 3));
+
+  Level::Snapshot snapshot;
+  std::vector<Obstacle::Snapshot> obstacles(saving->obstacle_count());
+  saving->save(snapshot, obstacles.data());
+  restoring->restore(snapshot, obstacles.data());
+
+  // The color is part of the restored state, until the script comes back around to setting it.
+  play(*restoring, 1000, 2000, std::make_tuple(1, 2, 3));
+  TEST_ASSERT_EQUAL_UINT32(0, play(*restoring, 2000, 4000, std::make_tuple(1, 2, 3)).size());
+  TEST_ASSERT_GREATER_THAN(0, play(*restoring, 4000, 5000, std::make_tuple(4, 5, 6)).size());
+}
+
+int main(int argc, char ** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_restored_script_outlives_the_saving_level);
+  RUN_TEST(test_restored_script_runs_the_restoring_levels_code);
+  return UNITY_END();
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <variant>
+#include "logging.hpp"
 #include "timer.hpp"
 #include "types.hpp"
 
@@ -21,7 +22,7 @@ class Animation final {
       _frame(0),
       _config(config),
       _done(false) {
-        _lights->reserve(100);
+        _lights->reserve(std::visit(CapacityVisitor{}, _config));
       }
     ~Animation() = default;
 
@@ -56,14 +57,14 @@ class Animation final {
 
     std::tuple<Animation, bool> tick(uint32_t time) && {
       if (_done) {
-        log_d("animation already complete");
+        xr_log_d(ANIMATION, "animation already complete");
         return std::make_tuple(std::move(*this), true);
       }
 
       auto [new_total, is_done] = std::move(*_total_timer).tick(time);
 
       if (is_done) {
-        log_d("animation has completed");
+        xr_log_d(ANIMATION, "animation has completed");
         _done = true;
         return std::make_tuple(std::move(*this), true);
       }
@@ -91,6 +92,13 @@ class Animation final {
     }
 
   private:
+    // Determines how many lights a given config will render at most in a single frame.
+    struct CapacityVisitor final {
+      uint32_t operator()(const MiddleOut& config) const {
+        return config.boundary + 2;
+      }
+    };
+
     struct ConfigVisitor final {
       ConfigVisitor(std::vector<Light> * const b, uint32_t f): _buffer(b), _frame(f) {}
 
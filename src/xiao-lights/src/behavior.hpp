@@ -0,0 +1,317 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <vector>
+
+#include "logging.hpp"
+#include "timer.hpp"
+
+namespace xr {
+  // A fixed number of equally sized blocks that coroutine frames (see `Behavior`) are allocated from.
+  // Blocks are handed out and returned through a free list, so starting and stopping behaviors never
+  // touches the heap; behaviors that do not fit (or find the pool empty) simply fail to start.
+  class BehaviorPool final {
+    public:
+      // Room for a single coroutine frame; behaviors keep everything that outlives a frame in the
+      // state they are given, so their frames stay small.
+      constexpr static const uint32_t FRAME_SIZE = 128;
+
+      explicit BehaviorPool(uint32_t capacity):
+        _blocks(new std::vector<Block>(capacity)),
+        _free(nullptr),
+        _available(capacity) {
+          for (auto block = _blocks->begin(); block != _blocks->end(); block++) {
+            block->pool = this;
+            block->next = _free;
+            _free = &(*block);
+          }
+        }
+      ~BehaviorPool() = default;
+
+      BehaviorPool(const BehaviorPool&) = delete;
+      BehaviorPool& operator=(const BehaviorPool&) = delete;
+
+      uint32_t capacity() const {
+        return _blocks->size();
+      }
+
+      uint32_t available() const {
+        return _available;
+      }
+
+      // A block of at least `size` bytes, or null when there is none.
+      void * allocate(size_t size) {
+        if (size > FRAME_SIZE || _free == nullptr) {
+          xr_log_e(OBSTACLE, "unable to start a behavior (frame of %d bytes, %d free)", static_cast<uint32_t>(size), _available);
+          return nullptr;
+        }
+
+        Block * block = _free;
+        _free = block->next;
+        _available -= 1;
+        return block->frame;
+      }
+
+      // Hands a block back to whichever pool it came from.
+      static void release(void * frame) {
+        Block * block = reinterpret_cast<Block *>(static_cast<unsigned char *>(frame) - offsetof(Block, frame));
+        BehaviorPool * pool = block->pool;
+        block->next = pool->_free;
+        pool->_free = block;
+        pool->_available += 1;
+      }
+
+    private:
+      struct Block final {
+        BehaviorPool * pool;
+        Block * next;
+        alignas(std::max_align_t) unsigned char frame[FRAME_SIZE];
+      };
+
+      std::unique_ptr<std::vector<Block>> _blocks;
+      Block * _free;
+      uint32_t _available;
+  };
+
+  // What a behavior sees of the entity running it, for as long as it is running (i.e until it next
+  // waits). The state belongs to the entity, which is free to move around while the behavior sleeps.
+  template <typename S>
+  struct BehaviorContext final {
+    S * state;
+
+    // The time of the frame the behavior was resumed in.
+    uint32_t now;
+  };
+
+  // Suspends a behavior for `ms`; it is resumed by the first update at or after that.
+  struct Wait final {
+    uint32_t ms;
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> handle) const noexcept {
+      P& promise = handle.promise();
+      promise.wake_at = promise.context.now + ms;
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  inline Wait wait(uint32_t ms) {
+    return Wait { ms };
+  }
+
+  // An entity's behavior written as a coroutine, reading top to bottom like a script:
+  //
+  // static xr::Behavior<ObstacleState> pace(xr::BehaviorPool& pool) {
+  //   auto& self = co_await xr::Behavior<ObstacleState>::context();
+  //
+  //   while (true) {
+  //     self.state->position += 1;
+  //     co_await xr::wait(100);
+  //   }
+  // }
+  //
+  // The first argument of every behavior is the pool its frame is allocated from. Behaviors are resumed
+  // by `update` only once whatever they are waiting on has elapsed; until then, updating one costs a
+  // single comparison (its frame is not even read). Behaviors that finish (`co_return`) are never
+  // resumed again.
+  //
+  // Snapshots (see `Level::Snapshot`) cannot capture where a coroutine is suspended, so an entity is
+  // restored by starting its behavior again from the top and waking it when the snapshot says. Behaviors
+  // must be written so that this is the same thing: everything they need across a wait lives in the
+  // entity's state (not in locals), and the top of the behavior is where it would be woken.
+  template <typename S>
+  class Behavior final {
+    public:
+      struct promise_type final {
+        BehaviorContext<S> context = { nullptr, 0 };
+        uint32_t wake_at = 0;
+
+        static void * operator new(size_t size, BehaviorPool& pool) noexcept {
+          return pool.allocate(size);
+        }
+
+        static void operator delete(void * frame) noexcept {
+          BehaviorPool::release(frame);
+        }
+
+        static Behavior get_return_object_on_allocation_failure() noexcept {
+          return Behavior();
+        }
+
+        Behavior get_return_object() noexcept {
+          return Behavior(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept {
+          return {};
+        }
+
+        std::suspend_always final_suspend() const noexcept {
+          return {};
+        }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept {
+          std::terminate();
+        }
+      };
+
+      // Gives a behavior its context, without suspending.
+      struct ContextAwaiter final {
+        BehaviorContext<S> * context = nullptr;
+
+        bool await_ready() const noexcept {
+          return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+          context = &handle.promise().context;
+          return false;
+        }
+
+        BehaviorContext<S>& await_resume() const noexcept {
+          return *context;
+        }
+      };
+
+      static ContextAwaiter context() {
+        return ContextAwaiter {};
+      }
+
+      // A behavior that does nothing; e.g one that failed to start.
+      Behavior(): Behavior(nullptr) {}
+      ~Behavior() {
+        if (_handle) {
+          _handle.destroy();
+        }
+      }
+
+      Behavior(const Behavior&) = delete;
+      Behavior& operator=(const Behavior&) = delete;
+
+      Behavior(const Behavior&& other):
+        _handle(other._handle),
+        _scheduled(other._scheduled),
+        _delay(other._delay),
+        _since(other._since),
+        _wake_at(other._wake_at) {
+          other._handle = nullptr;
+        }
+
+      const Behavior& operator=(const Behavior&& other) const noexcept {
+        if (_handle) {
+          _handle.destroy();
+        }
+
+        _handle = other._handle;
+        _scheduled = other._scheduled;
+        _delay = other._delay;
+        _since = other._since;
+        _wake_at = other._wake_at;
+        other._handle = nullptr;
+        return *this;
+      }
+
+      // Whether the behavior can still run (i.e it started, and has not finished).
+      bool is_running() const {
+        return static_cast<bool>(_handle);
+      }
+
+      // Runs the behavior (from wherever it is) `delay` after the next update.
+      void schedule(uint32_t delay) const {
+        _scheduled = false;
+        _delay = delay;
+      }
+
+      // Resumes the behavior, with `state`, if it is due at `time`; returns whether it was. Behaviors that
+      // finish give their frame back to the pool straight away.
+      bool update(uint32_t time, S& state) const {
+        if (!_handle) {
+          return false;
+        }
+
+        if (!_scheduled) {
+          _since = time;
+          _wake_at = time + _delay;
+          _scheduled = true;
+        }
+
+        if (static_cast<int32_t>(time - _wake_at) < 0) {
+          return false;
+        }
+
+        promise_type& promise = _handle.promise();
+        promise.context = BehaviorContext<S> { &state, time };
+        promise.wake_at = time;
+        _handle.resume();
+
+        if (_handle.done()) {
+          _handle.destroy();
+          _handle = nullptr;
+          return true;
+        }
+
+        promise.context.state = nullptr;
+        _since = time;
+        _wake_at = promise.wake_at;
+        return true;
+      }
+
+      // When the behavior will next run, as a timer (see `Timer::Snapshot`) counting from when it last ran;
+      // behaviors that have not been updated since they were scheduled are as if never ticked.
+      Timer::Snapshot timer() const {
+        if (!_handle) {
+          return Timer::Snapshot { 0, 0, 0 };
+        }
+
+        if (!_scheduled) {
+          return Timer::Snapshot { 0, _delay, 0 };
+        }
+
+        return Timer::Snapshot { 0, _wake_at - _since, _since };
+      }
+
+      // Wakes the behavior when `timer` (see `timer()`) says.
+      void restore(const Timer::Snapshot& timer) const {
+        if (timer.last_time == 0) {
+          return schedule(timer.remaining);
+        }
+
+        _since = timer.last_time;
+        _wake_at = timer.last_time + timer.remaining;
+        _scheduled = true;
+      }
+
+    private:
+      explicit Behavior(std::coroutine_handle<promise_type> handle):
+        _handle(handle),
+        _scheduled(false),
+        _delay(0),
+        _since(0),
+        _wake_at(0) {
+        }
+
+      mutable std::coroutine_handle<promise_type> _handle;
+
+      // Behaviors are scheduled relative to the first update after they start (or are restored).
+      mutable bool _scheduled;
+      mutable uint32_t _delay;
+
+      // When the behavior last ran, and when it next will; kept here (rather than in the coroutine frame)
+      // so that sleeping behaviors are skipped without touching their frames.
+      mutable uint32_t _since;
+      mutable uint32_t _wake_at;
+  };
+}
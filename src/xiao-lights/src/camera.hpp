@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+
+#include "types.hpp"
+
+namespace xr {
+  // Maps positions in the world (which is as long as the level being played) onto the strip, which shows
+  // `width` of them at a time. The camera scrolls to keep players in view, but only once they get within
+  // a quarter of the strip from its edges, so it does not jitter back and forth with every step.
+  class Camera final {
+    public:
+      Camera(uint32_t width, uint32_t world): _width(width), _world(std::max(width, world)), _offset(0) {}
+      Camera(): Camera(0, 0) {}
+      ~Camera() = default;
+
+      // The world position shown on the first light of the strip.
+      uint32_t offset() const {
+        return _offset;
+      }
+
+      uint32_t width() const {
+        return _width;
+      }
+
+      uint32_t world() const {
+        return _world;
+      }
+
+      // Scrolls so that every player between `first` and `last` is in view; when they are too far apart
+      // to all fit, the leading player (at `last`) is the one kept in view.
+      void follow(uint32_t first, uint32_t last) {
+        uint32_t margin = _width / 4;
+        uint32_t offset = _offset;
+
+        if (_width == 0) {
+          return;
+        }
+
+        if (last + margin + 1 > offset + _width) {
+          offset = last + margin + 1 - _width;
+        }
+
+        if (first < offset + margin) {
+          uint32_t back = first > margin ? first - margin : 0;
+          uint32_t leader = last + 1 > _width ? last + 1 - _width : 0;
+          offset = std::max(back, leader);
+        }
+
+        _offset = std::min(offset, _world - _width);
+      }
+
+      bool contains(uint32_t position) const {
+        return position >= _offset && position - _offset < _width;
+      }
+
+      // Moves a light from world to strip coordinates; only meaningful for lights the camera `contains`.
+      Light project(const Light& light) const {
+        auto [position, red, green, blue] = light;
+        return Light { position - _offset, red, green, blue };
+      }
+
+    private:
+      uint32_t _width;
+      uint32_t _world;
+      uint32_t _offset;
+  };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace xr {
+  // Maps a controller's clock onto ours from the timestamps on the messages it sends us. Every message
+  // gives us an offset (our time of arrival less the controller's time of sending) made up of the
+  // difference in clocks plus however long the message spent in the air; the smallest offset seen is
+  // the one with the least delay, which we take as the difference in clocks. Mapped times are then never
+  // later than when the message actually arrived, with any radio jitter on top of that removed.
+  //
+  // The smallest offset is taken over windows of `WINDOW` messages so that clock drift is followed.
+  class ClockSync final {
+    public:
+      constexpr static const uint32_t WINDOW = 256;
+
+      ClockSync(): _offset(0), _window_min(0), _samples(0), _synced(false) {}
+      ~ClockSync() = default;
+
+      void observe(uint32_t remote_time, uint32_t local_time) {
+        uint32_t sample = local_time - remote_time;
+
+        if (_samples == 0 || earlier(sample, _window_min)) {
+          _window_min = sample;
+        }
+
+        if (!_synced || earlier(sample, _offset)) {
+          _offset = sample;
+          _synced = true;
+        }
+
+        _samples += 1;
+
+        if (_samples == WINDOW) {
+          _offset = _window_min;
+          _samples = 0;
+        }
+      }
+
+      // Forgets everything observed so far, e.g after the controller has restarted.
+      void reset() {
+        _samples = 0;
+        _synced = false;
+      }
+
+      uint32_t map(uint32_t remote_time) const {
+        return remote_time + _offset;
+      }
+
+      bool is_synced() const {
+        return _synced;
+      }
+
+    private:
+      // Offsets are compared with wrapping arithmetic; clocks are unrelated so either may be ahead.
+      static bool earlier(uint32_t left, uint32_t right) {
+        return static_cast<int32_t>(left - right) < 0;
+      }
+
+      uint32_t _offset;
+      uint32_t _window_min;
+      uint32_t _samples;
+      bool _synced;
+  };
+}
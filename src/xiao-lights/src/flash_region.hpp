@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <esp_partition.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xr {
+  // A read-only, memory mapped view of some bytes: a data partition on the esp32 (mapped through the
+  // flash cache, so reading it costs no ram) or a file when built for a host. Anything reading through a
+  // region (e.g. `LevelPack`) runs unchanged on either.
+  class FlashRegion final {
+    public:
+#ifdef ARDUINO
+      // Maps the whole of the data partition labelled `name`.
+      explicit FlashRegion(const char * name): _data(nullptr), _size(0), _map(0) {
+        auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+        const void * memory = nullptr;
+
+        if (partition == nullptr) {
+          return;
+        }
+
+        if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &memory, &_map) == ESP_OK) {
+          _data = static_cast<const uint8_t *>(memory);
+          _size = partition->size;
+        }
+      }
+      ~FlashRegion() {
+        if (_data != nullptr) {
+          esp_partition_munmap(_map);
+        }
+      }
+#else
+      // Maps the whole of the file at `name`.
+      explicit FlashRegion(const char * name): _data(nullptr), _size(0) {
+        int file = open(name, O_RDONLY);
+        struct stat info;
+
+        if (file < 0) {
+          return;
+        }
+
+        if (fstat(file, &info) == 0 && info.st_size > 0) {
+          void * memory = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+          if (memory != MAP_FAILED) {
+            _data = static_cast<const uint8_t *>(memory);
+            _size = static_cast<uint32_t>(info.st_size);
+          }
+        }
+
+        // The mapping outlives the descriptor.
+        close(file);
+      }
+      ~FlashRegion() {
+        if (_data != nullptr) {
+          munmap(const_cast<uint8_t *>(_data), _size);
+        }
+      }
+#endif
+
+      FlashRegion(const FlashRegion&) = delete;
+      FlashRegion& operator=(const FlashRegion&) = delete;
+
+      bool is_mapped() const {
+        return _data != nullptr;
+      }
+
+      const uint8_t * data() const {
+        return _data;
+      }
+
+      uint32_t size() const {
+        return _size;
+      }
+
+    private:
+      const uint8_t * _data;
+      uint32_t _size;
+#ifdef ARDUINO
+      esp_partition_mmap_handle_t _map;
+#endif
+  };
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+
+#include "types.hpp"
+
+namespace xr {
+  // Everything that happened during a single frame, in the order it happened. Players and obstacles emit
+  // events while they are updated, and the level handles them all at once afterwards (see `Level::frame`),
+  // so that no player or obstacle depends on what was updated before it. Events past `CAPACITY` are
+  // dropped (and counted); nothing is ever allocated.
+  class FrameEvents final {
+    public:
+      constexpr static const uint32_t CAPACITY = 64;
+
+      FrameEvents(): _count(0), _dropped(0) {}
+      ~FrameEvents() = default;
+
+      FrameEvents(const FrameEvents&) = delete;
+      FrameEvents& operator=(const FrameEvents&) = delete;
+
+      void clear() {
+        _count = 0;
+        _dropped = 0;
+      }
+
+      bool emit(const FrameEvent& event) {
+        if (_count == CAPACITY) {
+          _dropped += 1;
+          return false;
+        }
+
+        _events[_count++] = event;
+        return true;
+      }
+
+      const FrameEvent * begin() const {
+        return _events.data();
+      }
+
+      const FrameEvent * end() const {
+        return _events.data() + _count;
+      }
+
+      uint32_t size() const {
+        return _count;
+      }
+
+      // How many events did not fit since the last `clear`.
+      uint32_t dropped() const {
+        return _dropped;
+      }
+
+    private:
+      std::array<FrameEvent, CAPACITY> _events;
+      uint32_t _count;
+      uint32_t _dropped;
+  };
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "clock_sync.hpp"
+#include "types.hpp"
+
+namespace xr {
+  // Frames are broadcast by the leading light host over esp-now, split into packets that each hold some
+  // of the frame's runs of lights:
+  //
+  // | magic (4) | sequence (4) | present at (4) | sent at (4) | part (1) | parts (1) | count (1) | runs |
+  //
+  // where every run is the position of its first light (2 bytes) and how many lights it covers (1 byte),
+  // followed by their red, green and blue. Neighbouring lights of the same color (e.g the completion
+  // animation, which spans the whole track) share a single run. Times are in microseconds on the
+  // leader's clock; like level packs, everything is stored in our (little endian) byte order.
+  struct SyncPacket final {
+    constexpr static const uint32_t MAGIC = 0x46535258;
+    constexpr static const uint32_t MAX_SIZE = 250;
+    constexpr static const uint32_t HEADER_SIZE = 19;
+    constexpr static const uint32_t RUN_SIZE = 6;
+    constexpr static const uint32_t RUNS_PER_PACKET = (MAX_SIZE - HEADER_SIZE) / RUN_SIZE;
+    // Enough for every light on a track of 600 to differ from its neighbours; frames like that take ~30ms
+    // to send, but are rare (most take a single packet).
+    constexpr static const uint8_t MAX_PARTS = 16;
+
+    // Esp-now sends at 1Mbps unless told otherwise: a long preamble, then our data wrapped in ~43 bytes
+    // of 802.11 and vendor headers.
+    constexpr static const uint32_t AIR_PREAMBLE_US = 192;
+    constexpr static const uint32_t AIR_OVERHEAD_BYTES = 43;
+    constexpr static const uint32_t AIR_US_PER_BYTE = 8;
+
+    static bool is_packet(const uint8_t * data, uint32_t size) {
+      uint32_t magic = 0;
+
+      if (size < HEADER_SIZE) {
+        return false;
+      }
+
+      memcpy(&magic, data, sizeof(magic));
+      return magic == MAGIC;
+    }
+
+    // Roughly how long a packet of `size` bytes spends in the air.
+    constexpr static uint32_t airtime(uint32_t size) {
+      return AIR_PREAMBLE_US + (size + AIR_OVERHEAD_BYTES) * AIR_US_PER_BYTE;
+    }
+  };
+
+  // `length` lights of the same color, from `start` on.
+  struct SyncRun final {
+    uint16_t start;
+    uint8_t length;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+  };
+
+  struct SyncFrame final {
+    constexpr static const uint32_t MAX_RUNS = SyncPacket::RUNS_PER_PACKET * SyncPacket::MAX_PARTS;
+
+    uint32_t sequence;
+    uint32_t present_at;
+    uint32_t count;
+    std::array<SyncRun, MAX_RUNS> runs;
+
+    // Calls `visit(light)` for every light in the frame, in order.
+    template <typename V>
+    void each(V&& visit) const {
+      for (uint32_t i = 0; i < count; i++) {
+        const SyncRun& run = runs[i];
+
+        for (uint32_t offset = 0; offset < run.length; offset++) {
+          visit(Light { static_cast<uint32_t>(run.start) + offset, run.red, run.green, run.blue });
+        }
+      }
+    }
+  };
+
+  // The leading light host runs the level and broadcasts every frame's lights (see `SyncPacket`) through
+  // `T`, which provides `micros()` and `send(data, size)`, to be presented at the same moment by every
+  // light host. Frames are scheduled far enough ahead for all of their packets to make it through the air
+  // (plus `margin` microseconds), and packets are stamped as they are sent so that followers can map our
+  // clock onto theirs.
+  //
+  // Lights are collected into a buffer as long as the whole track, so that a light replaces whatever was
+  // added at its position before it (as it does in a `Framebuffer`), and are sent as runs. Lights off the
+  // end of the track, or past the runs a frame can hold, are dropped and counted (see `take_dropped`).
+  template <typename T>
+  class SyncLeader final {
+    public:
+      SyncLeader(T& transport, uint32_t margin, uint32_t track):
+        _transport(transport),
+        _margin(margin),
+        _sequence(0),
+        _slots(new std::vector<Slot>(std::min<uint32_t>(track, UINT16_MAX + 1), Slot { false, 0, 0, 0 })),
+        _count(0),
+        _dropped(0) {
+        }
+      ~SyncLeader() = default;
+
+      SyncLeader(const SyncLeader&) = delete;
+      SyncLeader& operator=(const SyncLeader&) = delete;
+
+      void clear() {
+        std::fill(_slots->begin(), _slots->end(), Slot { false, 0, 0, 0 });
+      }
+
+      // Adds a light to the next frame, replacing any light already at its position.
+      bool add(const Light& light) {
+        auto [position, red, green, blue] = light;
+
+        if (position >= _slots->size()) {
+          _dropped += 1;
+          return false;
+        }
+
+        (*_slots)[position] = Slot { true, red, green, blue };
+        return true;
+      }
+
+      // Broadcasts the frame, returning the time (on our clock) it is to be presented at.
+      uint32_t send() {
+        encode();
+
+        uint8_t parts = std::max(1u, (_count + SyncPacket::RUNS_PER_PACKET - 1) / SyncPacket::RUNS_PER_PACKET);
+        uint32_t airtime = 0;
+
+        for (uint8_t part = 0; part < parts; part++) {
+          airtime += SyncPacket::airtime(SyncPacket::HEADER_SIZE + runs_in(part) * SyncPacket::RUN_SIZE);
+        }
+
+        uint32_t present_at = _transport.micros() + airtime + _margin;
+        _sequence += 1;
+
+        for (uint8_t part = 0; part < parts; part++) {
+          std::array<uint8_t, SyncPacket::MAX_SIZE> packet;
+          uint8_t count = runs_in(part);
+          uint32_t sent_at = _transport.micros();
+
+          memcpy(packet.data(), &SyncPacket::MAGIC, 4);
+          memcpy(packet.data() + 4, &_sequence, 4);
+          memcpy(packet.data() + 8, &present_at, 4);
+          memcpy(packet.data() + 12, &sent_at, 4);
+          packet[16] = part;
+          packet[17] = parts;
+          packet[18] = count;
+
+          uint8_t * cursor = packet.data() + SyncPacket::HEADER_SIZE;
+
+          for (uint32_t i = 0; i < count; i++) {
+            const SyncRun& run = _runs[part * SyncPacket::RUNS_PER_PACKET + i];
+            memcpy(cursor, &run.start, 2);
+            cursor[2] = run.length;
+            cursor[3] = run.red;
+            cursor[4] = run.green;
+            cursor[5] = run.blue;
+            cursor += SyncPacket::RUN_SIZE;
+          }
+
+          _transport.send(packet.data(), cursor - packet.data());
+        }
+
+        return present_at;
+      }
+
+      // Takes the number of lights dropped since the last call.
+      uint32_t take_dropped() {
+        uint32_t result = _dropped;
+        _dropped = 0;
+        return result;
+      }
+
+    private:
+      struct Slot final {
+        bool lit;
+        uint8_t red;
+        uint8_t green;
+        uint8_t blue;
+      };
+
+      // Gathers the lit slots into runs.
+      void encode() {
+        _count = 0;
+
+        for (uint32_t position = 0; position < _slots->size(); position++) {
+          const Slot& slot = (*_slots)[position];
+
+          if (!slot.lit) {
+            continue;
+          }
+
+          if (_count > 0) {
+            SyncRun& last = _runs[_count - 1];
+            bool same_color = last.red == slot.red && last.green == slot.green && last.blue == slot.blue;
+
+            if (same_color && last.start + last.length == position && last.length < UINT8_MAX) {
+              last.length += 1;
+              continue;
+            }
+          }
+
+          if (_count == _runs.size()) {
+            _dropped += 1;
+            continue;
+          }
+
+          _runs[_count++] = SyncRun { static_cast<uint16_t>(position), 1, slot.red, slot.green, slot.blue };
+        }
+      }
+
+      uint8_t runs_in(uint8_t part) const {
+        uint32_t start = part * SyncPacket::RUNS_PER_PACKET;
+        return start >= _count ? 0 : std::min(_count - start, SyncPacket::RUNS_PER_PACKET);
+      }
+
+      T& _transport;
+      uint32_t _margin;
+      uint32_t _sequence;
+      std::unique_ptr<std::vector<Slot>> _slots;
+      std::array<SyncRun, SyncFrame::MAX_RUNS> _runs;
+      uint32_t _count;
+      uint32_t _dropped;
+  };
+
+  // A light host following a leader (see `SyncLeader`): packets are assembled back into frames, which are
+  // handed out once the time they were scheduled for comes around on our clock.
+  //
+  // The leader's clock is mapped onto ours (see `ClockSync`) from the time every packet was sent and the
+  // time it finished arriving, less the time it spent in the air. Frames missing a packet are dropped,
+  // and a frame that completes before the previous one was taken replaces it.
+  class SyncFollower final {
+    public:
+      SyncFollower(): _parts_seen(0), _has_ready(false), _last_heard(0) {
+        _assembling.sequence = 0;
+        _assembling.count = 0;
+      }
+      ~SyncFollower() = default;
+
+      SyncFollower(const SyncFollower&) = delete;
+      SyncFollower& operator=(const SyncFollower&) = delete;
+
+      // Takes a packet that finished arriving at `arrival` (on our clock), returning false for anything
+      // that is not a well formed sync packet.
+      bool receive(const uint8_t * data, uint32_t size, uint32_t arrival) {
+        if (!SyncPacket::is_packet(data, size)) {
+          return false;
+        }
+
+        uint32_t sequence, present_at, sent_at;
+        memcpy(&sequence, data + 4, 4);
+        memcpy(&present_at, data + 8, 4);
+        memcpy(&sent_at, data + 12, 4);
+        uint8_t part = data[16];
+        uint8_t parts = data[17];
+        uint8_t count = data[18];
+
+        if (parts == 0 || parts > SyncPacket::MAX_PARTS || part >= parts) {
+          return false;
+        }
+
+        if (count > SyncPacket::RUNS_PER_PACKET || size < SyncPacket::HEADER_SIZE + count * SyncPacket::RUN_SIZE) {
+          return false;
+        }
+
+        // A sequence going backwards means the leader restarted, with a clock that started over.
+        if (sequence != _assembling.sequence) {
+          if (static_cast<int32_t>(sequence - _assembling.sequence) < 0) {
+            _clock.reset();
+          }
+
+          _assembling.sequence = sequence;
+          _assembling.count = 0;
+          _parts_seen = 0;
+        }
+
+        _clock.observe(sent_at, arrival - SyncPacket::airtime(size));
+        _last_heard = arrival;
+
+        const uint8_t * cursor = data + SyncPacket::HEADER_SIZE;
+        uint32_t start = part * SyncPacket::RUNS_PER_PACKET;
+
+        for (uint32_t i = 0; i < count; i++) {
+          SyncRun& run = _assembling.runs[start + i];
+          memcpy(&run.start, cursor, 2);
+          run.length = cursor[2];
+          run.red = cursor[3];
+          run.green = cursor[4];
+          run.blue = cursor[5];
+          cursor += SyncPacket::RUN_SIZE;
+        }
+
+        _assembling.count = std::max(_assembling.count, start + count);
+        _parts_seen |= 1u << part;
+
+        if (_parts_seen == (1u << parts) - 1) {
+          _ready = _assembling;
+          _ready.present_at = _clock.map(present_at);
+          _has_ready = true;
+        }
+
+        return true;
+      }
+
+      // When the next complete frame is due, on our clock.
+      std::optional<uint32_t> due_at() const {
+        return _has_ready ? std::make_optional(_ready.present_at) : std::nullopt;
+      }
+
+      // Copies out the next complete frame if it is due at `now`.
+      bool take(uint32_t now, SyncFrame& frame) {
+        if (!_has_ready || static_cast<int32_t>(_ready.present_at - now) > 0) {
+          return false;
+        }
+
+        frame = _ready;
+        _has_ready = false;
+        return true;
+      }
+
+      // When we last heard from the leader, on our clock.
+      uint32_t last_heard() const {
+        return _last_heard;
+      }
+
+    private:
+      ClockSync _clock;
+      SyncFrame _assembling;
+      SyncFrame _ready;
+      uint32_t _parts_seen;
+      bool _has_ready;
+      uint32_t _last_heard;
+  };
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "types.hpp"
+
+namespace xr {
+  // The framebuffer holds every pixel of the strip at 16 bits per channel. Lights produced by the
+  // game are 8-bit, but brightness is applied here (instead of on the strip)
+  // so that dim colors keep their precision until the very last step, where `render` temporally
+  // dithers them down to the 8 bits the strip understands.
+  //
+  // Dithering works by carrying the bits truncated from each channel into the next frame; a channel
+  // sitting at 10.25 will be shown as 10 for three frames and 11 for the fourth. This relies on frames
+  // being pushed out quickly - at ~30us per pixel, a 146 pixel strip refreshes well above 100hz.
+  class Framebuffer final {
+    public:
+      using Color16 = std::array<uint16_t, 3>;
+
+      explicit Framebuffer(uint32_t size, uint8_t brightness):
+        _colors(new std::vector<Color16>(size, Color16 { 0, 0, 0 })),
+        _residue(new std::vector<std::array<uint8_t, 3>>(size, std::array<uint8_t, 3> { 0, 0, 0 })),
+        _brightness(brightness) {
+        }
+      ~Framebuffer() = default;
+
+      Framebuffer(const Framebuffer&) = delete;
+      Framebuffer& operator=(const Framebuffer&) = delete;
+
+      uint32_t size() const {
+        return _colors->size();
+      }
+
+      void clear() {
+        std::fill(_colors->begin(), _colors->end(), Color16 { 0, 0, 0 });
+      }
+
+      // Replaces the color at the light's position; positions outside of the strip are ignored.
+      void set(const Light& light) {
+        auto [position, red, green, blue] = light;
+
+        if (position >= _colors->size()) {
+          return;
+        }
+
+        (*_colors)[position] = Color16 { expand(red), expand(green), expand(blue) };
+      }
+
+      // Adds the light's color, scaled by `intensity` (out of 255), to whatever is already at its position,
+      // saturating at full brightness. Faint lights keep their 16 bits here, so they fade out smoothly.
+      void add(const Light& light, uint8_t intensity) {
+        auto [position, red, green, blue] = light;
+
+        if (position >= _colors->size()) {
+          return;
+        }
+
+        Color16& color = (*_colors)[position];
+        uint8_t channels[3] = { red, green, blue };
+
+        for (uint8_t channel = 0; channel < 3; channel++) {
+          uint32_t value = color[channel] + ((static_cast<uint32_t>(expand(channels[channel])) * (intensity + 1u)) >> 8);
+          color[channel] = std::min(value, 0xFFFFu);
+        }
+      }
+
+      // Writes `count` pixels starting at `start` out through `write(index, red, green, blue)` as 8-bit
+      // values.
+      template <typename W>
+      void render(uint32_t start, uint32_t count, W&& write) {
+        uint32_t end = std::min(start + count, size());
+
+        for (uint32_t i = start; i < end; i++) {
+          const Color16& color = (*_colors)[i];
+          std::array<uint8_t, 3>& residue = (*_residue)[i];
+          uint8_t out[3];
+
+          for (uint8_t channel = 0; channel < 3; channel++) {
+            uint32_t value = color[channel] + residue[channel];
+            out[channel] = value > 0xFFFF ? 0xFF : value >> 8;
+            residue[channel] = value > 0xFFFF ? 0 : value & 0xFF;
+          }
+
+          write(i, out[0], out[1], out[2]);
+        }
+      }
+
+    private:
+      // Scales an 8-bit channel up to 16 bits (255 -> 65535) and applies our brightness.
+      uint16_t expand(uint8_t value) const {
+        return (static_cast<uint32_t>(value) * 257 * (static_cast<uint32_t>(_brightness) + 1)) >> 8;
+      }
+
+      std::unique_ptr<std::vector<Color16>> _colors;
+      std::unique_ptr<std::vector<std::array<uint8_t, 3>>> _residue;
+      uint8_t _brightness;
+  };
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <utility>
+
+namespace xr {
+  // A token from a level layout (see `Level`) and where in the world it goes.
+  struct Placement final {
+    char token;
+    uint32_t position;
+  };
+
+  // A level described by where its tokens go rather than by layout text, as produced by
+  // `LevelGenerator`. Placements are kept in order of position.
+  struct GeneratedLevel final {
+    constexpr static const uint32_t MAX_PLACEMENTS = 48;
+
+    uint32_t length;
+    uint32_t count;
+    std::array<Placement, MAX_PLACEMENTS> placements;
+
+    // Adds a placement, returning false once there is no more room.
+    bool place(char token, uint32_t position) {
+      if (count == MAX_PLACEMENTS) {
+        return false;
+      }
+
+      placements[count++] = Placement { token, position };
+      return true;
+    }
+
+    template <typename V>
+    void each(V&& visit) const {
+      for (uint32_t i = 0; i < count; i++) {
+        visit(placements[i].token, placements[i].position);
+      }
+    }
+
+    // Generated levels only use the obstacles built into our firmware.
+    std::pair<const char *, uint32_t> scripts() const {
+      return std::make_pair("", 0);
+    }
+  };
+}
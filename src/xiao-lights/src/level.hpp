@@ -1,15 +1,42 @@
 #pragma once
 
+#include "logging.hpp"
+#include "behavior.hpp"
+#include "camera.hpp"
+#include "frame_events.hpp"
+#include "generated_level.hpp"
 #include "timer.hpp"
 #include "types.hpp"
 #include "animation.hpp"
 #include "obstacle.hpp"
+#include "particles.hpp"
 #include "player.hpp"
+#include "script.hpp"
 
 class Level final {
   public:
-    constexpr static const uint32_t LEVEL_BUFFER_SIZE = 256;
-    constexpr static const uint32_t OBSTACLE_BUFFER_SIZE = 15;
+    // Where players start in level layouts.
+    constexpr static const char PLAYER_TOKEN = 'p';
+
+    // Checkpoints in level layouts; once any player reaches one, failing the level restarts it from
+    // there (see `restart`).
+    constexpr static const char CHECKPOINT_TOKEN = 'c';
+    constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> CHECKPOINT_COLOR = std::make_tuple(0, 20, 60);
+
+    // Obstacles further than this from the strip (and from every player) are asleep; they neither move
+    // nor render until the camera gets close to them.
+    constexpr static const uint32_t WAKE_DISTANCE = 24;
+
+    // What is thrown out (see `xr::Particles`) when obstacles are defeated, players are hit, the goal is
+    // reached and players join or start attacking.
+    constexpr static const xr::Burst DEFEAT_BURST = { 24, 10, 700, std::make_tuple(255, 60, 0) };
+    constexpr static const xr::Burst HIT_BURST = { 32, 14, 900, std::make_tuple(255, 40, 40) };
+    constexpr static const xr::Burst GOAL_BURST = { 64, 20, 1200, std::make_tuple(60, 255, 60) };
+    constexpr static const xr::Burst ATTACK_BURST = { 6, 6, 250, std::make_tuple(120, 255, 120) };
+    constexpr static const xr::Burst JOIN_BURST = { 12, 8, 500, std::make_tuple(255, 255, 255) };
+
+    // Sparks thrown out by scripts, in their own count and color (see `xr::Script::Op::EMIT`).
+    constexpr static const xr::Burst SIGNAL_BURST = { 0, 10, 600, std::make_tuple(255, 255, 255) };
 
     enum LevelStateKind {
       IN_PROGRESS,
@@ -17,27 +44,46 @@ class Level final {
       COMPLETE,
     };
 
-    explicit Level(std::pair<const char *, uint32_t> layout, uint32_t bound):
-      _impl(RunningState()),
-      _data(new std::vector<Light>(0)),
-      _boundary(bound) {
-        _data->reserve(LEVEL_BUFFER_SIZE);
+    // Everything about a level that changes while it is played, other than its obstacles (which are
+    // snapshotted alongside, see `Obstacle::Snapshot`), as plain data. Levels keep one from when they
+    // started and one from their last checkpoint, so restarting is a copy rather than a rebuild.
+    struct Snapshot final {
+      std::array<Player::Snapshot, MAX_PLAYERS> players;
+      xr::Camera camera;
+      uint32_t checkpoint;
+    };
 
-        const char * cursor = std::get<0>(layout);
-        uint32_t index = 0;
+    // How much room each of a level's buffers has. All of them are sized when the level is built, and
+    // none of them grow while it is played.
+    struct Capacities final {
+      uint32_t lights;
+      uint32_t obstacles;
+      uint32_t obstacle_lights;
+      uint32_t checkpoints;
+      uint32_t obstacle_snapshots;
+    };
 
-        while (index < _boundary) {
-          if (cursor == nullptr || *cursor == '\0' || *cursor == '\n') {
-            break;
-          }
-          auto attempt = Obstacle::try_from(*cursor, index);
-          if (attempt != std::nullopt) {
-            auto running = std::get_if<RunningState>(&_impl);
-            running->_obstacles->push_back(std::move(attempt.value()));
-          }
-          index++;
-          cursor++;
-        }
+    // Builds a level from a single line of layout text. Every buffer the level will need while it is
+    // being played is sized here, based on the obstacles in the layout and the length of the strip
+    // (`bound`), so that nothing is reallocated mid-frame.
+    //
+    // Each character of the layout is one position in the world, which is as long as the layout (or the
+    // strip, whichever is longer); the strip shows the part of it the players are in (see `xr::Camera`).
+    // When `stretch` is set, layout positions are instead scaled so the line spans exactly the strip.
+    //
+    // Digits in the layout are obstacles run by scripts, which follow the layout on the same line (see
+    // `xr::ScriptLibrary`).
+    explicit Level(std::pair<const char *, uint32_t> layout, uint32_t bound, bool stretch = false):
+      Level(
+        TextLayout { layout, stretch, stretch ? bound : std::max(bound, layout_length(layout)) },
+        bound,
+        stretch ? bound : std::max(bound, layout_length(layout))
+      ) {
+      }
+
+    // Builds a generated level (see `xr::LevelGenerator`) straight from its placements.
+    explicit Level(const xr::GeneratedLevel& generated, uint32_t bound):
+      Level(generated, bound, std::max(bound, generated.length)) {
       }
 
     Level(): Level(std::make_pair("", 0), 0) {}
@@ -47,15 +93,34 @@ class Level final {
     Level& operator=(const Level&) = delete;
 
     Level(const Level&& other):
+      _behaviors(std::move(other._behaviors)),
       _impl(std::move(other._impl)),
       _data(std::move(other._data)),
-      _boundary(other._boundary) {
+      _boundary(other._boundary),
+      _camera(other._camera),
+      _checkpoints(std::move(other._checkpoints)),
+      _reached(other._reached),
+      _snapshots(std::move(other._snapshots)),
+      _obstacle_snapshots(std::move(other._obstacle_snapshots)),
+      _particles(std::move(other._particles)),
+      _events(std::move(other._events)),
+      _scripts(std::move(other._scripts)) {
       }
 
     const Level& operator=(const Level&& other) const {
+      // Our old obstacles go (handing their behaviors back to our old pool) before the pool does.
       _impl = std::move(other._impl);
+      _behaviors = std::move(other._behaviors);
       _boundary = other._boundary;
+      _camera = other._camera;
       _data = std::move(other._data);
+      _checkpoints = std::move(other._checkpoints);
+      _reached = other._reached;
+      _snapshots = std::move(other._snapshots);
+      _obstacle_snapshots = std::move(other._obstacle_snapshots);
+      _particles = std::move(other._particles);
+      _events = std::move(other._events);
+      _scripts = std::move(other._scripts);
       return *this;
     }
 
@@ -67,111 +132,446 @@ class Level final {
       return _data->cend();
     }
 
+    // Calls `write(light, intensity)` for every particle on the strip; particles are drawn on top of
+    // (and added to) the level's lights.
+    template <typename W>
+    void render_particles(W&& write) const {
+      _particles->render(_camera, write);
+    }
+
     LevelStateKind state() const {
-      if (std::holds_alternative<CompletedState>(_impl) != true) {
+      auto completed = std::get_if<CompletedState>(&_impl);
+
+      if (completed == nullptr || completed->_completion_timer->is_done() != true) {
         return LevelStateKind::IN_PROGRESS;
       }
 
+      return outcome();
+    }
+
+    // What `state` will be once the completion animation (if any) is over.
+    LevelStateKind outcome() const {
       auto completed = std::get_if<CompletedState>(&_impl);
 
-      if (completed->_completion_timer->is_done() != true) {
+      if (completed == nullptr) {
         return LevelStateKind::IN_PROGRESS;
       }
 
       return completed->_result ? LevelStateKind::COMPLETE : LevelStateKind::FAILED;
     }
 
-    const Level frame(uint32_t current_time, const std::optional<ControllerInput>& input) const && noexcept {
+    const Level frame(uint32_t current_time, const PlayerInputs& inputs) const && noexcept {
       _data->clear();
-      auto new_state = std::visit(StateVisitor{ _data.get(), current_time, input, _boundary }, _impl);
+      _events->clear();
+      _particles->update(current_time);
+      auto new_state = std::visit(
+        StateVisitor{ _data.get(), current_time, inputs, _camera, *_checkpoints, _reached, *_particles, *_events },
+        _impl
+      );
       _impl = std::move(new_state);
 
+      if (_events->dropped() > 0) {
+        xr_log_e(LEVEL, "%d frame events dropped", _events->dropped());
+      }
+
+      auto running = std::get_if<RunningState>(&_impl);
+
+      if (running != nullptr && _reached < _checkpoints->size()) {
+        uint32_t reached = _reached;
+
+        for (auto player = running->_players->cbegin(); player != running->_players->cend(); player++) {
+          while (player->is_playing() && reached < _checkpoints->size() && player->position() >= (*_checkpoints)[reached]) {
+            reached++;
+          }
+        }
+
+        if (reached != _reached) {
+          xr_log_d(LEVEL, "checkpoint %d reached", reached);
+          _reached = reached;
+          save_slot(SnapshotSlot::CHECKPOINT);
+        }
+      }
+
       return std::move(*this);
     }
 
+    // Puts the level back the way it was when it started (or when its last checkpoint was reached), in
+    // place; nothing is rebuilt or allocated.
+    void restart(bool from_checkpoint) const {
+      auto slot = from_checkpoint ? SnapshotSlot::CHECKPOINT : SnapshotSlot::START;
+      restore((*_snapshots)[slot], _obstacle_snapshots->data() + slot * obstacle_count());
+    }
+
+    uint32_t obstacle_count() const {
+      return running_state()->_obstacles->size();
+    }
+
+    Capacities capacities() const {
+      auto obstacles = running_state()->_obstacles.get();
+      uint32_t obstacle_lights = 0;
+
+      for (auto obstacle = obstacles->cbegin(); obstacle != obstacles->cend(); obstacle++) {
+        obstacle_lights += obstacle->light_buffer_capacity();
+      }
+
+      return Capacities {
+        static_cast<uint32_t>(_data->capacity()),
+        static_cast<uint32_t>(obstacles->capacity()),
+        obstacle_lights,
+        static_cast<uint32_t>(_checkpoints->capacity()),
+        static_cast<uint32_t>(_obstacle_snapshots->capacity()),
+      };
+    }
+
+    // Copies everything that changes while the level is played into `snapshot`, and each obstacle into
+    // `obstacles` (which must have room for `obstacle_count` of them).
+    void save(Snapshot& snapshot, Obstacle::Snapshot * obstacles) const {
+      auto running = running_state();
+
+      for (uint8_t i = 0; i < MAX_PLAYERS; i++) {
+        snapshot.players[i] = (*running->_players)[i].snapshot();
+      }
+
+      for (auto obstacle = running->_obstacles->cbegin(); obstacle != running->_obstacles->cend(); obstacle++) {
+        *obstacles++ = obstacle->snapshot();
+      }
+
+      snapshot.camera = _camera;
+      snapshot.checkpoint = _reached;
+    }
+
+    // Puts the level back exactly the way it was when `save` was called, in place (even if it has been
+    // completed since); nothing is rebuilt or allocated.
+    void restore(const Snapshot& snapshot, const Obstacle::Snapshot * obstacles) const {
+      if (auto completed = std::get_if<CompletedState>(&_impl)) {
+        RunningState running(std::move(completed->_running));
+        _impl = std::move(running);
+      }
+
+      auto running = running_state();
+      _data->clear();
+
+      for (uint8_t i = 0; i < MAX_PLAYERS; i++) {
+        (*running->_players)[i].restore(snapshot.players[i]);
+      }
+
+      for (auto obstacle = running->_obstacles->cbegin(); obstacle != running->_obstacles->cend(); obstacle++) {
+        obstacle->restore(*obstacles++, *_scripts);
+      }
+
+      _camera = snapshot.camera;
+      _reached = snapshot.checkpoint;
+      _particles->clear();
+    }
+
   private:
+    enum SnapshotSlot {
+      START,
+      CHECKPOINT,
+    };
+
+    // The length of a layout, up to the end of its line (or its scripts).
+    static uint32_t layout_length(std::pair<const char *, uint32_t> layout) {
+      auto [cursor, length] = layout;
+      uint32_t result = 0;
+
+      while (result < length && cursor[result] != '\0' && cursor[result] != '\n' && cursor[result] != xr::ScriptLibrary::SEPARATOR) {
+        result++;
+      }
+
+      return result;
+    }
+
+    // Layout text, visited a token at a time like any other layout (see `xr::GeneratedLevel`).
+    struct TextLayout final {
+      std::pair<const char *, uint32_t> text;
+      bool stretch;
+      uint32_t world;
+
+      template <typename V>
+      void each(V&& visit) const {
+        auto cursor = text.first;
+        uint32_t length = layout_length(text);
+
+        for (uint32_t i = 0; i < length; i++) {
+          uint32_t index = stretch && length > 1 && world > 0 ? (i * (world - 1)) / (length - 1) : i;
+
+          if (index >= world) {
+            xr_log_e(LEVEL, "level layout (length %d) is longer than the boundary (%d), truncating", length, world);
+            break;
+          }
+
+          visit(cursor[i], index);
+        }
+      }
+
+      std::pair<const char *, uint32_t> scripts() const {
+        uint32_t length = layout_length(text);
+        return std::make_pair(text.first + length, text.second - length);
+      }
+    };
+
+    // Levels are built from any layout that can `each(visit)` its tokens and their positions, in order,
+    // and give the text of its `scripts()`.
+    template <typename L>
+    Level(const L& layout, uint32_t bound, uint32_t world):
+      _behaviors(nullptr),
+      _impl(RunningState()),
+      _data(new std::vector<Light>(0)),
+      _boundary(world),
+      _camera(bound, world),
+      _checkpoints(new std::vector<uint32_t>(0)),
+      _reached(0),
+      _snapshots(new std::array<Snapshot, 2>()),
+      _obstacle_snapshots(nullptr),
+      _particles(new xr::Particles()),
+      _events(new xr::FrameEvents()),
+      _scripts(new xr::ScriptLibrary(layout.scripts())) {
+        uint32_t obstacle_count = 0;
+        uint32_t checkpoint_count = 0;
+        uint32_t light_count = Player::OBJECT_BUFFER_SIZE * MAX_PLAYERS;
+        uint32_t spawn = 0;
+
+        layout.each([&](char token, uint32_t index) {
+          auto capacity = Obstacle::light_capacity(token);
+          obstacle_count += capacity > 0 ? 1 : 0;
+          checkpoint_count += token == CHECKPOINT_TOKEN ? 1 : 0;
+          light_count += capacity;
+        });
+
+        auto running = std::get_if<RunningState>(&_impl);
+        running->_obstacles->reserve(obstacle_count);
+        _behaviors = std::make_unique<xr::BehaviorPool>(obstacle_count);
+        _checkpoints->reserve(checkpoint_count);
+        _data->reserve(std::max(light_count + checkpoint_count, bound));
+
+        layout.each([&](char token, uint32_t index) {
+          if (token == PLAYER_TOKEN) {
+            spawn = index;
+            return;
+          }
+
+          if (token == CHECKPOINT_TOKEN) {
+            _checkpoints->push_back(index);
+            return;
+          }
+
+          if (auto scripted = Obstacle::from_script(token, index, *_scripts)) {
+            running->_obstacles->push_back(std::move(scripted.value()));
+            return;
+          }
+
+          auto attempt = Obstacle::try_from(token, index, _behaviors.get());
+          if (attempt != std::nullopt) {
+            running->_obstacles->push_back(std::move(attempt.value()));
+          }
+        });
+
+        // Every player starts next to the spawn point, in order.
+        for (uint8_t i = 0; i < MAX_PLAYERS; i++) {
+          running->_players->push_back(Player(i, std::min(spawn + i, _boundary > 0 ? _boundary - 1 : 0)));
+        }
+
+        _camera.follow(spawn, spawn);
+
+        // Room for the obstacles of both snapshots, which are then taken without allocating.
+        _obstacle_snapshots = std::make_unique<std::vector<Obstacle::Snapshot>>(obstacle_count * 2);
+        save_slot(SnapshotSlot::START);
+        save_slot(SnapshotSlot::CHECKPOINT);
+      }
+
     struct RunningState final {
-      RunningState(): _player(new Player()), _obstacles(new std::vector<Obstacle>(0)) {
-        _obstacles->reserve(OBSTACLE_BUFFER_SIZE);
+      RunningState(): _players(new std::vector<Player>(0)), _obstacles(new std::vector<Obstacle>(0)) {
+        _players->reserve(MAX_PLAYERS);
       }
       ~RunningState() = default;
       RunningState(const RunningState&) = delete;
       RunningState& operator=(const RunningState&) = delete;
       RunningState(const RunningState&& other):
-        _player(std::move(other._player)),
+        _players(std::move(other._players)),
         _obstacles(std::move(other._obstacles)) {
         }
 
       RunningState& operator=(const RunningState&& other) {
         _obstacles = std::move(other._obstacles);
-        _player = std::move(other._player);
+        _players = std::move(other._players);
         return *this;
       }
 
-      mutable std::unique_ptr<const Player> _player;
+      mutable std::unique_ptr<std::vector<Player>> _players;
       mutable std::unique_ptr<std::vector<Obstacle>> _obstacles;
     };
 
+    // Completed levels hold on to the players and obstacles they finished with, so that they can be
+    // restarted in place.
     struct CompletedState final {
-      CompletedState(bool success, uint32_t boundary):
+      CompletedState(bool success, uint32_t boundary, const RunningState&& running):
         _completion_timer(new Animation(Animation::MiddleOut {
           boundary / 2, boundary,
           success ? std::make_tuple(0, 255, 0) : std::make_tuple(255, 0, 0)
         })),
-        _result(success) {
+        _result(success),
+        _running(std::move(running)) {
         }
       ~CompletedState() = default;
       CompletedState(const CompletedState&) = delete;
       CompletedState& operator=(const CompletedState&) = delete;
       CompletedState(const CompletedState&& other):
         _completion_timer(std::move(other._completion_timer)),
-        _result(other._result) {
+        _result(other._result),
+        _running(std::move(other._running)) {
       }
       CompletedState& operator=(const CompletedState&& other) {
         _result = other._result;
         _completion_timer = std::move(other._completion_timer);
+        _running = std::move(other._running);
         return *this;
       }
 
       mutable std::unique_ptr<Animation> _completion_timer;
       mutable bool _result;
+      mutable RunningState _running;
     };
 
     using InnerState = std::variant<RunningState, CompletedState>;
 
+    // Handles the events of a frame, once every player and obstacle has been updated.
+    struct EventVisitor final {
+      const std::vector<Player>& players;
+      xr::Particles& particles;
+      bool& goal_reached;
+
+      // Players can be run into by more than one obstacle in a frame, but are only hit once.
+      void operator()(const ObstacleCollision& collision) {
+        if (!players[collision.player].is_playing()) {
+          return;
+        }
+
+        players[collision.player].kill();
+        particles.emit(collision.position, HIT_BURST);
+      }
+
+      void operator()(const ObstacleDefeated& defeated) {
+        particles.emit(defeated.position, DEFEAT_BURST);
+      }
+
+      void operator()(const GoalReached& goal) {
+        goal_reached = true;
+        particles.emit(goal.position, GOAL_BURST);
+      }
+
+      void operator()(const PlayerJoined& joined) {
+        particles.emit(joined.position, JOIN_BURST);
+      }
+
+      void operator()(const AttackStarted& attack) {
+        particles.emit(attack.position, ATTACK_BURST);
+      }
+
+      void operator()(const ScriptSignal& signal) {
+        xr::Burst burst = SIGNAL_BURST;
+        burst.count = signal.count;
+        burst.color = signal.color;
+        particles.emit(signal.position, burst);
+      }
+    };
+
     struct StateVisitor final {
       std::vector<Light> * light_buffer;
       uint32_t current_time;
-      const std::optional<ControllerInput>& input;
-      uint32_t boundary;
+      const PlayerInputs& inputs;
+      xr::Camera& camera;
+      const std::vector<uint32_t>& checkpoints;
+      uint32_t reached;
+      xr::Particles& particles;
+      xr::FrameEvents& events;
 
       InnerState operator()(const RunningState& running) {
-        auto [new_player, message] = std::move(*running._player).frame(current_time, input);
-        running._player = std::make_unique<Player>(std::move(new_player));
+        PlayerMovements movements { {}, 0 };
+        bool players_remaining = false;
+
+        for (auto player = running._players->begin(); player != running._players->end(); player++) {
+          auto index = std::distance(running._players->begin(), player);
+          auto [new_player, movement] = std::move(*player).frame(current_time, inputs[index], events);
+          *player = std::move(new_player);
+
+          if (player->is_playing()) {
+            movements.movements[movements.count] = movement;
+            movements.count += 1;
+          }
+
+        }
+
+        uint32_t first = camera.offset(), last = camera.offset();
+
+        for (uint8_t i = 0; i < movements.count; i++) {
+          first = i == 0 ? movements.movements[i].position : std::min(first, movements.movements[i].position);
+          last = i == 0 ? movements.movements[i].position : std::max(last, movements.movements[i].position);
+        }
+
+        if (movements.count > 0) {
+          camera.follow(first, last);
+        }
+
+        uint32_t awake_start = std::min(camera.offset(), first);
+        uint32_t awake_end = std::max(camera.offset() + camera.width(), last + 1) + WAKE_DISTANCE;
+        awake_start = awake_start > WAKE_DISTANCE ? awake_start - WAKE_DISTANCE : 0;
+
+        // Checkpoints are drawn (underneath everything else) until they are reached.
+        for (auto checkpoint = checkpoints.cbegin() + reached; checkpoint != checkpoints.cend(); checkpoint++) {
+          if (camera.contains(*checkpoint)) {
+            auto [red, green, blue] = CHECKPOINT_COLOR;
+            light_buffer->push_back(camera.project(std::make_tuple(*checkpoint, red, green, blue)));
+          }
+        }
 
         for (auto obstacle = running._obstacles->begin(); obstacle != running._obstacles->end(); obstacle++) {
-          auto [new_obstacle, update] = std::move(*obstacle).frame(current_time, message);
-          message = update;
+          if (!obstacle->is_within(awake_start, awake_end)) {
+            continue;
+          }
+
+          auto new_obstacle = std::move(*obstacle).frame(current_time, movements, events);
 
           for (auto light = new_obstacle.light_begin(); light != new_obstacle.light_end(); light++) {
-            light_buffer->push_back(*light);
+            if (camera.contains(std::get<0>(*light))) {
+              light_buffer->push_back(camera.project(*light));
+            }
           }
 
           *obstacle = std::move(new_obstacle);
         }
 
-        for (auto light = running._player->light_begin(); light != running._player->light_end(); light++) {
-          light_buffer->push_back(*light);
+        // Collisions are resolved for each player individually, once everything has moved; the level
+        // fails once every player that had joined has been hit.
+        bool goal_reached = false;
+        auto handler = EventVisitor { *running._players, particles, goal_reached };
+
+        for (auto event = events.begin(); event != events.end(); event++) {
+          std::visit(handler, *event);
         }
 
-        if (std::holds_alternative<GoalReached>(message)) {
+        for (auto player = running._players->begin(); player != running._players->end(); player++) {
+          players_remaining = players_remaining || player->is_playing();
+
+          if (!player->is_playing()) {
+            continue;
+          }
+
+          for (auto light = player->light_begin(); light != player->light_end(); light++) {
+            if (camera.contains(std::get<0>(*light))) {
+              light_buffer->push_back(camera.project(*light));
+            }
+          }
+        }
+
+        if (goal_reached) {
           light_buffer->clear();
 
-          return CompletedState(true, boundary);
-        } else if (std::holds_alternative<ObstacleCollision>(message)) {
+          return CompletedState(true, camera.width(), std::move(running));
+        } else if (!players_remaining) {
           light_buffer->clear();
 
-          return CompletedState(false, boundary);
+          return CompletedState(false, camera.width(), std::move(running));
         }
 
         return std::move(running);
@@ -192,7 +592,49 @@ class Level final {
     };
 
 
+    // The players and obstacles we are playing with, whether we are still playing or not.
+    const RunningState * running_state() const {
+      if (auto running = std::get_if<RunningState>(&_impl)) {
+        return running;
+      }
+
+      return &std::get_if<CompletedState>(&_impl)->_running;
+    }
+
+    // Restarts pick up from whenever they happen, so the timers in our own snapshots are saved as if
+    // they had never been ticked.
+    void save_slot(SnapshotSlot slot) const {
+      auto& snapshot = (*_snapshots)[slot];
+      auto obstacles = _obstacle_snapshots->data() + slot * obstacle_count();
+      save(snapshot, obstacles);
+
+      for (auto player = snapshot.players.begin(); player != snapshot.players.end(); player++) {
+        player->movement_timer.last_time = 0;
+        player->idle_timer.last_time = 0;
+      }
+
+      for (uint32_t i = 0; i < obstacle_count(); i++) {
+        obstacles[i].timer.last_time = 0;
+      }
+    }
+
+    // Where obstacles' movements (see `xr::Behavior`) live; declared before them, so it outlives them.
+    mutable std::unique_ptr<xr::BehaviorPool> _behaviors;
+
     mutable InnerState _impl;
     mutable std::unique_ptr<std::vector<Light>> _data;
     mutable uint32_t _boundary;
+    mutable xr::Camera _camera;
+
+    // Where checkpoints are, in the order they are reached, and how many of them have been.
+    mutable std::unique_ptr<std::vector<uint32_t>> _checkpoints;
+    mutable uint32_t _reached;
+
+    mutable std::unique_ptr<std::array<Snapshot, 2>> _snapshots;
+    mutable std::unique_ptr<std::vector<Obstacle::Snapshot>> _obstacle_snapshots;
+    mutable std::unique_ptr<xr::Particles> _particles;
+    mutable std::unique_ptr<xr::FrameEvents> _events;
+
+    // Obstacles run by scripts point into their bytecode, which lives as long as we do.
+    mutable std::unique_ptr<xr::ScriptLibrary> _scripts;
 };
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "generated_level.hpp"
+#include "random.hpp"
+#include "obstacle_kinds.hpp"
+#include "level.hpp"
+
+namespace xr {
+  // Builds levels from a seed and a difficulty, for when the hand written ones run out. The same seed and
+  // difficulty always make the same level (on the light host or anywhere else), so generated levels can
+  // be checked off of the device (see `xiao-host`).
+  //
+  // Levels get longer, busier and more snake ridden as the difficulty goes up, leveling off at
+  // `MAX_DIFFICULTY`.
+  class LevelGenerator final {
+    public:
+      constexpr static const uint32_t MAX_DIFFICULTY = 16;
+
+      // Nothing is placed this close to the spawn point, so players have a moment before anything
+      // reaches them.
+      constexpr static const uint32_t SAFE_DISTANCE = 20;
+
+      static GeneratedLevel generate(uint32_t seed, uint32_t difficulty, uint32_t bound) {
+        Random random(seed, difficulty);
+        uint32_t level = std::min(difficulty, MAX_DIFFICULTY);
+        GeneratedLevel generated { bound + (bound * level) / 4, 0, {} };
+
+        // Room between obstacles beyond what they need to not overlap, which shrinks (and varies less)
+        // with difficulty.
+        uint32_t slack = 30 - level;
+        uint32_t spread = 48 - level * 2;
+        uint32_t snake_chance = level < 2 ? 0 : std::min(level * 6, 45u);
+
+        uint32_t position = SAFE_DISTANCE;
+        uint32_t previous_clearance = 0;
+        uint32_t next_checkpoint = bound * 2;
+
+        generated.place(Level::PLAYER_TOKEN, 0);
+
+        // One place is always kept back for the goal.
+        while (generated.count < GeneratedLevel::MAX_PLACEMENTS - 2) {
+          bool snake = random.below(100) < snake_chance;
+          uint32_t clearance = snake ? clearance_of<SnakeTraits>() : clearance_of<PawnTraits>();
+          uint32_t next = position + previous_clearance + clearance + slack + random.below(spread);
+
+          if (next + clearance >= generated.length - 1) {
+            break;
+          }
+
+          // Long levels get a checkpoint between obstacles every couple of strips.
+          if (next >= next_checkpoint) {
+            generated.place(Level::CHECKPOINT_TOKEN, (position + next) / 2);
+            next_checkpoint += bound * 2;
+          }
+
+          generated.place(snake ? SnakeTraits::TOKEN : PawnTraits::TOKEN, next);
+          position = next;
+          previous_clearance = clearance;
+        }
+
+        generated.place(GoalTraits::TOKEN, generated.length - 1);
+        return generated;
+      }
+
+    private:
+      // How far an obstacle of this kind reaches from where it is placed, at most.
+      template <typename T>
+      constexpr static uint32_t clearance_of() {
+        return std::max(-T::Shape::MIN_OFFSET, T::Shape::MAX_OFFSET) + movement_range<typename T::Movement>();
+      }
+
+      template <typename M>
+      constexpr static uint32_t movement_range() {
+        return range_of(static_cast<M *>(nullptr));
+      }
+
+      constexpr static uint32_t range_of(Stationary *) {
+        return 0;
+      }
+
+      template <uint16_t MS, uint32_t RANGE>
+      constexpr static uint32_t range_of(Patrol<MS, RANGE> *) {
+        return RANGE + 1;
+      }
+
+      template <uint16_t MS, uint32_t HALF>
+      constexpr static uint32_t range_of(Hover<MS, HALF> *) {
+        return HALF + 1;
+      }
+  };
+}
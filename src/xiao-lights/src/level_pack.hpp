@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <utility>
+
+namespace xr {
+  // A read-only view of a compiled level pack (see `tools/pack_levels.py`), laid out as:
+  //
+  // | magic | version | count | reserved | { offset, length } * count | level text ... |
+  //
+  // where every field is a little endian `uint32_t` and offsets are from the start of the pack. Any level
+  // can be found from the index without reading the others, so a pack can be read straight out of mapped
+  // flash (see `FlashRegion`) and levels built from it one at a time; nothing about the pack is kept in ram
+  // regardless of how many levels it holds.
+  class LevelPack final {
+    public:
+      constexpr static const uint32_t MAGIC = 0x504c5258;
+      constexpr static const uint32_t VERSION = 1;
+
+      struct Header final {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+      };
+
+      struct Entry final {
+        uint32_t offset;
+        uint32_t length;
+      };
+
+      LevelPack(): _data(nullptr), _size(0), _count(0) {}
+
+      // Reads the pack in the `size` bytes at `data`, which must outlive it. Anything that is not a pack
+      // (or whose index does not fit in `size`) is treated as an empty pack.
+      LevelPack(const uint8_t * data, uint32_t size): _data(nullptr), _size(0), _count(0) {
+        Header header;
+
+        if (data == nullptr || size < sizeof(Header)) {
+          return;
+        }
+
+        // Packs mapped from flash or embedded in our firmware are not guaranteed to be aligned.
+        memcpy(&header, data, sizeof(Header));
+
+        if (header.magic != MAGIC || header.version != VERSION) {
+          return;
+        }
+
+        if (header.count > (size - sizeof(Header)) / sizeof(Entry)) {
+          return;
+        }
+
+        _data = data;
+        _size = size;
+        _count = header.count;
+      }
+
+      ~LevelPack() = default;
+
+      bool is_valid() const {
+        return _data != nullptr;
+      }
+
+      uint32_t count() const {
+        return _count;
+      }
+
+      // The layout text of the level at `index`, which is empty if there is no such level or its entry
+      // points outside of the pack.
+      std::pair<const char *, uint32_t> level(uint32_t index) const {
+        Entry entry;
+
+        if (index >= _count) {
+          return std::make_pair("", 0);
+        }
+
+        memcpy(&entry, _data + sizeof(Header) + index * sizeof(Entry), sizeof(Entry));
+
+        if (entry.offset > _size || entry.length > _size - entry.offset) {
+          return std::make_pair("", 0);
+        }
+
+        return std::make_pair(reinterpret_cast<const char *>(_data + entry.offset), entry.length);
+      }
+
+    private:
+      const uint8_t * _data;
+      uint32_t _size;
+      uint32_t _count;
+  };
+}
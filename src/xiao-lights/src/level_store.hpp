@@ -0,0 +1,134 @@
+#pragma once
+
+#include <esp_partition.h>
+#include <string.h>
+
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "logging.hpp"
+#include "flash_region.hpp"
+
+#ifndef XR_LOG_LEVEL_STORE
+#define XR_LOG_LEVEL_STORE XR_LOG_LEVEL
+#endif
+
+namespace xr {
+  // The crc used to verify level packs; the same as zlib's (and python's `zlib.crc32`).
+  inline uint32_t crc32(uint32_t crc, const uint8_t * data, size_t length) {
+    crc = ~crc;
+
+    for (size_t i = 0; i < length; i++) {
+      crc ^= data[i];
+
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+      }
+    }
+
+    return ~crc;
+  }
+
+  // A compiled level pack (see `LevelPack`) kept in the `levels` flash partition, behind a small header.
+  // Packs are read through a memory map of the partition (see `FlashRegion`), so levels are never copied
+  // into ram; the header is only written once the whole pack is in place, so a partially written pack (or
+  // an erased partition) is never loaded.
+  class LevelStore final {
+    public:
+      constexpr static const esp_partition_subtype_t PARTITION_SUBTYPE = static_cast<esp_partition_subtype_t>(0x40);
+      constexpr static const char * PARTITION_LABEL = "levels";
+      constexpr static const uint32_t MAGIC = 0x564c5258;
+
+      struct Header final {
+        uint32_t magic;
+        uint32_t length;
+        uint32_t crc;
+        uint32_t reserved;
+      };
+
+      LevelStore():
+        _partition(esp_partition_find_first(ESP_PARTITION_TYPE_DATA, PARTITION_SUBTYPE, PARTITION_LABEL)),
+        _region(nullptr) {
+        }
+      ~LevelStore() = default;
+
+      LevelStore(const LevelStore&) = delete;
+      LevelStore& operator=(const LevelStore&) = delete;
+
+      // The largest pack we can hold.
+      uint32_t capacity() const {
+        return _partition == nullptr ? 0 : _partition->size - sizeof(Header);
+      }
+
+      // Maps the stored pack, returning its bytes if there is one and it is intact. They stay valid until
+      // the store is erased or loaded again.
+      std::optional<std::pair<const uint8_t *, uint32_t>> load() {
+        _region.reset();
+
+        if (_partition == nullptr) {
+          xr_log_w(STORE, "no levels partition");
+          return std::nullopt;
+        }
+
+        _region = std::make_unique<FlashRegion>(PARTITION_LABEL);
+
+        if (!_region->is_mapped() || _region->size() < sizeof(Header)) {
+          xr_log_e(STORE, "unable to map levels partition");
+          _region.reset();
+          return std::nullopt;
+        }
+
+        Header header;
+        auto pack = _region->data() + sizeof(Header);
+        memcpy(&header, _region->data(), sizeof(Header));
+
+        if (header.magic != MAGIC || header.length > capacity()) {
+          xr_log_d(STORE, "no level pack stored");
+          _region.reset();
+          return std::nullopt;
+        }
+
+        if (crc32(0, pack, header.length) != header.crc) {
+          xr_log_e(STORE, "stored level pack (length %d) failed its crc check", header.length);
+          _region.reset();
+          return std::nullopt;
+        }
+
+        return std::make_pair(pack, header.length);
+      }
+
+      // Whether the pack last loaded is still mapped, i.e its bytes are still valid.
+      bool is_mapped() const {
+        return _region != nullptr;
+      }
+
+      // Makes room for a pack of `length`, invalidating anything previously loaded. Packs that do not fit
+      // are refused before anything is touched.
+      bool erase(uint32_t length) {
+        if (_partition == nullptr || length > capacity()) {
+          return false;
+        }
+
+        _region.reset();
+        uint32_t size = sizeof(Header) + length;
+        size = ((size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE) * SPI_FLASH_SEC_SIZE;
+        return esp_partition_erase_range(_partition, 0, size) == ESP_OK;
+      }
+
+      bool write(uint32_t offset, const uint8_t * data, size_t length) {
+        return _partition != nullptr
+          && esp_partition_write(_partition, sizeof(Header) + offset, data, length) == ESP_OK;
+      }
+
+      // Writes the header for a fully written pack, making it loadable.
+      bool seal(uint32_t length, uint32_t crc) {
+        Header header { MAGIC, length, crc, 0 };
+        return _partition != nullptr && esp_partition_write(_partition, 0, &header, sizeof(Header)) == ESP_OK;
+      }
+
+    private:
+      const esp_partition_t * _partition;
+      std::unique_ptr<FlashRegion> _region;
+  };
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.hpp"
+#include "level_store.hpp"
+
+namespace xr {
+  // Receives a level pack into a store (see `LevelStore`), a chunk at a time, from lines of text that
+  // can arrive over serial or esp-now alike:
+  //
+  // XRU BEGIN <length> <crc32>   -> XRU OK 0
+  // XRU CHUNK <offset> <hex>     -> XRU OK <next offset>
+  // XRU COMMIT                   -> XRU OK <length>
+  // XRU ABORT                    -> XRU OK 0
+  //
+  // Anything that cannot be applied is answered with `XRU ERR <expected offset> <reason>`. Chunks must
+  // arrive in order, so a sender that missed a reply can resend from the expected offset; the pack is
+  // only committed once every byte is in place and matches the crc given when the upload began.
+  template <typename Store>
+  class LevelUpload final {
+    public:
+      enum UploadEvent {
+        NONE,
+        STARTED,
+        COMMITTED,
+        ABORTED,
+      };
+
+      // The most data bytes a single chunk may carry.
+      constexpr static const uint32_t MAX_CHUNK = 240;
+
+      explicit LevelUpload(Store& store): _store(store), _active(false), _length(0), _received(0), _crc(0), _expected_crc(0) {}
+      ~LevelUpload() = default;
+
+      LevelUpload(const LevelUpload&) = delete;
+      LevelUpload& operator=(const LevelUpload&) = delete;
+
+      static bool is_command(const char * line, size_t length) {
+        return length >= 4 && strncmp(line, "XRU ", 4) == 0;
+      }
+
+      // Applies a single (nul terminated) command line, writing the reply to send back into `reply`.
+      UploadEvent handle(const char * line, char * reply, size_t reply_size) {
+        unsigned long length = 0, offset = 0, crc = 0;
+        int consumed = 0;
+
+        if (sscanf(line, "XRU BEGIN %lu %lu", &length, &crc) == 2) {
+          _active = _store.erase(length);
+
+          if (!_active) {
+            snprintf(reply, reply_size, "XRU ERR 0 unable to erase %lu bytes", length);
+            return UploadEvent::ABORTED;
+          }
+
+          _length = length;
+          _expected_crc = crc;
+          _received = 0;
+          _crc = 0;
+          xr_log_i(STORE, "receiving level pack of %d bytes", _length);
+          snprintf(reply, reply_size, "XRU OK 0");
+          return UploadEvent::STARTED;
+        }
+
+        if (sscanf(line, "XRU CHUNK %lu %n", &offset, &consumed) == 1 && consumed > 0) {
+          if (!_active) {
+            snprintf(reply, reply_size, "XRU ERR 0 no upload");
+            return UploadEvent::NONE;
+          }
+
+          if (offset != _received) {
+            snprintf(reply, reply_size, "XRU ERR %u out of order", static_cast<unsigned int>(_received));
+            return UploadEvent::NONE;
+          }
+
+          uint8_t chunk[MAX_CHUNK];
+          auto size = decode(line + consumed, chunk, MAX_CHUNK);
+
+          if (size < 0 || _received + static_cast<uint32_t>(size) > _length || !_store.write(_received, chunk, size)) {
+            snprintf(reply, reply_size, "XRU ERR %u bad chunk", static_cast<unsigned int>(_received));
+            return UploadEvent::NONE;
+          }
+
+          _crc = crc32(_crc, chunk, size);
+          _received += size;
+          snprintf(reply, reply_size, "XRU OK %u", static_cast<unsigned int>(_received));
+          return UploadEvent::NONE;
+        }
+
+        if (strncmp(line, "XRU COMMIT", 10) == 0) {
+          if (!_active || _received != _length || _crc != _expected_crc || !_store.seal(_length, _crc)) {
+            snprintf(reply, reply_size, "XRU ERR %u unable to commit", static_cast<unsigned int>(_received));
+            return UploadEvent::NONE;
+          }
+
+          _active = false;
+          xr_log_i(STORE, "committed level pack of %d bytes", _length);
+          snprintf(reply, reply_size, "XRU OK %u", static_cast<unsigned int>(_length));
+          return UploadEvent::COMMITTED;
+        }
+
+        if (strncmp(line, "XRU ABORT", 9) == 0) {
+          _active = false;
+          snprintf(reply, reply_size, "XRU OK 0");
+          return UploadEvent::ABORTED;
+        }
+
+        snprintf(reply, reply_size, "XRU ERR %u unknown command", static_cast<unsigned int>(_received));
+        return UploadEvent::NONE;
+      }
+
+    private:
+      // Decodes hex pairs until the end of the line, returning the number of bytes or -1 when invalid.
+      static int decode(const char * hex, uint8_t * out, size_t capacity) {
+        size_t size = 0;
+
+        while (hex[0] != '\0' && hex[0] != '\r' && hex[0] != '\n') {
+          int high = nibble(hex[0]);
+          int low = hex[1] == '\0' ? -1 : nibble(hex[1]);
+
+          if (high < 0 || low < 0 || size == capacity) {
+            return -1;
+          }
+
+          out[size++] = (high << 4) | low;
+          hex += 2;
+        }
+
+        return size;
+      }
+
+      static int nibble(char c) {
+        if (c >= '0' && c <= '9') {
+          return c - '0';
+        }
+
+        if (c >= 'a' && c <= 'f') {
+          return c - 'a' + 10;
+        }
+
+        if (c >= 'A' && c <= 'F') {
+          return c - 'A' + 10;
+        }
+
+        return -1;
+      }
+
+      Store& _store;
+      bool _active;
+      uint32_t _length;
+      uint32_t _received;
+      uint32_t _crc;
+      uint32_t _expected_crc;
+  };
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp32-hal-log.h"
+
+#include <array>
+#include <type_traits>
+
+// Engine logging. Every call names the module it belongs to, and is compiled out entirely when its
+// level is above that module's level:
+//
+// xr_log_d(PLAYER, "moving right (%d)", x_input);
+//
+// Module levels default to `XR_LOG_LEVEL` (itself defaulting to `CORE_DEBUG_LEVEL`) and can be set
+// individually at compile time, e.g `-DXR_LOG_LEVEL_OBSTACLE=1` keeps only obstacle errors.
+//
+// With `XR_LOG_DEFERRED` defined, calls do no formatting or serial writes; the format string and up to
+// four integral arguments are stored in a ring buffer, and printed later by `xr::log::drain`, which
+// the main loop calls once it is done with the frame.
+#define XR_LOG_NONE 0
+#define XR_LOG_ERROR 1
+#define XR_LOG_WARN 2
+#define XR_LOG_INFO 3
+#define XR_LOG_DEBUG 4
+
+#ifndef XR_LOG_LEVEL
+#define XR_LOG_LEVEL CORE_DEBUG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_LEVEL
+#define XR_LOG_LEVEL_LEVEL XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_PLAYER
+#define XR_LOG_LEVEL_PLAYER XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_OBSTACLE
+#define XR_LOG_LEVEL_OBSTACLE XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_ANIMATION
+#define XR_LOG_LEVEL_ANIMATION XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_TIMER
+#define XR_LOG_LEVEL_TIMER XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_SEGMENT
+#define XR_LOG_LEVEL_SEGMENT XR_LOG_LEVEL
+#endif
+
+#ifndef XR_LOG_LEVEL_SCRIPT
+#define XR_LOG_LEVEL_SCRIPT XR_LOG_LEVEL
+#endif
+
+#define XR_LOG(module, level, format, ...) \
+  do { \
+    if (level <= XR_LOG_LEVEL_##module) { \
+      xr::log::write(level, #module, format, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define xr_log_e(module, format, ...) XR_LOG(module, XR_LOG_ERROR, format, ##__VA_ARGS__)
+#define xr_log_w(module, format, ...) XR_LOG(module, XR_LOG_WARN, format, ##__VA_ARGS__)
+#define xr_log_i(module, format, ...) XR_LOG(module, XR_LOG_INFO, format, ##__VA_ARGS__)
+#define xr_log_d(module, format, ...) XR_LOG(module, XR_LOG_DEBUG, format, ##__VA_ARGS__)
+
+namespace xr {
+  namespace log {
+    constexpr static const uint32_t MAX_ARGUMENTS = 4;
+    constexpr static const uint32_t DEFERRED_CAPACITY = 64;
+
+    struct Entry final {
+      const char * format;
+      const char * module;
+      uint32_t time;
+      uint8_t level;
+      std::array<uint32_t, MAX_ARGUMENTS> arguments;
+    };
+
+    inline char level_tag(uint8_t level) {
+      switch (level) {
+        case XR_LOG_ERROR:
+          return 'E';
+        case XR_LOG_WARN:
+          return 'W';
+        case XR_LOG_INFO:
+          return 'I';
+        default:
+          return 'D';
+      }
+    }
+
+    inline void print(const Entry& entry) {
+      auto [a, b, c, d] = entry.arguments;
+      log_printf("[%6u][%c][%s] ", entry.time, level_tag(entry.level), entry.module);
+      log_printf(entry.format, a, b, c, d);
+      log_printf("\r\n");
+    }
+
+    // A fixed size ring of entries waiting to be printed. It is only written to from the main loop, so
+    // no locking is done; entries logged while the ring is full are counted and dropped.
+    class Deferred final {
+      public:
+        static Deferred& instance() {
+          static Deferred deferred;
+          return deferred;
+        }
+
+        void push(Entry&& entry) {
+          if (_size == DEFERRED_CAPACITY) {
+            _dropped += 1;
+            return;
+          }
+
+          _entries[(_head + _size) % DEFERRED_CAPACITY] = entry;
+          _size += 1;
+        }
+
+        void drain(uint32_t max) {
+          if (_dropped > 0) {
+            log_printf("[%6u][W][log] dropped %u deferred entries\r\n", millis(), _dropped);
+            _dropped = 0;
+          }
+
+          for (uint32_t i = 0; i < max && _size > 0; i++) {
+            print(_entries[_head]);
+            _head = (_head + 1) % DEFERRED_CAPACITY;
+            _size -= 1;
+          }
+        }
+
+      private:
+        Deferred(): _head(0), _size(0), _dropped(0) {}
+
+        std::array<Entry, DEFERRED_CAPACITY> _entries;
+        uint32_t _head;
+        uint32_t _size;
+        uint32_t _dropped;
+    };
+
+    template <typename... A>
+    void write(uint8_t level, const char * module, const char * format, A... args) {
+      static_assert(sizeof...(A) <= MAX_ARGUMENTS, "too many log arguments");
+      static_assert(
+        ((std::is_integral<A>::value || std::is_enum<A>::value) && ...) && ((sizeof(A) <= 4) && ...),
+        "only integral log arguments can be recorded"
+      );
+
+      Entry entry { format, module, millis(), level, { static_cast<uint32_t>(args)... } };
+
+#ifdef XR_LOG_DEFERRED
+      Deferred::instance().push(std::move(entry));
+#else
+      print(entry);
+#endif
+    }
+
+    // Prints up to `max` deferred entries; does nothing unless `XR_LOG_DEFERRED` is defined.
+    inline void drain(uint32_t max) {
+#ifdef XR_LOG_DEFERRED
+      Deferred::instance().drain(max);
+#endif
+    }
+  }
+}
@@ -1,9 +1,11 @@
 #include <Arduino.h>
 #include "WiFi.h"
 #include "esp_now.h"
-#include "Adafruit_NeoPixel.h"
+#include "esp_wifi.h"
+#include "esp_system.h"
 #include "esp32-hal-log.h"
 
+#include <atomic>
 #include <memory>
 #include <variant>
 
@@ -12,16 +14,73 @@
 #include "player.hpp"
 #include "obstacle.hpp"
 #include "level.hpp"
+#include "framebuffer.hpp"
+#include "segments.hpp"
+#include "telemetry.hpp"
+#include "logging.hpp"
+#include "peers.hpp"
+#include "pairing.hpp"
+#include "pairing_store.hpp"
+#include "link_monitor.hpp"
+#include "discovery.hpp"
+#include "transport.hpp"
+#include "input_message.hpp"
+#include "level_pack.hpp"
+#include "level_generator.hpp"
+#include "level_store.hpp"
+#include "level_upload.hpp"
+#include "frame_sync.hpp"
 
 #ifndef NUM_PIXELS
-constexpr const uint32_t num_pixels = 146;
+#define NUM_PIXELS 146
+#endif
+
+// The physical strips making up our track, as `{ pin, offset, length, reversed }`. A single strip on
+// `D0` is used unless a layout is provided at compile time, e.g:
+//
+// -DSEGMENT_LAYOUT="{ { D0, 0, 146, false }, { D1, 146, 146, true } }"
+#ifndef SEGMENT_LAYOUT
+#define SEGMENT_LAYOUT { { D0, 0, NUM_PIXELS, false } }
+#endif
+
+constexpr const xr::Segment segments[] = SEGMENT_LAYOUT;
+constexpr const uint32_t num_segments = sizeof(segments) / sizeof(xr::Segment);
+static_assert(num_segments <= xr::SegmentOutput::MAX_SEGMENTS, "every segment needs an rmt channel of its own");
+
+constexpr uint32_t track_length(uint32_t index = 0) {
+  return index == num_segments
+    ? 0
+    : std::max(segments[index].offset + segments[index].length, track_length(index + 1));
+}
+
+// Tracks can also be split across the strips of several light hosts: one of them (built with
+// `-DSYNC_LEADER`) runs the game and broadcasts every frame to the others (built with `-DSYNC_FOLLOWER`),
+// each showing the part of the track covered by their own `SEGMENT_LAYOUT`. The leader is told how long
+// the whole track is with `TRACK_LENGTH`, e.g for three light hosts of 146 pixels:
+//
+// leader:    -DSYNC_LEADER -DTRACK_LENGTH=438
+// followers: -DSYNC_FOLLOWER "-DSEGMENT_LAYOUT={ { D0, 146, 146, false } }"
+//            -DSYNC_FOLLOWER "-DSEGMENT_LAYOUT={ { D0, 292, 146, false } }"
+#if defined(SYNC_LEADER) && defined(SYNC_FOLLOWER)
+#error "a light host can either lead or follow, not both"
+#endif
+
+#ifndef TRACK_LENGTH
+#define TRACK_LENGTH 0
+#endif
+
+constexpr const uint32_t num_pixels = std::max<uint32_t>(TRACK_LENGTH, track_length());
+
+// When set, level layouts are stretched across the whole track instead of one character per light.
+#ifdef STRETCH_LEVELS
+constexpr const bool stretch_levels = true;
 #else
-constexpr const uint32_t num_pixels = NUM_PIXELS;
+constexpr const bool stretch_levels = false;
 #endif
-constexpr const uint32_t pixel_pin = D0;
+constexpr const uint8_t pixel_brightness = 20;
 
-extern const char level_data_start[] asm("_binary_embed_levels_txt_start");
-extern const char level_data_end[] asm("_binary_embed_levels_txt_end");
+extern const uint8_t level_data_start[] asm("_binary_embed_levels_pack_start");
+extern const uint8_t level_data_end[] asm("_binary_embed_levels_pack_end");
 
 struct MessagePayload final {
   char content[120];
@@ -34,75 +93,425 @@ enum ERuntimeMode {
 };
 
 static const uint32_t debug_timer_ms = 2000;
-static const uint32_t max_nomessage_time = 10000;
+
+// How long we wait for a controller we were paired with on a previous boot before starting discovery.
+static const uint32_t max_resume_time = 20000;
+
+// Once paired, the link is supervised from the messages our controllers send (and the ones that go
+// missing). The game is paused while the link is lost; if it doesn't come back we move our access point
+// to another channel (the controllers go looking for us), and eventually start over with discovery.
+static const xr::LinkConfig link_config {
+  900, 500,    // degraded, lost delivery (permille)
+  -80,         // weak rssi
+  3000,        // silence
+  1000, 8000,  // base, max backoff
+  3,           // retries per hop
+  2,           // hops before repair
+};
+
+// Without a controller to resume, we wait for one to join our access point (see `Discovery`), then give
+// the radio a second to settle before starting esp-now. Our access point is never joined, so the retry and
+// join timeout go unused.
+static const xr::DiscoveryConfig discovery_config {
+  0, 0,        // retry, join timeout
+  1000, 200,   // settle, leave
+};
+
+// While we wait for controllers the level plays itself, as an attract mode: a demo player runs right with
+// the button held down (so it attacks whenever it can), and the level is shown pulsing as if paused. The
+// level is rebuilt once the game starts.
+static const ControllerInput attract_input = std::make_tuple(1, 0, 1);
+
+// The level is simulated in fixed ticks, `INPUT_DELAY_MS` behind the present so that controller inputs
+// (which are stamped with the time they happened) are applied at the tick they happened at regardless of
+// how long the radio took to deliver them. If we fall more than a few ticks behind, the rest are skipped.
+#ifndef INPUT_DELAY_MS
+#define INPUT_DELAY_MS 30
+#endif
+
+static const uint32_t simulation_tick_ms = 5;
+static const uint32_t max_ticks_per_frame = 8;
+
+// While paused, the level is shown pulsing with this period.
+static const uint32_t pause_pulse_ms = 2000;
+
+// The most deferred log entries printed at the end of each frame.
+static const uint32_t max_log_entries_per_frame = 4;
+
+#ifndef TELEMETRY_INTERVAL_MS
+#define TELEMETRY_INTERVAL_MS 5000
+#endif
+
+// Synced frames are presented this long after they have had time to make it through the air, to cover
+// the radio's queueing and jitter (see `SyncLeader`).
+#ifndef SYNC_MARGIN_US
+#define SYNC_MARGIN_US 1000
+#endif
+
+// Followers build their frame this long before it is due, so that it can be presented right on time.
+static const uint32_t sync_render_lead_us = 2000;
+
+// Followers that have not heard from their leader for this long blank their strips and go looking for
+// it on the next channel.
+static const uint32_t sync_search_us = 500000;
 
 // Every message received by our esp-now listener will update this gloval state.
 static MessagePayload frame_payload;
 
-// Once received the esp now messages will be parsed into an optional controller input that will be
-// sent into every frame of our game logic.
-static std::optional<ControllerInput> last_input = std::nullopt;
+// Controllers (and any light hosts following us) are talked to over esp-now (see `Transport`).
+static xr::Transport transport;
+
+// Once received the esp now messages will be parsed into controller inputs and queued for the player
+// assigned to the controller that sent them; every simulation tick takes the inputs that happened by then.
+static xr::Peers peers;
 
-// Current level and indices into our embedded memory for where levels exist.
-static std::vector<std::pair<const char *, uint32_t>> level_indices;
+// The level pack being played (either embedded in our firmware or mapped from flash) and the level
+// built from it; levels are only ever built one at a time, as they are reached.
+static xr::LevelPack level_pack;
+static bool levels_in_flash = false;
 static std::unique_ptr<const Level> current_level(nullptr);
 static uint32_t current_level_index = 0;
 
+// Once the pack runs out, levels are generated (see `LevelGenerator`) from this seed; when left at zero
+// a new seed is picked every boot.
+#ifndef LEVEL_SEED
+#define LEVEL_SEED 0
+#endif
+
+static uint32_t level_seed = LEVEL_SEED;
+
+// Level packs can be uploaded over serial or esp-now (see `LevelUpload`) and are played as soon as they
+// are committed. Commands over esp-now arrive on the wifi task and are handed to the main loop one at a
+// time; senders wait for our reply before sending the next.
+static xr::LevelStore level_store;
+static xr::LevelUpload<xr::LevelStore> level_upload(level_store);
+static std::array<char, 512> serial_line;
+static uint32_t serial_line_length = 0;
+
+struct UploadCommand final {
+  uint8_t mac[6];
+  char line[ESP_NOW_MAX_DATA_LEN + 1];
+};
+
+static portMUX_TYPE upload_lock = portMUX_INITIALIZER_UNLOCKED;
+static UploadCommand upload_command;
+static bool has_upload_command = false;
+
+#ifdef SYNC_LEADER
+// Frames are broadcast to every follower listening on our channel.
+struct SyncBroadcast final {
+  uint32_t micros() {
+    return ::micros();
+  }
+
+  void send(const uint8_t * data, uint32_t size) {
+    transport.send(xr::BROADCAST_ADDRESS.data(), data, size);
+  }
+};
+
+static SyncBroadcast sync_broadcast;
+static xr::SyncLeader<SyncBroadcast> sync_leader(sync_broadcast, SYNC_MARGIN_US, num_pixels);
+#endif
+
+#ifdef SYNC_FOLLOWER
+// Packets from our leader arrive on the wifi task and are assembled into frames there; the main loop
+// takes each frame as it comes due.
+static portMUX_TYPE sync_lock = portMUX_INITIALIZER_UNLOCKED;
+static xr::SyncFollower sync_follower;
+static xr::SyncFrame sync_frame;
+static uint8_t sync_channel = xr::LINK_CHANNELS[0];
+static uint32_t sync_search_time = 0;
+#endif
+
 static std::unique_ptr<xr::Timer> debug_timer(nullptr);
-static Adafruit_NeoPixel pixels(num_pixels, pixel_pin);
+static std::vector<std::unique_ptr<xr::SegmentOutput>> outputs;
+static xr::Framebuffer framebuffer(num_pixels, pixel_brightness);
+
+#ifdef XR_TELEMETRY
+// Frame timings; input parsing happens in the esp-now callback, so its duration is handed to the main
+// loop which records it alongside the other stages.
+static xr::Telemetry telemetry;
+static std::unique_ptr<xr::Timer> telemetry_timer(nullptr);
+static std::atomic<uint32_t> last_parse_micros(0);
+#endif
 
 // Disconnected state.
 static uint32_t active_wifi_connections = 0;
 static ERuntimeMode mode = ERuntimeMode::DISCONNECTED;
-static uint32_t last_message_time = 0;
-
-// The messages sent from the `beetle-controller` are received and parsed into a tuple containing
-// three unsigned integer values - x, y and z (button press).
-ControllerInput parse_message(const char* data, int max_len) {
-  const char * head = data + 0;
-  uint32_t left = 0;
-  uint32_t right = 0;
-  uint32_t up = 0;
-  uint8_t stage = 0;
-  uint8_t cursor = 0;
-
-  while (*head != ']' && cursor < max_len && cursor < 255) {
-    cursor += 1;
-
-    if (*head == '[' && stage == 0) {
-      stage = 1;
-      head++;
-    } 
-
-    if (*head == '|' && stage == 1) {
-      stage = 2;
-      head++;
-    }
+static volatile uint32_t last_message_time = 0;
+
+// The controllers we have played with are persisted; once we have any, booting goes straight to esp-now
+// instead of waiting for a controller to connect to our access point.
+static xr::PairingStore pairing_store("xr-pairing");
+static xr::PairingRecord pairing_record;
+static xr::Pairing pairing(max_resume_time);
+static xr::LinkMonitor link_monitor(link_config);
+static xr::Discovery discovery(discovery_config);
+
+// The signal strength of the last esp-now frame seen by our promiscuous callback.
+static std::atomic<int8_t> last_rssi(0);
+
+// The level is run on a clock that stands still while the game is paused.
+static uint32_t paused_time = 0;
+static uint32_t last_frame_time = 0;
+static uint32_t simulation_time = 0;
+
+// Ticks our debug timer, returning whether it is time to log again.
+bool debug_due(uint32_t now) {
+  auto [new_timer, did_finish] = std::move(*debug_timer).tick(now);
+  debug_timer = did_finish
+    ? std::make_unique<xr::Timer>(debug_timer_ms)
+    : std::make_unique<xr::Timer>(std::move(new_timer));
+  return did_finish;
+}
 
-    if (*head == '|' && stage == 2) {
-      stage = 3;
-      head++;
-    }
+// Copies the framebuffer into every segment.
+void write_outputs(void) {
+  for (auto output = outputs.begin(); output != outputs.end(); output++) {
+    (*output)->write(framebuffer);
+  }
+}
 
-    if (stage == 1) {
-      left = (left * 10) + (*head - '0');
-    } else if (stage == 2) {
-      right = (right * 10) + (*head - '0');
-    } else if (stage == 3) {
-      up = (up * 10) + (*head - '0');
-    }
+// Transmits every segment, waiting until all of them are done.
+void present(void) {
+  XR_TELEMETRY_SCOPE(telemetry, xr::TelemetryStage::SHOW_PIXELS);
+
+  for (auto output = outputs.begin(); output != outputs.end(); output++) {
+    (*output)->start();
+  }
 
-    head++;
+  for (auto output = outputs.begin(); output != outputs.end(); output++) {
+    (*output)->wait();
   }
+}
 
-  return std::make_tuple(left, right, up);
+// Busy waits for `time` (on our microsecond clock) to come around.
+void wait_until(uint32_t time) {
+  while (static_cast<int32_t>(time - micros()) > 0) {
+  }
 }
 
 void receive_cb(const uint8_t * mac, const uint8_t *incoming_data, int len) {
+  // Frames from another leader nearby are none of our business.
+  if (xr::SyncPacket::is_packet(incoming_data, len)) {
+    return;
+  }
+
+  if (xr::LevelUpload<xr::LevelStore>::is_command(reinterpret_cast<const char *>(incoming_data), len)) {
+    portENTER_CRITICAL(&upload_lock);
+
+    if (!has_upload_command) {
+      memcpy(upload_command.mac, mac, 6);
+      memcpy(upload_command.line, incoming_data, std::min(len, ESP_NOW_MAX_DATA_LEN));
+      upload_command.line[std::min(len, ESP_NOW_MAX_DATA_LEN)] = '\0';
+      has_upload_command = true;
+    }
+
+    portEXIT_CRITICAL(&upload_lock);
+    return;
+  }
+
+  // Messages are never read past our payload, however long the frame that carried them.
+  len = std::min(len, static_cast<int>(sizeof(frame_payload.content)));
   memset(frame_payload.content, '\0', 120);
-  memcpy(&frame_payload, incoming_data, sizeof(frame_payload));
-  last_message_time = millis();
-  last_input = parse_message(frame_payload.content, len);
+  memcpy(&frame_payload, incoming_data, len);
+  uint32_t now = millis();
+  last_message_time = now;
+
+#ifdef XR_TELEMETRY
+  int64_t start = esp_timer_get_time();
+  auto message = xr::parse_input_message(frame_payload.content, len);
+  last_parse_micros = esp_timer_get_time() - start;
+#else
+  auto message = xr::parse_input_message(frame_payload.content, len);
+#endif
+
+  // The messages sent from the `beetle-controller` carry its axes and button (see `InputMessage`).
+  auto input = std::make_tuple(message.x, message.y, message.z);
+  peers.receive(mac, ControllerMessage { input, message.sequence, message.time }, now);
+}
+
+// Esp-now messages are vendor specific action frames; every one sent by one of our controllers (the
+// transmitter is the second address of the frame's header) updates our signal strength. Frames from
+// anything else on the channel, e.g other esp-now devices or our own followers, are ignored.
+void promiscuous_cb(void * buffer, wifi_promiscuous_pkt_type_t type) {
+  auto packet = static_cast<const wifi_promiscuous_pkt_t *>(buffer);
+
+  if (type == WIFI_PKT_MGMT && packet->payload[0] == 0xD0 && peers.knows(packet->payload + 10)) {
+    last_rssi = packet->rx_ctrl.rssi;
+  }
+}
+
+#ifdef SYNC_FOLLOWER
+void sync_receive_cb(const uint8_t * mac, const uint8_t * incoming_data, int len) {
+  uint32_t arrival = micros();
+  portENTER_CRITICAL(&sync_lock);
+  sync_follower.receive(incoming_data, len, arrival);
+  portEXIT_CRITICAL(&sync_lock);
+}
+
+// Followers only listen for their leader, presenting every frame it sends at the time it was scheduled
+// for.
+void setup_follower(void) {
+  WiFi.mode(WIFI_STA);
+  log_d("following, my mac address is:");
+  Serial.println(WiFi.macAddress());
+
+  if (!transport.begin()) {
+    mode = ERuntimeMode::FAILED;
+    log_e("unable to initialize esp_now");
+    return;
+  }
+
+  esp_wifi_set_channel(sync_channel, WIFI_SECOND_CHAN_NONE);
+  transport.on_receive(sync_receive_cb);
+  sync_search_time = micros();
+  mode = ERuntimeMode::RUNNING;
+}
+
+void loop_follower(void) {
+  uint32_t now = micros();
+  portENTER_CRITICAL(&sync_lock);
+  bool has_frame = sync_follower.take(now + sync_render_lead_us, sync_frame);
+  uint32_t last_heard = sync_follower.last_heard();
+  portEXIT_CRITICAL(&sync_lock);
+
+  if (has_frame) {
+    framebuffer.clear();
+
+    sync_frame.each([](const Light& light) {
+      framebuffer.set(light);
+    });
+
+    write_outputs();
+    wait_until(sync_frame.present_at);
+    present();
+    return;
+  }
+
+  if (now - last_heard < sync_search_us || now - sync_search_time < sync_search_us) {
+    return;
+  }
+
+  sync_channel = xr::next_link_channel(sync_channel);
+  sync_search_time = now;
+  log_d("no frames from our leader, listening on channel %d", sync_channel);
+  esp_wifi_set_channel(sync_channel, WIFI_SECOND_CHAN_NONE);
+
+  framebuffer.clear();
+  write_outputs();
+  present();
+}
+#endif
+
+bool start_access_point(uint8_t channel) {
+  return WiFi.softAP("xiao-runner-light-host", "lights-host", channel, 0);
+}
+
+// Dims a light for the pause animation.
+Light dim(const Light& light, uint8_t level) {
+  auto [position, red, green, blue] = light;
+  return Light {
+    position,
+    static_cast<uint8_t>((red * level) >> 8),
+    static_cast<uint8_t>((green * level) >> 8),
+    static_cast<uint8_t>((blue * level) >> 8)
+  };
+}
+
+// Builds the level at `index`; levels past the end of the pack are generated, each harder than the last.
+Level build_level(uint32_t index) {
+  if (index < level_pack.count()) {
+    return Level { level_pack.level(index), num_pixels, stretch_levels };
+  }
+
+  uint32_t difficulty = index - level_pack.count();
+  log_d("generating level with seed %u, difficulty %u", level_seed, difficulty);
+  return Level { xr::LevelGenerator::generate(level_seed, difficulty, num_pixels), num_pixels };
+}
+
+// Plays the level pack stored in flash when asked to and there is one, otherwise the one embedded in our
+// firmware, starting over from its first level.
+void load_levels(bool from_store) {
+  auto stored = from_store ? level_store.load() : std::nullopt;
+  level_pack = stored != std::nullopt ? xr::LevelPack(stored->first, stored->second) : xr::LevelPack();
+
+  if (stored != std::nullopt && !level_pack.is_valid()) {
+    log_e("level pack in flash (%d bytes) is not a compiled pack, ignoring", stored->second);
+  }
+
+  levels_in_flash = level_pack.is_valid();
+
+  if (!level_pack.is_valid()) {
+    level_pack = xr::LevelPack(level_data_start, level_data_end - level_data_start);
+  }
+
+  log_d("loaded level pack with %d levels", level_pack.count());
+  current_level_index = 0;
+  current_level = std::make_unique<Level>(build_level(current_level_index));
+}
+
+void apply_upload_command(const char * line, const uint8_t * mac) {
+  char reply[64];
+  auto event = level_upload.handle(line, reply, sizeof(reply));
+
+  if (mac == nullptr) {
+    Serial.println(reply);
+  } else {
+    transport.add_peer(mac);
+    transport.send(mac, reinterpret_cast<const uint8_t *>(reply), strlen(reply));
+  }
+
+  // The flash holding the current pack is erased when an upload starts, so we fall back to our embedded
+  // levels until the new pack is committed. Uploads that fail to start may have unmapped it too.
+  bool unmapped = levels_in_flash && !level_store.is_mapped();
+
+  if (event == xr::LevelUpload<xr::LevelStore>::UploadEvent::STARTED) {
+    load_levels(false);
+  } else if (event == xr::LevelUpload<xr::LevelStore>::UploadEvent::ABORTED && unmapped) {
+    load_levels(false);
+  } else if (event == xr::LevelUpload<xr::LevelStore>::UploadEvent::COMMITTED) {
+    load_levels(true);
+  }
+}
+
+// Applies any upload commands that have arrived over serial or esp-now.
+void poll_uploads(void) {
+  while (Serial.available() > 0) {
+    char next = Serial.read();
+
+    if (next != '\n') {
+      if (serial_line_length < serial_line.size() - 1) {
+        serial_line[serial_line_length++] = next;
+      }
+
+      continue;
+    }
+
+    serial_line[serial_line_length] = '\0';
+
+    if (xr::LevelUpload<xr::LevelStore>::is_command(serial_line.data(), serial_line_length)) {
+      apply_upload_command(serial_line.data(), nullptr);
+    }
+
+    serial_line_length = 0;
+  }
+
+  UploadCommand command;
+  bool has_command = false;
+  portENTER_CRITICAL(&upload_lock);
+
+  if (has_upload_command) {
+    command = upload_command;
+    has_command = true;
+    has_upload_command = false;
+  }
+
+  portEXIT_CRITICAL(&upload_lock);
+
+  if (has_command) {
+    apply_upload_command(command.line, command.mac);
+  }
 }
 
 void on_connect(WiFiEvent_t event, WiFiEventInfo_t info) {
@@ -120,157 +529,374 @@ void on_connect(WiFiEvent_t event, WiFiEventInfo_t info) {
   active_wifi_connections += 1;
 }
 
-void setup(void) {
-  Serial.begin(115200);
-  log_d("setup");
-  level_indices.reserve(10);
-  delay(1000);
+// Plays the level up to `now` in fixed ticks, with our controllers' inputs or (while attracting) the
+// demo player's. Failed levels are restarted in place, from their last checkpoint (if one was reached);
+// levels the demo player completes are played again.
+void advance_level(uint32_t now, bool attracting) {
+  XR_TELEMETRY_SCOPE(telemetry, xr::TelemetryStage::LEVEL_FRAME);
+  uint32_t game_time = now - paused_time;
+  uint32_t target_time = game_time > INPUT_DELAY_MS ? game_time - INPUT_DELAY_MS : 0;
 
-  log_d("initializing game engine");
-  debug_timer = std::make_unique<xr::Timer>(debug_timer_ms);
-  pixels.begin();
-  pixels.setBrightness(20);
-  pixels.fill(Adafruit_NeoPixel::Color(0, 0, 0));
-  pixels.show();
-
-  const char *cursor = level_data_start, *current_level_cursor = level_data_start;
-  uint32_t level_size = 0;
-
-  while (cursor != level_data_end) {
-    if (*cursor != '\n' || *cursor == ':') {
-      level_size++;
-      cursor++;
-      continue;
+  if (target_time > simulation_time + (max_ticks_per_frame * simulation_tick_ms)) {
+    simulation_time = target_time - (max_ticks_per_frame * simulation_tick_ms);
+  }
+
+  while (simulation_time + simulation_tick_ms <= target_time && current_level->state() == Level::LevelStateKind::IN_PROGRESS) {
+    simulation_time += simulation_tick_ms;
+    PlayerInputs inputs {};
+
+    if (attracting) {
+      inputs[0] = attract_input;
+    } else {
+      // Inputs are stamped on our own clock, which keeps running while the game is paused.
+      inputs = peers.take(simulation_time + paused_time);
     }
 
-    log_d("found level %.*s", level_size, current_level_cursor);
-    level_indices.push_back(std::make_pair(current_level_cursor, level_size));
-    cursor++;
-    current_level_cursor = cursor;
-    level_size = 0;
+    current_level = std::make_unique<Level>(std::move(*current_level).frame(simulation_time, inputs));
   }
 
-  current_level = std::make_unique<Level>(
-    level_indices.size() > 0 ? Level{ level_indices[current_level_index], num_pixels } : Level {}
-  );
-  log_d("setup complete");
-}
+  auto next = current_level->state();
 
-void loop(void) {
-  // While we haven't had a client connected for some time, our loop in a single frame until we receive one
-  // connection to our access point.
-  if (mode == ERuntimeMode::DISCONNECTED) {
-    pixels.fill(Adafruit_NeoPixel::Color(0, 0, 0));
-    pixels.show();
+  if (attracting && next != Level::LevelStateKind::IN_PROGRESS) {
+    current_level->restart(next == Level::LevelStateKind::FAILED);
+  } else if (next == Level::LevelStateKind::FAILED) {
+    log_d("level %d failed, restarting", current_level_index);
+    current_level->restart(true);
+  } else if (next == Level::LevelStateKind::COMPLETE) {
+    log_d("level %d complete, moving to next level %d", current_level_index, current_level_index + 1);
+    current_level_index += 1;
+    current_level = std::make_unique<Level>(build_level(current_level_index));
+  }
+}
 
-    // Start our wifi access point
-    WiFi.mode(WIFI_AP);
+// Draws the level (pulsing while `paused`) and presents it; our followers present it at the same moment.
+void show_level(uint32_t now, bool paused) {
+  {
+    XR_TELEMETRY_SCOPE(telemetry, xr::TelemetryStage::BUILD_FRAMEBUFFER);
+    framebuffer.clear();
 
-    // Register some callbacks so we know when a client connects.
-    WiFi.onEvent(on_connect, ARDUINO_EVENT_WIFI_AP_STACONNECTED);
-    WiFi.onEvent(on_connect, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+    // A triangle wave between a quarter and full brightness.
+    uint32_t phase = (now % pause_pulse_ms) * 382 / pause_pulse_ms;
+    uint8_t pulse = 64 + (phase < 191 ? phase : 382 - phase);
 
-    // Create the SSID; start broadcasting.
-    bool result = WiFi.softAP("xiao-runner-light-host", "lights-host", 1, 0);
+#ifdef SYNC_LEADER
+    sync_leader.clear();
+#endif
 
-    if (!result) {
-      mode = ERuntimeMode::FAILED;
-      log_e("unable to start in soft ap mode");
-      return;
+    for (auto light = current_level->light_begin(); light != current_level->light_end(); light++) {
+      auto shown = paused ? dim(*light, pulse) : *light;
+      framebuffer.set(shown);
+#ifdef SYNC_LEADER
+      sync_leader.add(shown);
+#endif
     }
 
-    // Wait until we have a connection; this will block the current `loop` until there is a connection.
-    while (active_wifi_connections == 0) {
-      auto now = millis();
-      auto [new_timer, did_finish] = std::move(*debug_timer).tick(now);
-      debug_timer = did_finish
-        ? std::make_unique<xr::Timer>(debug_timer_ms)
-        : std::make_unique<xr::Timer>(std::move(new_timer));
-
-      if (did_finish) {
-        log_d("still waiting for connection...");
-        Serial.println(WiFi.macAddress());
-        log_d("^-- my mac address");
+    // Followers only ever replace lights, so they are sent particles already faded.
+    current_level->render_particles([paused, pulse](const Light& light, uint8_t intensity) {
+      uint8_t shown = paused ? (intensity * pulse) >> 8 : intensity;
+      framebuffer.add(light, shown);
+#ifdef SYNC_LEADER
+      sync_leader.add(dim(light, shown));
+#endif
+    });
+
+    write_outputs();
+  }
+
+#ifdef SYNC_LEADER
+  wait_until(sync_leader.send());
+#endif
+
+  present();
+  xr::log::drain(max_log_entries_per_frame);
+}
+
+// Plays the attract mode for a frame, keeping level uploads going.
+void attract(uint32_t now) {
+  last_frame_time = now;
+  poll_uploads();
+  advance_level(now, true);
+  show_level(now, true);
+}
+
+// Switches into station mode, prints our mac address and starts esp-now. The access point is kept up so
+// that additional controllers are still able to find us and join the game.
+void start_running(uint32_t now) {
+  if (pairing.state() == xr::Pairing::PairingState::DISCOVERING) {
+    pairing.discovered(now);
+  }
+
+  WiFi.mode(WIFI_AP_STA);
+  log_d("[WIFI] initializing wifi, my mac address is:");
+  Serial.println(WiFi.macAddress());
+  log_d("^ mac address");
+
+  if (!transport.begin()) {
+    mode = ERuntimeMode::FAILED;
+    log_e("unable to initialize esp_now");
+    return;
+  }
+
+  wifi_promiscuous_filter_t filter = { WIFI_PROMIS_FILTER_MASK_MGMT };
+  esp_wifi_set_promiscuous_filter(&filter);
+  esp_wifi_set_promiscuous_rx_cb(promiscuous_cb);
+  esp_wifi_set_promiscuous(true);
+
+  // The demo player has been playing our level; the game starts over with a fresh one.
+  current_level = std::make_unique<Level>(build_level(current_level_index));
+
+  // Move into our "running" state
+  log_d("esp-now ready, client should be connecting soon");
+  last_message_time = 0;
+  peers.take_link_counts();
+  link_monitor.reset(now);
+  transport.on_receive(receive_cb);
+
+#ifdef SYNC_LEADER
+  transport.add_peer(xr::BROADCAST_ADDRESS.data());
+#endif
+
+  mode = ERuntimeMode::RUNNING;
+}
+
+// Takes discovery (see `Discovery`) a step further, playing the attract mode in the meantime; nothing
+// here waits on the radio.
+void loop_disconnected(uint32_t now) {
+  if (discovery.state() == xr::Discovery::DiscoveryState::IDLE) {
+    discovery.begin(now);
+  }
+
+  switch (discovery.tick(now)) {
+    case xr::Discovery::DiscoveryAction::SEARCH:
+      // Start our wifi access point, and create the SSID; start broadcasting.
+      WiFi.mode(WIFI_AP);
+
+      if (!start_access_point(pairing_record.channel)) {
+        mode = ERuntimeMode::FAILED;
+        log_e("unable to start in soft ap mode");
+        return;
+      }
+
+      // Controllers we are resuming find us over esp-now; there is nothing to wait for.
+      if (pairing.state() != xr::Pairing::PairingState::DISCOVERING) {
+        discovery.resume(now);
       }
-    }
 
-    // Before terminating our access point, sleep for a small amount of time to allow things to settle.
-    log_d("sleeping for a second to allow wifi to settle before terminating access point");
-    delay(1000);
+      break;
+    case xr::Discovery::DiscoveryAction::LEAVE:
+      log_d("controller joined, settling with disconnected wifi");
+      WiFi.disconnect();
+      break;
+    case xr::Discovery::DiscoveryAction::START:
+      log_d("awake, starting esp-now");
+      start_running(now);
+      return;
+    default:
+      break;
+  }
 
-    // Remove callbacks, stop access point.
-    WiFi.disconnect();
-    log_d("sleeping for a second to settle with disconnected wifi");
-    delay(200);
-    log_d("awake, starting esp-now");
+  if (discovery.state() == xr::Discovery::DiscoveryState::SEARCHING && active_wifi_connections > 0) {
+    log_d("allowing wifi to settle before starting esp-now");
+    discovery.joined(now);
+  }
 
-    // Switch into station mode, print our mac address and start esp-now.
-    WiFi.mode(WIFI_MODE_STA);
-    log_d("[WIFI] initializing wifi, my mac address is:");
+  if (debug_due(now) && discovery.state() == xr::Discovery::DiscoveryState::SEARCHING) {
+    log_d("still waiting for connection...");
     Serial.println(WiFi.macAddress());
-    log_d("^ mac address");
+    log_d("^-- my mac address");
+  }
 
-    if (esp_now_init() != ESP_OK) {
-      mode = ERuntimeMode::FAILED;
-      log_e("unable to initialize esp_now");
-      return;
+  attract(now);
+}
+
+void setup(void) {
+  Serial.begin(115200);
+  log_d("setup");
+
+  log_d("initializing game engine");
+  debug_timer = std::make_unique<xr::Timer>(debug_timer_ms);
+#ifdef XR_TELEMETRY
+  telemetry_timer = std::make_unique<xr::Timer>(TELEMETRY_INTERVAL_MS);
+#endif
+  outputs.reserve(num_segments);
+  for (uint32_t i = 0; i < num_segments; i++) {
+    log_d("segment %d on pin %d (offset %d, length %d)", i, segments[i].pin, segments[i].offset, segments[i].length);
+    outputs.push_back(std::make_unique<xr::SegmentOutput>(segments[i]));
+    outputs.back()->begin();
+  }
+
+#ifdef SYNC_FOLLOWER
+  setup_follower();
+  return;
+#endif
+
+  if (level_seed == 0) {
+    level_seed = esp_random();
+  }
+
+  load_levels(true);
+
+  bool has_pairing = pairing_store.load(pairing_record);
+  pairing.boot(millis(), has_pairing);
+
+  if (!has_pairing) {
+    pairing_record.channel = 1;
+    pairing_record.count = 0;
+  }
+
+  // Register some callbacks so we know when a client connects to our access point.
+  WiFi.onEvent(on_connect, ARDUINO_EVENT_WIFI_AP_STACONNECTED);
+  WiFi.onEvent(on_connect, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+
+  log_d("loaded %d paired controllers", pairing_record.count);
+  log_d("setup complete");
+}
+
+void loop(void) {
+  auto now = millis();
+
+#ifdef SYNC_FOLLOWER
+  if (mode == ERuntimeMode::RUNNING) {
+    loop_follower();
+    return;
+  }
+
+  if (debug_due(now)) {
+    log_e("unable to follow");
+  }
+
+  return;
+#endif
+
+  if (current_level == nullptr) {
+    if (debug_due(now)) {
+      log_e("no current level");
     }
 
-    // Move into our "running" state
-    log_d("esp-now ready, client should be connecting soon");
-    last_message_time = millis();
-    esp_now_register_recv_cb(receive_cb);
-    mode = ERuntimeMode::RUNNING;
     return;
   }
 
-  if (current_level == nullptr || mode == ERuntimeMode::FAILED) {
-    delay(1000);
-    log_e("no current level");
+  // Until we have a controller, the level plays itself.
+  if (mode == ERuntimeMode::DISCONNECTED) {
+    loop_disconnected(now);
     return;
   }
 
-  pixels.fill(Adafruit_NeoPixel::Color(0, 0, 0));
+  if (mode == ERuntimeMode::FAILED) {
+    if (debug_due(now)) {
+      log_e("unable to start the radio");
+    }
 
-  auto now = millis();
-  auto [new_timer, did_finish] = std::move(*debug_timer).tick(now);
-  debug_timer = did_finish
-    ? std::make_unique<xr::Timer>(debug_timer_ms)
-    : std::make_unique<xr::Timer>(std::move(new_timer));
+    attract(now);
+    return;
+  }
 
-  if (did_finish) {
+  if (debug_due(now)) {
     auto stack_size = uxTaskGetStackHighWaterMark(NULL);
     log_d("memory: %d (max %d) (stack %d)", ESP.getFreeHeap(), ESP.getMaxAllocHeap(), stack_size);
+    log_d("link state %d on channel %d (delivery %d, rssi %d)", link_monitor.state(), pairing_record.channel, link_monitor.delivery(), link_monitor.rssi());
+
+#ifdef SYNC_LEADER
+    uint32_t sync_dropped = sync_leader.take_dropped();
+
+    if (sync_dropped > 0) {
+      log_e("%d lights dropped from synced frames", sync_dropped);
+    }
+#endif
   }
 
-  current_level = std::make_unique<Level>(std::move(*current_level).frame(now, last_input));
-  last_input = std::nullopt;
-  auto next = current_level->state();
+#ifdef XR_TELEMETRY
+  auto [new_telemetry_timer, should_emit] = std::move(*telemetry_timer).tick(now);
+  telemetry_timer = should_emit
+    ? std::make_unique<xr::Timer>(TELEMETRY_INTERVAL_MS)
+    : std::make_unique<xr::Timer>(std::move(new_telemetry_timer));
 
-  if (next != Level::LevelStateKind::IN_PROGRESS) {
-    auto new_level_index = next == Level::LevelStateKind::COMPLETE
-      ? current_level_index + 1
-      : 0;
+  if (should_emit) {
+    telemetry.emit();
+  }
 
-    if (new_level_index > level_indices.size() - 1) {
-      new_level_index = 0;
-    }
+#endif
+
+  poll_uploads();
+
+  auto link_counts = peers.take_link_counts();
+
+  for (uint32_t i = 0; i < link_counts.delivered; i++) {
+    link_monitor.delivered(last_message_time);
+  }
+
+  link_monitor.missed(link_counts.missed);
 
-    log_d("level %d complete, moving to next level %d", current_level_index, new_level_index);
-    current_level_index = new_level_index;
-    current_level = std::make_unique<Level>(Level{ level_indices[current_level_index], num_pixels });
+  if (last_rssi != 0) {
+    link_monitor.rssi(last_rssi);
   }
 
-  for (auto light = current_level->light_begin(); light != current_level->light_end(); light++) {
-    auto [pos, red, green, blue] = *light;
-    pixels.setPixelColor(pos, Adafruit_NeoPixel::Color(red, green, blue));
+  if (last_message_time > 0) {
+    pairing.heard(last_message_time);
   }
 
-  pixels.show();
+  auto pairing_state = pairing.tick(now);
+  auto action = pairing_state == xr::Pairing::PairingState::PAIRED
+    ? link_monitor.tick(now)
+    : xr::LinkMonitor::LinkAction::NONE;
+
+  switch (action) {
+    case xr::LinkMonitor::LinkAction::RETRY:
+      log_w("link lost, waiting for controllers (delivery %d)", link_monitor.delivery());
+      break;
+    case xr::LinkMonitor::LinkAction::HOP:
+      log_e("link lost, moving from channel %d to %d", pairing_record.channel, xr::next_link_channel(pairing_record.channel));
+      pairing_record.channel = xr::next_link_channel(pairing_record.channel);
+      start_access_point(pairing_record.channel);
+      pairing_store.save(pairing_record);
+      break;
+    case xr::LinkMonitor::LinkAction::REPAIR:
+      pairing.lost(now);
+      break;
+    default:
+      break;
+  }
 
-  if (now > last_message_time && last_message_time > 0 && now - last_message_time > max_nomessage_time) {
+  if (pairing.state() == xr::Pairing::PairingState::DISCOVERING) {
     log_e("message not received in a while, moving to disconnected");
-    esp_now_deinit();
+    esp_wifi_set_promiscuous(false);
+    transport.end();
     mode = ERuntimeMode::DISCONNECTED;
+    return;
   }
+
+  // Play is paused (rather than the level being torn down) until we hear from our controllers again.
+  bool paused = pairing.state() != xr::Pairing::PairingState::PAIRED
+    || link_monitor.state() == xr::LinkMonitor::LinkState::LOST;
+
+  if (paused && last_frame_time != 0) {
+    paused_time += now - last_frame_time;
+  }
+
+  last_frame_time = now;
+
+#ifdef XR_TELEMETRY
+  if (link_counts.delivered > 0) {
+    telemetry.record(xr::TelemetryStage::PARSE_INPUT, last_parse_micros);
+  }
+#endif
+
+  if (!paused) {
+    advance_level(now, false);
+  }
+
+  show_level(now, paused);
+
+  // Persist any controller we haven't played with before; registration happens on the wifi task, so
+  // this is picked up here rather than when the controller's first message arrives.
+  bool has_new_peer = false;
+
+  for (uint8_t i = 0; i < peers.count(); i++) {
+    has_new_peer = pairing_record.add(peers.mac(i).data()) || has_new_peer;
+  }
+
+  if (has_new_peer && !pairing_store.save(pairing_record)) {
+    log_e("unable to persist pairing");
+  }
+
 }
@@ -1,63 +1,142 @@
 #pragma once
 
-#include "esp32-hal-log.h"
+#include "logging.hpp"
 #include <memory>
 #include <vector>
 #include <optional>
+#include <type_traits>
 #include <variant>
 
+#include "behavior.hpp"
+#include "frame_events.hpp"
+#include "script.hpp"
 #include "timer.hpp"
 #include "types.hpp"
+#include "obstacle_kinds.hpp"
 
 class Obstacle final {
   private:
-    constexpr static const uint32_t OBJECT_BUFFER_SIZE = 30;
-    static const uint16_t ENEMY_MS_PER_MOVE = 100;
-    static const uint16_t SNAKE_MS_PER_MOVE = 1000;
-    static const uint16_t SNAKE_EYE_SIZE_HALF = 5;
-    static const uint16_t SNAKE_WINGS_SIZE_HALF = 12;
-
-    constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> SNAKE_COLOR = std::make_tuple(255, 100, 0);
-    constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> PAWN_COLOR = std::make_tuple(255, 20, 0);
-    constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> GOAL_COLOR = std::make_tuple(100, 150, 0);
+    // Every obstacle first moves this long after being created, and then at its own pace.
+    static const uint16_t FIRST_MOVE_MS = 100;
 
     class FrameVisitor;
 
-    struct Snake final {
+    // A single obstacle, whose behavior is entirely determined by its (compile time) traits. Its movement
+    // runs as a coroutine (see `xr::Behavior`) whose frame comes from the level's pool; obstacles without
+    // a pool (or whose pool is full) stand still.
+    template <typename Traits>
+    struct Actor final {
+      public:
+        using Behavior = Traits;
+
+        Actor() = delete;
+        explicit Actor(xr::BehaviorPool * pool, uint32_t pos):
+          _state(xr::ObstacleState { Direction::LEFT, pos, pos }),
+          _movement(pool == nullptr ? xr::ObstacleBehavior() : Traits::Movement::behave(*pool)) {
+            _movement.schedule(FIRST_MOVE_MS);
+          }
+        ~Actor() = default;
+
+        Actor(const Actor&) = delete;
+        Actor& operator=(const Actor&) = delete;
+
+        Actor(const Actor&& other):
+          _state(other._state),
+          _movement(std::move(other._movement))
+          {}
+
+        const Actor& operator=(const Actor&& other) noexcept {
+          this->_state = other._state;
+          this->_movement = std::move(other._movement);
+          return *this;
+        }
+
+        uint32_t position() const {
+          return _state.position;
+        }
+
+        xr::ObstacleState state() const {
+          return _state;
+        }
+
+        xr::Timer::Snapshot timer() const {
+          return _movement.timer();
+        }
+
+        void restore(const xr::ObstacleState& state, const xr::Timer::Snapshot& timer) const {
+          _state = state;
+          _movement.restore(timer);
+        }
+
+      private:
+        friend class FrameVisitor;
+        mutable xr::ObstacleState _state;
+        const xr::ObstacleBehavior _movement;
+    };
+
+    // An obstacle run by a level's script (see `xr::Script`), which waits on its movement timer.
+    struct Scripted final {
       public:
-        Snake() = delete;
-        explicit Snake(uint32_t pos):
-          _direction(Direction::LEFT),
-          _position(pos),
-          _origin(pos),
-          _movement_timer(xr::Timer(ENEMY_MS_PER_MOVE))
+        Scripted() = delete;
+        explicit Scripted(uint32_t pos, char token, std::pair<const uint8_t *, uint8_t> program):
+          _state(xr::ObstacleState { Direction::LEFT, pos, pos }),
+          _timer(xr::Timer(FIRST_MOVE_MS)),
+          _program(program.first),
+          _script(xr::ScriptState::start(token, program.second))
           {}
-        ~Snake() = default;
+        ~Scripted() = default;
 
-        Snake(const Snake&) = delete;
-        Snake& operator=(const Snake&) = delete;
+        Scripted(const Scripted&) = delete;
+        Scripted& operator=(const Scripted&) = delete;
 
-        Snake(const Snake&& other):
-          _direction(other._direction),
-          _position(other._position),
-          _origin(other._origin),
-          _movement_timer(std::move(other._movement_timer))
+        Scripted(const Scripted&& other):
+          _state(other._state),
+          _timer(std::move(other._timer)),
+          _program(other._program),
+          _script(other._script)
           {}
 
-        const Snake& operator=(const Snake&& other) noexcept {
-          this->_direction = other._direction;
-          this->_position = other._position;
-          this->_origin = other._origin;
-          this->_movement_timer = std::move(other._movement_timer);
+        const Scripted& operator=(const Scripted&& other) noexcept {
+          this->_state = other._state;
+          this->_timer = std::move(other._timer);
+          this->_program = other._program;
+          this->_script = other._script;
           return *this;
         }
 
+        uint32_t position() const {
+          return _state.position;
+        }
+
+        xr::ObstacleState state() const {
+          return _state;
+        }
+
+        xr::Timer::Snapshot timer() const {
+          return _timer.snapshot();
+        }
+
+        const xr::ScriptState& script() const {
+          return _script;
+        }
+
+        // Our bytecode stays our own; only its length is kept from before the state is taken.
+        void restore(const xr::ObstacleState& state, const xr::Timer::Snapshot& timer, const xr::ScriptState& script) const {
+          uint8_t length = _script.length;
+          _state = state;
+          _timer.restore(timer);
+          _script = script;
+          _script.length = length;
+        }
+
       private:
         friend class FrameVisitor;
-        mutable Direction _direction;
-        mutable uint32_t _position;
-        mutable uint32_t _origin;
-        const xr::Timer _movement_timer;
+        mutable xr::ObstacleState _state;
+        const xr::Timer _timer;
+
+        // Our level's bytecode (see `xr::ScriptLibrary`), which outlives us.
+        const uint8_t * _program;
+        mutable xr::ScriptState _script;
     };
 
     struct Corpse final {
@@ -73,82 +152,79 @@ class Obstacle final {
       }
     };
 
-    struct Pawn final {
-      public:
-        Pawn() = delete;
-        explicit Pawn(uint32_t pos):
-          _direction(Direction::LEFT),
-          _position(pos),
-          _origin(pos),
-          _movement_timer(xr::Timer(ENEMY_MS_PER_MOVE))
-          {}
-        ~Pawn() = default;
+    using ObstacleKind = std::variant<Actor<PawnTraits>, Actor<SnakeTraits>, Actor<GoalTraits>, Scripted, Corpse>;
 
-        Pawn(const Pawn&) = delete;
-        Pawn& operator=(const Pawn&) = delete;
+    template <typename K>
+    struct is_actor final : std::false_type {};
 
-        Pawn(const Pawn&& other):
-          _direction(other._direction),
-          _position(other._position),
-          _origin(other._origin),
-          _movement_timer(std::move(other._movement_timer))
-          {}
+    template <typename T>
+    struct is_actor<Actor<T>> final : std::true_type {};
 
-        const Pawn& operator=(const Pawn&& other) noexcept {
-          this->_direction = other._direction;
-          this->_position = other._position;
-          this->_origin = other._origin;
-          this->_movement_timer = std::move(other._movement_timer);
-          return *this;
-        }
+    // Whether an obstacle kind is somewhere in the world (i.e has not been defeated).
+    template <typename K>
+    struct is_placed final : std::bool_constant<is_actor<K>::value || std::is_same_v<K, Scripted>> {};
 
-      private:
-        friend class FrameVisitor;
-        mutable Direction _direction;
-        mutable uint32_t _position;
-        mutable uint32_t _origin;
-        const xr::Timer _movement_timer;
+  public:
+    // Everything about an obstacle that changes while a level is played (including whether it has been
+    // defeated), as plain data (see `Level::Snapshot`).
+    struct Snapshot final {
+      xr::ObstacleState state;
+      xr::Timer::Snapshot timer;
+      uint8_t kind;
+      xr::ScriptState script;
     };
 
-    struct Goal final {
-      public:
-        Goal() = delete;
-        Goal(uint16_t p): _position(p) {}
-        ~Goal() = default;
-
-        Goal(const Goal&) = delete;
-        Goal& operator=(const Goal&) = delete;
+    Obstacle(): Obstacle(Actor<PawnTraits>(nullptr, 0), PawnTraits::Shape::LIGHT_COUNT, nullptr) {}
+    ~Obstacle() = default;
 
-        Goal(const Goal&& other): _position(other._position) {}
-        const Goal& operator=(const Goal&& other) noexcept {
-          _position = other._position;
-          return *this;
+    // Creates the obstacle whose traits use `token` in level layouts, if there is one, running its
+    // movement from `pool` (which must outlive it).
+    template <size_t I = 0>
+    static std::optional<Obstacle> try_from(char token, uint32_t location, xr::BehaviorPool * pool) {
+      if constexpr (I == std::variant_size_v<ObstacleKind>) {
+        return std::nullopt;
+      } else {
+        using Kind = std::variant_alternative_t<I, ObstacleKind>;
+
+        if constexpr (is_actor<Kind>::value) {
+          if (token == Kind::Behavior::TOKEN) {
+            xr_log_d(OBSTACLE, "creating '%c' at %d", token, location);
+            return Obstacle { Kind(pool, location), Kind::Behavior::Shape::LIGHT_COUNT, pool };
+          }
         }
 
-      private:
-        friend class FrameVisitor;
-        mutable uint16_t _position;
-    };
+        return try_from<I + 1>(token, location, pool);
+      }
+    }
 
-    using ObstacleKind = std::variant<Pawn, Snake, Goal, Corpse>;
+    // Creates an obstacle running the script for `token` from a level's library (which must outlive it).
+    static std::optional<Obstacle> from_script(char token, uint32_t location, const xr::ScriptLibrary& scripts) {
+      auto program = scripts.program(token);
 
-  public:
-    Obstacle(): Obstacle(Pawn(0)) {}
-    ~Obstacle() = default;
+      if (program == std::nullopt) {
+        return std::nullopt;
+      }
+
+      xr_log_d(OBSTACLE, "creating scripted obstacle at %d", location);
+      return Obstacle { Scripted(location, token, *program), xr::Script::LIGHT_CAPACITY, nullptr };
+    }
+
+    // The most lights an obstacle created from this token will render in a single frame; zero for
+    // tokens that are not obstacles.
+    template <size_t I = 0>
+    static uint32_t light_capacity(char token) {
+      if constexpr (I == std::variant_size_v<ObstacleKind>) {
+        return token >= '0' && token <= '9' ? xr::Script::LIGHT_CAPACITY : 0;
+      } else {
+        using Kind = std::variant_alternative_t<I, ObstacleKind>;
+
+        if constexpr (is_actor<Kind>::value) {
+          if (token == Kind::Behavior::TOKEN) {
+            return Kind::Behavior::Shape::LIGHT_COUNT;
+          }
+        }
 
-    static std::optional<Obstacle> try_from(char token, uint32_t location) {
-      switch (token) {
-        case 'x':
-          log_d("creating pawn at %d", location);
-          return Obstacle { Pawn(location) };
-        case 'g':
-          log_d("creating goal at %d", location);
-          return Obstacle { Goal(location) };
-        case 's':
-          log_d("creating snake at %d", location);
-          return Obstacle { Snake(location) };
-        default:
-          return std::nullopt;
+        return light_capacity<I + 1>(token);
       }
     }
 
@@ -157,12 +233,14 @@ class Obstacle final {
 
     Obstacle(const Obstacle&& other):
       _data(std::move(other._data)),
-      _kind(std::move(other._kind)) {
+      _kind(std::move(other._kind)),
+      _pool(other._pool) {
     }
 
     Obstacle& operator=(const Obstacle&& other) {
       _data = std::move(other._data);
       _kind = std::move(other._kind);
+      _pool = other._pool;
       return *this;
     }
 
@@ -174,12 +252,74 @@ class Obstacle final {
       return _data->cend();
     }
 
-    std::tuple<const Obstacle, FrameMessage> frame(uint32_t time, const FrameMessage& input) const && {
+    // How many lights we have room for; fixed when we are created (see `light_capacity`).
+    uint32_t light_buffer_capacity() const {
+      return _data->capacity();
+    }
+
+    // Whether the obstacle is between `start` and `end` (inclusive); defeated obstacles are nowhere.
+    bool is_within(uint32_t start, uint32_t end) const {
+      return std::visit([start, end](const auto& kind) {
+        if constexpr (is_placed<std::decay_t<decltype(kind)>>::value) {
+          return kind.position() >= start && kind.position() <= end;
+        } else {
+          return false;
+        }
+      }, _kind);
+    }
+
+    Snapshot snapshot() const {
+      return std::visit([this](const auto& kind) {
+        using Kind = std::decay_t<decltype(kind)>;
+        uint8_t index = static_cast<uint8_t>(_kind.index());
+
+        if constexpr (std::is_same_v<Kind, Scripted>) {
+          return Snapshot { kind.state(), kind.timer(), index, kind.script() };
+        } else if constexpr (is_actor<Kind>::value) {
+          return Snapshot { kind.state(), kind.timer(), index, xr::ScriptState {} };
+        } else {
+          return Snapshot { xr::ObstacleState { Direction::IDLE, 0, 0 }, xr::Timer::Snapshot { 0, 0, 0 }, index, xr::ScriptState {} };
+        }
+      }, _kind);
+    }
+
+    // Puts the obstacle back the way it was when the snapshot was taken. Obstacles are restored in place
+    // (a defeated obstacle comes back to life in the same storage, and restarts its movement in the block
+    // of the pool its old one gave back), so nothing is allocated. Scripted obstacles run the bytecode
+    // `scripts` (our level's library) has for their token, wherever the snapshot was taken.
+    template <size_t I = 0>
+    void restore(const Snapshot& snapshot, const xr::ScriptLibrary& scripts) const {
+      if constexpr (I == std::variant_size_v<ObstacleKind>) {
+        return;
+      } else {
+        using Kind = std::variant_alternative_t<I, ObstacleKind>;
+
+        if (snapshot.kind != I) {
+          return restore<I + 1>(snapshot, scripts);
+        }
+
+        _data->clear();
+
+        if constexpr (std::is_same_v<Kind, Scripted>) {
+          // A library without the script (e.g a snapshot from a different level) leaves nothing to run.
+          auto program = scripts.program(snapshot.script.token);
+          _kind.template emplace<I>(snapshot.state.origin, snapshot.script.token, program.value_or(std::pair<const uint8_t *, uint8_t>(nullptr, 0)));
+          std::get<I>(_kind).restore(snapshot.state, snapshot.timer, snapshot.script);
+        } else if constexpr (is_actor<Kind>::value) {
+          _kind.template emplace<I>(_pool, snapshot.state.origin);
+          std::get<I>(_kind).restore(snapshot.state, snapshot.timer);
+        } else {
+          _kind.template emplace<I>();
+        }
+      }
+    }
+
+    // Moves the obstacle for the frame, emitting an event for every player it ran into.
+    const Obstacle frame(uint32_t time, const PlayerMovements& players, xr::FrameEvents& events) const && {
       _data->clear();
-      auto visitor = FrameVisitor { time, input, _data.get() };
-      auto [new_kind, message] = std::visit(visitor, std::move(_kind));
-      _kind = std::move(new_kind);
-      return std::make_tuple(std::move(*this), message);
+      auto visitor = FrameVisitor { time, players, _data.get(), events };
+      _kind = std::visit(visitor, std::move(_kind));
+      return std::move(*this);
     }
 
   private:
@@ -187,125 +327,106 @@ class Obstacle final {
       public:
         explicit FrameVisitor(
           uint32_t time,
-          const FrameMessage& input,
-          std::vector<Light> * const data
-        ): _time(time), _input(input), _data(data) {
+          const PlayerMovements& players,
+          std::vector<Light> * const data,
+          xr::FrameEvents& events
+        ): _time(time), _players(players), _data(data), _events(events) {
         }
 
-        std::tuple<ObstacleKind, FrameMessage> operator()(const Snake& snake) const {
-          auto [updated_timer, has_moved] = std::move(snake._movement_timer).tick(_time);
-          snake._movement_timer = has_moved
-            ? xr::Timer(SNAKE_MS_PER_MOVE)
-            : std::move(updated_timer);
-
-          auto new_position = has_moved
-            ? snake._direction == Direction::LEFT ? snake._position + 1 : snake._position - 1
-            : snake._position;
+        // Obstacles that ran into anyone stay put (and are not drawn) for the frame; the rest move if
+        // their movement is due.
+        template <typename T>
+        ObstacleKind operator()(const Actor<T>& actor) const {
+          bool touched = false;
+
+          for (uint8_t i = 0; i < _players.count; i++) {
+            const PlayerMovement& player_movement = _players.movements[i];
+            auto outcome = T::Shape::covers(actor._state.position, _time, player_movement.position)
+              ? T::Collision::resolve(player_movement.attacking)
+              : xr::CollisionOutcome::NONE;
+
+            switch (outcome) {
+              case xr::CollisionOutcome::OBSTACLE_DEFEATED:
+                _events.emit(ObstacleDefeated { player_movement.player, actor._state.position });
+                return Corpse();
+              case xr::CollisionOutcome::PLAYER_HIT:
+                _events.emit(ObstacleCollision { player_movement.player, player_movement.position });
+                touched = true;
+                break;
+              case xr::CollisionOutcome::GOAL:
+                _events.emit(GoalReached { actor._state.position });
+                return std::move(actor);
+              default:
+                break;
+            }
+          }
 
-          if (snake._position + SNAKE_EYE_SIZE_HALF > snake._origin) {
-            snake._direction = Direction::RIGHT;
-          } else if (snake._position > SNAKE_EYE_SIZE_HALF && snake._position - SNAKE_EYE_SIZE_HALF < snake._origin) {
-            snake._direction = Direction::LEFT;
+          if (touched) {
+            return std::move(actor);
           }
 
-          FrameMessage result = std::move(_input);
+          actor._movement.update(_time, actor._state);
 
-          for (uint32_t i = 0; i < (SNAKE_WINGS_SIZE_HALF + SNAKE_WINGS_SIZE_HALF); i++) {
-            uint32_t light_position = 0;
+          T::Shape::blit(actor._state.position, _time, _data);
 
-            if (i < SNAKE_WINGS_SIZE_HALF) {
-              light_position = snake._position + i + SNAKE_EYE_SIZE_HALF;
-            } else {
-              if (snake._position < (i + SNAKE_EYE_SIZE_HALF)) {
-                continue;
-              }
+          return std::move(actor);
+        }
 
-              light_position = snake._position - (i + SNAKE_EYE_SIZE_HALF);
-            }
+        // Scripted obstacles collide like any other, then run their script (see `xr::ScriptMachine`).
+        ObstacleKind operator()(const Scripted& scripted) const {
+          bool touched = false;
 
-            if (std::holds_alternative<PlayerMovement>(result)) {
-              auto player_movement = std::get_if<PlayerMovement>(&result);
-              auto did_collide = player_movement->position == light_position;
+          for (uint8_t i = 0; i < _players.count; i++) {
+            const PlayerMovement& player_movement = _players.movements[i];
 
-              if (did_collide && player_movement->attacking == false) {
-                result = ObstacleCollision { light_position };
-              }
+            if (!xr::ScriptMachine::covers(scripted._script, scripted._state, player_movement.position)) {
+              continue;
             }
 
-            auto [red, green, blue] = SNAKE_COLOR;
-            _data->push_back(std::make_tuple(light_position, red, green, blue));
-          }
-
-          snake._position = new_position;
-
-          return std::make_tuple(std::move(snake), std::move(result));
-        }
+            auto outcome = scripted._script.killable
+              ? xr::Killable::resolve(player_movement.attacking)
+              : xr::Lethal::resolve(player_movement.attacking);
 
-        std::tuple<ObstacleKind, FrameMessage> operator()(const Pawn& pawn) const {
-          auto [updated_timer, has_moved] = std::move(pawn._movement_timer).tick(_time);
-          pawn._movement_timer = has_moved ? xr::Timer(ENEMY_MS_PER_MOVE) : std::move(updated_timer);
-
-          if (std::holds_alternative<PlayerMovement>(_input)) {
-            auto player_movement = std::get_if<PlayerMovement>(&_input);
-            bool did_collide = player_movement->position == pawn._position;
-
-            if (did_collide) {
-              return player_movement->attacking
-                ? std::make_tuple<ObstacleKind>(Corpse(), _input)
-                : std::make_tuple<ObstacleKind>(std::move(pawn), ObstacleCollision { pawn._position });
+            if (outcome == xr::CollisionOutcome::OBSTACLE_DEFEATED) {
+              _events.emit(ObstacleDefeated { player_movement.player, scripted._state.position });
+              return Corpse();
             }
-          }
 
-          if (has_moved) {
-            pawn._position = pawn._direction == Direction::LEFT
-              ? pawn._position + 1
-              : pawn._position - 1;
-
-            if (pawn._direction == Direction::LEFT && pawn._position > (pawn._origin + 10)) {
-              pawn._direction = Direction::RIGHT;
-            } else if (pawn._direction == Direction::RIGHT && pawn._position < (pawn._origin - 10)) {
-              pawn._direction = Direction::LEFT;
+            if (outcome == xr::CollisionOutcome::PLAYER_HIT) {
+              _events.emit(ObstacleCollision { player_movement.player, player_movement.position });
+              touched = true;
             }
           }
 
-          auto [red, green, blue] = PAWN_COLOR;
-          _data->push_back(std::make_tuple(pawn._position, red, green, blue));
-
-          return std::make_pair(std::move(pawn), _input);
-        }
-
-        std::tuple<ObstacleKind, FrameMessage> operator()(const Goal& goal) const {
-          auto [red, green, blue] = GOAL_COLOR;
-          _data->push_back(std::make_tuple(goal._position, red, green, blue));
-
-          if (std::holds_alternative<PlayerMovement>(_input)) {
-            auto player_movement = std::get_if<PlayerMovement>(&_input);
-            bool did_collide = player_movement->position == goal._position;
-
-            if (did_collide) {
-              return std::make_tuple<ObstacleKind>(std::move(goal), GoalReached { });
-            }
+          if (touched) {
+            return std::move(scripted);
           }
 
-          return std::make_tuple(std::move(goal), _input);
+          xr::ScriptMachine::run(scripted._script, scripted._program, scripted._state, scripted._timer, _time, _events);
+          xr::ScriptMachine::blit(scripted._script, scripted._state, _data);
+
+          return std::move(scripted);
         }
 
-        std::tuple<ObstacleKind, FrameMessage> operator()(const Corpse& corpse) const {
-          return std::make_tuple(std::move(corpse), _input);
+        ObstacleKind operator()(const Corpse& corpse) const {
+          return std::move(corpse);
         }
 
       private:
         uint32_t _time;
-        const FrameMessage& _input;
+        const PlayerMovements& _players;
         std::vector<Light> * const _data;
+        xr::FrameEvents& _events;
     };
 
-    explicit Obstacle(ObstacleKind&& kind):
+    explicit Obstacle(ObstacleKind&& kind, uint32_t capacity, xr::BehaviorPool * pool):
       _data(new std::vector<Light>(0)),
-      _kind(std::move(kind)) {
-      _data->reserve(OBJECT_BUFFER_SIZE);
+      _kind(std::move(kind)),
+      _pool(pool) {
+      _data->reserve(capacity);
     }
 
     mutable std::unique_ptr<std::vector<Light>> _data;
     mutable ObstacleKind _kind;
+    mutable xr::BehaviorPool * _pool;
 };
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <tuple>
+
+#include "behavior.hpp"
+#include "types.hpp"
+#include "sprite.hpp"
+
+// Obstacle kinds are described entirely at compile time by a traits struct naming the token used for
+// them in level layouts, and one policy for each of their movement, shape (a sprite, see `sprite.hpp`)
+// and what happens when the player runs into them:
+//
+// struct PawnTraits final {
+//   constexpr static const char TOKEN = 'x';
+//   using Movement = xr::Patrol<100, 10>;
+//   using Shape = xr::Sprite<xr::PointMask<255, 20, 0>>;
+//   using Collision = xr::Killable;
+// };
+//
+// New kinds are added by writing a traits struct and listing it in `Obstacle::ObstacleKind`.
+namespace xr {
+  // The mutable state shared by every kind of obstacle.
+  struct ObstacleState final {
+    Direction direction;
+    uint32_t position;
+    uint32_t origin;
+  };
+
+  using ObstacleBehavior = Behavior<ObstacleState>;
+
+  // Movement policies `behave` as coroutines (see `xr::Behavior`), moving their obstacle and waiting
+  // between moves. They are resumed from the top whenever an obstacle is restored, so each keeps its
+  // whole routine in the obstacle's state and waits in exactly one place: at the bottom of its loop.
+
+  // Never moves; finishing straight away hands its frame back to the pool.
+  struct Stationary final {
+    static ObstacleBehavior behave(BehaviorPool& pool) {
+      co_return;
+    }
+  };
+
+  // Walks back and forth, turning around once `RANGE` lights away from where it started.
+  template <uint16_t MS, uint32_t RANGE>
+  struct Patrol final {
+    static ObstacleBehavior behave(BehaviorPool& pool) {
+      auto& self = co_await ObstacleBehavior::context();
+
+      while (true) {
+        ObstacleState& state = *self.state;
+        state.position = state.direction == Direction::LEFT ? state.position + 1 : state.position - 1;
+
+        if (state.direction == Direction::LEFT && state.position > (state.origin + RANGE)) {
+          state.direction = Direction::RIGHT;
+        } else if (state.direction == Direction::RIGHT && state.position < (state.origin - RANGE)) {
+          state.direction = Direction::LEFT;
+        }
+
+        co_await wait(MS);
+      }
+    }
+  };
+
+  // Sways slowly in place around its origin.
+  template <uint16_t MS, uint32_t HALF>
+  struct Hover final {
+    static ObstacleBehavior behave(BehaviorPool& pool) {
+      auto& self = co_await ObstacleBehavior::context();
+
+      while (true) {
+        ObstacleState& state = *self.state;
+
+        if (state.position + HALF > state.origin) {
+          state.direction = Direction::RIGHT;
+        } else if (state.position > HALF && state.position - HALF < state.origin) {
+          state.direction = Direction::LEFT;
+        }
+
+        state.position = state.direction == Direction::LEFT ? state.position + 1 : state.position - 1;
+
+        co_await wait(MS);
+      }
+    }
+  };
+
+  // Collision policies decide what happens when one of an obstacle's lights lands on the player.
+
+  enum CollisionOutcome {
+    NONE,
+    PLAYER_HIT,
+    OBSTACLE_DEFEATED,
+    GOAL,
+  };
+
+  // Hurts the player unless they are attacking, in which case they pass through unharmed.
+  struct Lethal final {
+    static CollisionOutcome resolve(bool attacking) {
+      return attacking ? CollisionOutcome::NONE : CollisionOutcome::PLAYER_HIT;
+    }
+  };
+
+  // Hurts the player unless they are attacking, in which case the obstacle is defeated.
+  struct Killable final {
+    static CollisionOutcome resolve(bool attacking) {
+      return attacking ? CollisionOutcome::OBSTACLE_DEFEATED : CollisionOutcome::PLAYER_HIT;
+    }
+  };
+
+  struct Objective final {
+    static CollisionOutcome resolve(bool attacking) {
+      return CollisionOutcome::GOAL;
+    }
+  };
+}
+
+struct PawnTraits final {
+  constexpr static const char TOKEN = 'x';
+  using Movement = xr::Patrol<100, 10>;
+  using Shape = xr::Sprite<xr::PointMask<255, 20, 0>>;
+  using Collision = xr::Killable;
+};
+
+struct SnakeTraits final {
+  constexpr static const char TOKEN = 's';
+  using Movement = xr::Hover<1000, 5>;
+  using Shape = xr::Sprite<xr::WingsMask<5, 12, 255, 100, 0>>;
+  using Collision = xr::Lethal;
+};
+
+struct GoalTraits final {
+  constexpr static const char TOKEN = 'g';
+  using Movement = xr::Stationary;
+  using Shape = xr::Sprite<xr::PointMask<100, 150, 0>>;
+  using Collision = xr::Objective;
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+#include "camera.hpp"
+#include "random.hpp"
+#include "types.hpp"
+
+namespace xr {
+  // A handful of particles thrown out from a single position, e.g when an obstacle is defeated.
+  struct Burst final {
+    uint8_t count;
+
+    // How fast the fastest of them leave, in 1/256ths of a light per millisecond.
+    uint16_t speed;
+
+    // How long they take to fade out, in milliseconds.
+    uint16_t life_ms;
+
+    std::tuple<uint8_t, uint8_t, uint8_t> color;
+  };
+
+  // Short lived sparks drawn on top of the level, additively (see `Framebuffer::add`). Every particle
+  // lives in a fixed pool, sized once, and is kept in fixed point: positions and velocities in 1/256ths of
+  // a light, and intensities in 1/256ths of a step out of 255. Particles that die are swapped with the last
+  // live one, and bursts that do not fit in the pool are cut short, so nothing is ever allocated.
+  //
+  // Particles are purely for show; they are not part of level snapshots and have no effect on play.
+  class Particles final {
+    public:
+      constexpr static const uint32_t CAPACITY = 256;
+
+      // Particles slow by 1/256th of their speed every millisecond.
+      constexpr static const int32_t DRAG_SHIFT = 8;
+
+      // Updates further apart than this (e.g after the game was paused) are taken to be this far apart.
+      constexpr static const uint32_t MAX_STEP_MS = 50;
+
+      struct Particle final {
+        int32_t position;
+        int32_t velocity;
+        uint16_t intensity;
+        uint16_t decay;
+        uint8_t red;
+        uint8_t green;
+        uint8_t blue;
+      };
+
+      Particles(): _count(0), _last_time(0), _random(0x5041525449434c45ULL, 0) {}
+      ~Particles() = default;
+
+      Particles(const Particles&) = delete;
+      Particles& operator=(const Particles&) = delete;
+
+      uint32_t count() const {
+        return _count;
+      }
+
+      void clear() {
+        _count = 0;
+        _last_time = 0;
+      }
+
+      // Throws out up to `burst.count` particles from `position` (in the world), in both directions.
+      void emit(uint32_t position, const Burst& burst) {
+        auto [red, green, blue] = burst.color;
+        uint16_t decay = std::max(1u, (255u << 8) / std::max<uint32_t>(burst.life_ms, 1));
+        uint32_t spread = static_cast<uint32_t>(burst.speed) * 2 + 1;
+
+        for (uint8_t i = 0; i < burst.count && _count < CAPACITY; i++) {
+          int32_t velocity = static_cast<int32_t>(_random.below(spread)) - burst.speed;
+
+          // Some particles start dimmer than others, so that the burst thins out as it fades.
+          uint16_t intensity = 0xFFFF - _random.below(0x4000);
+
+          _pool[_count++] = Particle {
+            static_cast<int32_t>(position << 8) + 0x80,
+            velocity,
+            intensity,
+            decay,
+            red,
+            green,
+            blue,
+          };
+        }
+      }
+
+      // Moves and fades every particle up to `time`, dropping the ones that have faded out.
+      void update(uint32_t time) {
+        uint32_t step = _last_time == 0 ? 0 : std::min(time - _last_time, MAX_STEP_MS);
+        _last_time = time;
+
+        if (step == 0) {
+          return;
+        }
+
+        uint32_t i = 0;
+
+        while (i < _count) {
+          Particle& particle = _pool[i];
+          uint32_t faded = static_cast<uint32_t>(particle.decay) * step;
+
+          if (faded >= particle.intensity) {
+            _pool[i] = _pool[--_count];
+            continue;
+          }
+
+          particle.intensity -= faded;
+          particle.position += particle.velocity * static_cast<int32_t>(step);
+          particle.velocity -= (particle.velocity * static_cast<int32_t>(step)) >> DRAG_SHIFT;
+          i++;
+        }
+      }
+
+      // Calls `write(light, intensity)` for every particle the camera can see, with the light in strip
+      // coordinates and its intensity out of 255.
+      template <typename W>
+      void render(const Camera& camera, W&& write) const {
+        for (uint32_t i = 0; i < _count; i++) {
+          const Particle& particle = _pool[i];
+
+          if (particle.position < 0) {
+            continue;
+          }
+
+          uint32_t position = static_cast<uint32_t>(particle.position) >> 8;
+
+          if (camera.contains(position)) {
+            write(camera.project(Light { position, particle.red, particle.green, particle.blue }), particle.intensity >> 8);
+          }
+        }
+      }
+
+    private:
+      std::array<Particle, CAPACITY> _pool;
+      uint32_t _count;
+      uint32_t _last_time;
+      Random _random;
+  };
+}
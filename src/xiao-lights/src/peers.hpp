@@ -0,0 +1,203 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <array>
+#include <optional>
+
+#include "types.hpp"
+#include "clock_sync.hpp"
+
+namespace xr {
+  // Routes controller inputs to players. Every controller is identified by its mac address and given the
+  // next free player slot the first time it sends us anything; inputs are then queued per controller
+  // (they arrive on the wifi task) until the simulation reaches the time they happened at.
+  //
+  // Controllers number their messages, which is used to count how many of them never arrived, and stamp
+  // them with the time they were sent, which is mapped onto our clock (see `ClockSync`).
+  class Peers final {
+    public:
+      constexpr static const uint8_t QUEUE_SIZE = 8;
+
+      // For this long after a controller's last input we predict that it is still being held (without the
+      // button, so that attacks are not repeated); after that the controller is taken to be neutral.
+      constexpr static const uint32_t PREDICTION_HORIZON_MS = 150;
+
+      // Gaps in sequence numbers larger than this are not counted as missed; the controller most likely
+      // restarted.
+      constexpr static const uint32_t MAX_SEQUENCE_GAP = 32;
+
+      struct LinkCounts final {
+        uint32_t delivered;
+        uint32_t missed;
+      };
+
+      Peers(): _lock(portMUX_INITIALIZER_UNLOCKED), _count(0), _link_counts({ 0, 0 }) {}
+      ~Peers() = default;
+
+      Peers(const Peers&) = delete;
+      Peers& operator=(const Peers&) = delete;
+
+      // Queues a message from the controller at `mac`, received at `local_time`; when a controller's queue
+      // is full its oldest input is dropped. Messages without a timestamp happened when they arrived.
+      void receive(const uint8_t * mac, const ControllerMessage& message, uint32_t local_time) {
+        portENTER_CRITICAL(&_lock);
+        auto peer = find_or_register(mac);
+        _link_counts.delivered += 1;
+
+        if (peer != nullptr) {
+          auto sequence = message.sequence;
+
+          if (sequence > peer->sequence + 1 && peer->sequence != 0 && sequence - peer->sequence <= MAX_SEQUENCE_GAP) {
+            _link_counts.missed += sequence - peer->sequence - 1;
+          }
+
+          if (sequence <= peer->sequence) {
+            peer->clock.reset();
+          }
+
+          peer->sequence = sequence;
+
+          if (message.time != 0) {
+            peer->clock.observe(message.time, local_time);
+          }
+
+          if (peer->size == QUEUE_SIZE) {
+            peer->head = (peer->head + 1) % QUEUE_SIZE;
+            peer->size -= 1;
+          }
+
+          auto time = message.time != 0 ? peer->clock.map(message.time) : local_time;
+          peer->queue[(peer->head + peer->size) % QUEUE_SIZE] = QueuedInput { time, message.input };
+          peer->size += 1;
+        }
+
+        portEXIT_CRITICAL(&_lock);
+      }
+
+      // Takes, for every controller by player index, the next input that happened at or before `time`
+      // (on our clock). Controllers without one get their predicted input instead.
+      PlayerInputs take(uint32_t time) {
+        PlayerInputs inputs;
+        portENTER_CRITICAL(&_lock);
+
+        for (uint8_t i = 0; i < _count; i++) {
+          Peer& peer = _peers[i];
+
+          if (peer.size > 0 && !later(peer.queue[peer.head].time, time)) {
+            peer.last = peer.queue[peer.head];
+            inputs[i] = peer.last.input;
+            peer.head = (peer.head + 1) % QUEUE_SIZE;
+            peer.size -= 1;
+            continue;
+          }
+
+          if (peer.last.time == 0) {
+            continue;
+          }
+
+          auto [x, y, z] = peer.last.input;
+          inputs[i] = time - peer.last.time <= PREDICTION_HORIZON_MS
+            ? ControllerInput { x, y, 0 }
+            : ControllerInput { 0, 0, 0 };
+        }
+
+        portEXIT_CRITICAL(&_lock);
+        return inputs;
+      }
+
+      // Takes the number of messages received (and known to be missed) since the last call.
+      LinkCounts take_link_counts() {
+        portENTER_CRITICAL(&_lock);
+        auto result = _link_counts;
+        _link_counts = { 0, 0 };
+        portEXIT_CRITICAL(&_lock);
+        return result;
+      }
+
+      uint8_t count() const {
+        return _count;
+      }
+
+      // When the input last taken for player `index` happened, on our clock.
+      uint32_t input_time(uint8_t index) {
+        portENTER_CRITICAL(&_lock);
+        auto result = _peers[index].last.time;
+        portEXIT_CRITICAL(&_lock);
+        return result;
+      }
+
+      // Whether `mac` belongs to one of our controllers.
+      bool knows(const uint8_t * mac) {
+        portENTER_CRITICAL(&_lock);
+        bool result = find(mac) != nullptr;
+        portEXIT_CRITICAL(&_lock);
+        return result;
+      }
+
+      // The mac address of the controller assigned to player `index`.
+      std::array<uint8_t, 6> mac(uint8_t index) {
+        portENTER_CRITICAL(&_lock);
+        auto result = _peers[index].mac;
+        portEXIT_CRITICAL(&_lock);
+        return result;
+      }
+
+    private:
+      struct QueuedInput final {
+        uint32_t time;
+        ControllerInput input;
+      };
+
+      struct Peer final {
+        std::array<uint8_t, 6> mac;
+        std::array<QueuedInput, QUEUE_SIZE> queue;
+        uint8_t head;
+        uint8_t size;
+        uint32_t sequence;
+        ClockSync clock;
+        QueuedInput last;
+      };
+
+      static bool later(uint32_t left, uint32_t right) {
+        return static_cast<int32_t>(left - right) > 0;
+      }
+
+      Peer * find(const uint8_t * mac) {
+        for (uint8_t i = 0; i < _count; i++) {
+          if (memcmp(_peers[i].mac.data(), mac, 6) == 0) {
+            return &_peers[i];
+          }
+        }
+
+        return nullptr;
+      }
+
+      Peer * find_or_register(const uint8_t * mac) {
+        Peer * known = find(mac);
+
+        if (known != nullptr) {
+          return known;
+        }
+
+        if (_count == MAX_PLAYERS) {
+          return nullptr;
+        }
+
+        Peer& peer = _peers[_count];
+        memcpy(peer.mac.data(), mac, 6);
+        peer.head = 0;
+        peer.size = 0;
+        peer.sequence = 0;
+        peer.clock.reset();
+        peer.last = QueuedInput { 0, ControllerInput { 0, 0, 0 } };
+        _count += 1;
+        return &peer;
+      }
+
+      portMUX_TYPE _lock;
+      std::array<Peer, MAX_PLAYERS> _peers;
+      uint8_t _count;
+      LinkCounts _link_counts;
+  };
+}
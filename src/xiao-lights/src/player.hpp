@@ -1,9 +1,11 @@
 #pragma once
 
-#include "esp32-hal-log.h"
+#include "logging.hpp"
+#include <array>
 #include <memory>
 #include <vector>
 
+#include "frame_events.hpp"
 #include "timer.hpp"
 #include "types.hpp"
 
@@ -14,12 +16,37 @@ class Player final {
     static const uint32_t PLAYER_ATTACK_DURATION = 1000;
     static const uint32_t OBJECT_BUFFER_SIZE = 2;
     constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> ATTACKING_COLOR = std::make_tuple(0, 255, 0);
-    constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> IDLE_COLOR = std::make_tuple(255, 255, 255);
     constexpr static const std::tuple<uint8_t, uint8_t, uint8_t> RECOVERING_COLOR = std::make_tuple(10, 180, 255);
 
-    Player():
+    // Everything about a player that changes while they play, as plain data (see `Level::Snapshot`).
+    struct Snapshot final {
+      uint32_t position;
+      xr::Timer::Snapshot movement_timer;
+      xr::Timer::Snapshot idle_timer;
+      uint8_t direction;
+      uint8_t kind;
+      bool joined;
+    };
+
+    // The color each player is shown in while idle, by player index.
+    constexpr static const std::array<std::tuple<uint8_t, uint8_t, uint8_t>, MAX_PLAYERS> IDLE_COLORS = {
+      std::make_tuple(255, 255, 255),
+      std::make_tuple(255, 0, 255),
+      std::make_tuple(0, 0, 255),
+      std::make_tuple(255, 255, 0),
+      std::make_tuple(0, 255, 255),
+      std::make_tuple(255, 120, 120),
+      std::make_tuple(120, 0, 255),
+      std::make_tuple(255, 120, 0),
+    };
+
+    // Players other than the first sit out (are not drawn and cannot be hit) until their controller
+    // sends its first input.
+    explicit Player(uint8_t index, uint32_t spawn):
       _data(new std::vector<Light>(0)),
-      _position(0),
+      _index(index),
+      _joined(index == 0),
+      _position(spawn),
       _direction(Direction::IDLE),
       _kind(PlayerStateKind::IDLE),
       _movement_timer(new xr::Timer(10)),
@@ -27,6 +54,8 @@ class Player final {
       _data->reserve(OBJECT_BUFFER_SIZE);
     }
 
+    Player(): Player(0, 0) {}
+
     ~Player() = default;
 
     Player(const Player&) = delete;
@@ -34,6 +63,8 @@ class Player final {
 
     Player(const Player&& other):
       _data(std::move(other._data)),
+      _index(other._index),
+      _joined(other._joined),
       _position(other._position),
       _direction(other._direction),
       _kind(other._kind),
@@ -43,6 +74,8 @@ class Player final {
 
     Player& operator=(const Player&& other) {
       _data = std::move(other._data);
+      _index = other._index;
+      _joined = other._joined;
       _position = other._position;
       _direction = other._direction;
       _kind = other._kind;
@@ -60,12 +93,59 @@ class Player final {
       return _data->cend();
     }
 
-    std::tuple<const Player, FrameMessage> frame(
+    uint32_t position() const {
+      return _position;
+    }
+
+    Snapshot snapshot() const {
+      return Snapshot {
+        _position,
+        _movement_timer->snapshot(),
+        _idle_timer->snapshot(),
+        static_cast<uint8_t>(_direction),
+        static_cast<uint8_t>(_kind),
+        _joined
+      };
+    }
+
+    void restore(const Snapshot& snapshot) const {
+      _data->clear();
+      _position = snapshot.position;
+      _movement_timer->restore(snapshot.movement_timer);
+      _idle_timer->restore(snapshot.idle_timer);
+      _direction = static_cast<Direction>(snapshot.direction);
+      _kind = static_cast<PlayerStateKind>(snapshot.kind);
+      _joined = snapshot.joined;
+    }
+
+    // Whether the player has joined the game and has not been hit.
+    bool is_playing() const {
+      return _joined && _kind != PlayerStateKind::DEAD;
+    }
+
+    void kill() const {
+      xr_log_d(PLAYER, "player %d hit at %d", _index, _position);
+      _kind = PlayerStateKind::DEAD;
+    }
+
+    // Moves the player for the frame, emitting an event when they join or start an attack.
+    std::tuple<const Player, PlayerMovement> frame(
       uint32_t current_time,
-      const std::optional<ControllerInput>& input
+      const std::optional<ControllerInput>& input,
+      xr::FrameEvents& events
     ) const && {
       _data->clear();
 
+      if (!_joined && input != std::nullopt) {
+        xr_log_d(PLAYER, "player %d joined at %d", _index, _position);
+        _joined = true;
+        events.emit(PlayerJoined { _index, _position });
+      }
+
+      if (!is_playing()) {
+        return std::make_tuple(std::move(*this), PlayerMovement { _index, _position, false });
+      }
+
       // Tick our movement timer; if it has run out we will be able to move.
       auto [next_player_movement_timer, did_move] = std::move(*_movement_timer).tick(current_time);
       _movement_timer = did_move
@@ -84,7 +164,7 @@ class Player final {
       }
 
       if (_kind == PlayerStateKind::ATTACKING && has_acted) {
-        log_d("attack complete (duration %d) at time %d", PLAYER_ATTACK_DURATION, time);
+        xr_log_d(PLAYER, "attack complete (duration %d) at time %d", PLAYER_ATTACK_DURATION, current_time);
         _kind = PlayerStateKind::RECOVERING;
         _idle_timer = std::make_unique<xr::Timer>(PLAYER_DEBUFF_DURATION);
       }
@@ -92,9 +172,10 @@ class Player final {
       // If we have an input message and it is above our threshold and we aren't already attacking,
       // update our state and kick off our action frames.
       if (input != std::nullopt && std::get<2>(*input) > 0 && _kind == PlayerStateKind::IDLE) {
-        log_d("starting attack (duration %d) at time %d", PLAYER_ATTACK_DURATION, time);
+        xr_log_d(PLAYER, "starting attack (duration %d) at time %d", PLAYER_ATTACK_DURATION, current_time);
         _kind = PlayerStateKind::ATTACKING;
         _idle_timer = std::make_unique<xr::Timer>(PLAYER_ATTACK_DURATION);
+        events.emit(AttackStarted { _index, _position });
       }
 
       // Update our position
@@ -117,17 +198,17 @@ class Player final {
         // - `2` -> left position
         if (x_input == 1) {
           if (_direction != Direction::RIGHT) {
-            log_d("moving right (%d)", x_input);
+            xr_log_d(PLAYER, "moving right (%d)", x_input);
           }
           _direction = Direction::RIGHT;
         } else if (x_input == 2) {
           if (_direction != Direction::LEFT) {
-            log_d("moving left (%d)", x_input);
+            xr_log_d(PLAYER, "moving left (%d)", x_input);
           }
           _direction = Direction::LEFT;
         } else {
           if (_direction != Direction::IDLE) {
-            log_d("idle (%d)", x_input);
+            xr_log_d(PLAYER, "idle (%d)", x_input);
           }
           _direction = Direction::IDLE;
         }
@@ -145,7 +226,7 @@ class Player final {
           break;
         }
         default: {
-          auto [red, green, blue] = IDLE_COLOR;
+          auto [red, green, blue] = IDLE_COLORS[_index];
           _data->push_back(std::make_tuple(_position, red, green, blue));
           break;
         }
@@ -153,7 +234,7 @@ class Player final {
 
       return std::make_tuple(
         std::move(*this),
-        PlayerMovement { _position, _kind == PlayerStateKind::ATTACKING }
+        PlayerMovement { _index, _position, _kind == PlayerStateKind::ATTACKING }
       );
     }
 
@@ -167,6 +248,8 @@ class Player final {
 
     mutable std::unique_ptr<std::vector<Light>> _data;
 
+    mutable uint8_t _index;
+    mutable bool _joined;
     mutable uint32_t _position;
     mutable Direction _direction;
     mutable PlayerStateKind _kind;
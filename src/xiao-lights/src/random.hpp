@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace xr {
+  // A pcg32 generator (see https://www.pcg-random.org): small, fast and, since it only uses integer
+  // arithmetic, the same on every platform for a given seed and stream.
+  class Random final {
+    public:
+      Random(uint64_t seed, uint64_t stream): _state(0), _increment((stream << 1) | 1) {
+        next();
+        _state += seed;
+        next();
+      }
+      ~Random() = default;
+
+      uint32_t next() {
+        uint64_t old = _state;
+        _state = old * 6364136223846793005ULL + _increment;
+        uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(old >> 59);
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+      }
+
+      // A number in [0, bound), without favoring the low end.
+      uint32_t below(uint32_t bound) {
+        if (bound == 0) {
+          return 0;
+        }
+
+        uint32_t threshold = (0 - bound) % bound;
+
+        while (true) {
+          uint32_t value = next();
+
+          if (value >= threshold) {
+            return value % bound;
+          }
+        }
+      }
+
+    private:
+      uint64_t _state;
+      uint64_t _increment;
+  };
+}
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "logging.hpp"
+#include "frame_events.hpp"
+#include "obstacle_kinds.hpp"
+#include "timer.hpp"
+#include "types.hpp"
+
+namespace xr {
+  // Obstacles can also be scripted by levels themselves (see `ScriptLibrary`), rather than built into
+  // our firmware (see `obstacle_kinds.hpp`). Scripts are compiled into a compact bytecode, every
+  // instruction being an opcode followed by its operands (little endian), and run by a small register
+  // machine: four 16-bit registers, a program counter and the obstacle itself.
+  //
+  // Scripted obstacles are a solid bar of `2 * half + 1` lights, lethal unless made killable, and start
+  // facing the start of the level.
+  struct Script final {
+    constexpr static const uint8_t REGISTERS = 4;
+
+    // Jump targets are a single byte.
+    constexpr static const uint32_t MAX_LENGTH = 255;
+
+    // The most instructions run for an obstacle in a single frame; scripts that have not waited by then
+    // pick up where they left off on the next one.
+    constexpr static const uint32_t BUDGET = 32;
+
+    constexpr static const uint8_t MAX_HALF = 8;
+    constexpr static const uint32_t LIGHT_CAPACITY = MAX_HALF + MAX_HALF + 1;
+
+    enum Op : uint8_t {
+      END,      // starts over from the top, on the next frame
+      STEP,     // moves one light the way the obstacle is facing
+      TURN,     // turns around
+      HOME,     // jumps back to where the obstacle started
+      MOVE,     // reg: moves by a register's worth of lights the way the obstacle is facing
+      WAIT,     // ms (u16): waits before running the next instruction
+      SET,      // reg, value (i16)
+      ADD,      // reg, value (i16)
+      JUMP,     // target
+      LOOP,     // reg, target: counts the register down, jumping to the target until it reaches zero
+      SHAPE,    // half: lights on either side of the obstacle's position
+      COLOR,    // red, green, blue
+      LETHAL,   // hurts players that run into it, unless they are attacking (see `Lethal`)
+      KILLABLE, // hurts players that run into it, unless they are attacking and defeat it (see `Killable`)
+      EMIT,     // count: throws out sparks (see `ScriptSignal`)
+      OP_COUNT,
+    };
+
+    // How many bytes of operands follow each opcode.
+    constexpr static const std::array<uint8_t, OP_COUNT> OPERAND_SIZES = {
+      0, 0, 0, 0, 1, 2, 3, 3, 1, 2, 1, 3, 0, 0, 1,
+    };
+  };
+
+  // Everything about a running script, as plain data (see `Obstacle::Snapshot`). The script is named by
+  // its layout token rather than pointed at, so that the state can be restored into any level built from
+  // the same text; its bytecode is looked up in that level's `ScriptLibrary`.
+  struct ScriptState final {
+    char token;
+    uint8_t length;
+    uint8_t pc;
+    bool waiting;
+    bool killable;
+    uint8_t half;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    std::array<int16_t, Script::REGISTERS> registers;
+
+    static ScriptState start(char token, uint8_t length) {
+      return ScriptState { token, length, 0, false, false, 0, 255, 255, 255, {} };
+    }
+  };
+
+  // Runs scripts, a frame at a time.
+  class ScriptMachine final {
+    public:
+      // Runs the script (whose bytecode is `program`) until it waits, ends or runs out of budget, moving the
+      // obstacle in `state`. Waits are timed by `timer`, which is otherwise left alone.
+      static void run(ScriptState& script, const uint8_t * program, ObstacleState& state, const Timer& timer, uint32_t time, FrameEvents& events) {
+        if (script.waiting) {
+          auto [next, done] = std::move(timer).tick(time);
+          timer = std::move(next);
+
+          if (!done) {
+            return;
+          }
+
+          script.waiting = false;
+        }
+
+        for (uint32_t budget = 0; budget < Script::BUDGET; budget++) {
+          if (script.pc >= script.length) {
+            script.pc = 0;
+            return;
+          }
+
+          const uint8_t * operands = program + script.pc + 1;
+          uint8_t op = program[script.pc];
+
+          if (op >= Script::Op::OP_COUNT) {
+            script.pc = 0;
+            return;
+          }
+
+          script.pc += 1 + Script::OPERAND_SIZES[op];
+
+          switch (op) {
+            case Script::Op::END:
+              script.pc = 0;
+              return;
+            case Script::Op::STEP:
+              move(state, 1);
+              break;
+            case Script::Op::TURN:
+              state.direction = state.direction == Direction::LEFT ? Direction::RIGHT : Direction::LEFT;
+              break;
+            case Script::Op::HOME:
+              state.position = state.origin;
+              break;
+            case Script::Op::MOVE:
+              move(state, script.registers[operands[0]]);
+              break;
+            case Script::Op::WAIT:
+              timer = Timer(read_u16(operands));
+              timer.tick(time);
+              script.waiting = true;
+              return;
+            case Script::Op::SET:
+              script.registers[operands[0]] = read_i16(operands + 1);
+              break;
+            case Script::Op::ADD:
+              script.registers[operands[0]] += read_i16(operands + 1);
+              break;
+            case Script::Op::JUMP:
+              script.pc = operands[0];
+              break;
+            case Script::Op::LOOP:
+              script.registers[operands[0]] -= 1;
+              script.pc = script.registers[operands[0]] > 0 ? operands[1] : script.pc;
+              break;
+            case Script::Op::SHAPE:
+              script.half = std::min(operands[0], Script::MAX_HALF);
+              break;
+            case Script::Op::COLOR:
+              script.red = operands[0];
+              script.green = operands[1];
+              script.blue = operands[2];
+              break;
+            case Script::Op::LETHAL:
+              script.killable = false;
+              break;
+            case Script::Op::KILLABLE:
+              script.killable = true;
+              break;
+            case Script::Op::EMIT:
+              events.emit(ScriptSignal { state.position, operands[0], std::make_tuple(script.red, script.green, script.blue) });
+              break;
+          }
+        }
+      }
+
+      // Whether the obstacle has a light on `target`.
+      static bool covers(const ScriptState& script, const ObstacleState& state, uint32_t target) {
+        uint32_t distance = target > state.position ? target - state.position : state.position - target;
+        return distance <= script.half;
+      }
+
+      // Appends every light of the obstacle that lands on the strip.
+      static void blit(const ScriptState& script, const ObstacleState& state, std::vector<Light> * const out) {
+        uint32_t first = state.position > script.half ? state.position - script.half : 0;
+
+        for (uint32_t position = first; position <= state.position + script.half; position++) {
+          out->push_back(std::make_tuple(position, script.red, script.green, script.blue));
+        }
+      }
+
+    private:
+      // Facing the start of the level is facing left, like players.
+      static void move(ObstacleState& state, int32_t amount) {
+        int64_t delta = state.direction == Direction::LEFT ? -amount : amount;
+        state.position = static_cast<uint32_t>(std::max<int64_t>(0, static_cast<int64_t>(state.position) + delta));
+      }
+
+      static uint16_t read_u16(const uint8_t * bytes) {
+        return bytes[0] | (bytes[1] << 8);
+      }
+
+      static int16_t read_i16(const uint8_t * bytes) {
+        return static_cast<int16_t>(read_u16(bytes));
+      }
+  };
+
+  // The scripts of a level, compiled from the text after its layout (see `Level`), e.g:
+  //
+  // p    0         0         g|0: shape 1 color 255 0 80 set r0 4 out: wait 150 step loop r0 out turn
+  //
+  // where `0` is the script used by the `0` tokens of the layout (scripts `0` through `9` can be given),
+  // followed by its instructions: the lower case names of `Script::Op`, each followed by its operands
+  // (registers are `r0` through `r3`). Jump targets are labels, a name followed by a colon.
+  //
+  // Scripts that do not compile are logged and left out, as are their obstacles.
+  class ScriptLibrary final {
+    public:
+      constexpr static const char SEPARATOR = '|';
+      constexpr static const uint8_t MAX_SCRIPTS = 10;
+      constexpr static const uint8_t MAX_LABELS = 16;
+
+      // Bytecode is never longer than the text it was compiled from, so it is given that much room up front
+      // and never reallocated; obstacles keep pointers into it.
+      explicit ScriptLibrary(std::pair<const char *, uint32_t> source): _code(new std::vector<uint8_t>(0)), _programs {} {
+        _code->reserve(source.second);
+        uint32_t cursor = 0;
+
+        while (cursor < source.second && source.first[cursor] != '\n') {
+          if (source.first[cursor] != SEPARATOR) {
+            cursor++;
+            continue;
+          }
+
+          uint32_t start = ++cursor;
+
+          while (cursor < source.second && source.first[cursor] != SEPARATOR && source.first[cursor] != '\n') {
+            cursor++;
+          }
+
+          add(source.first + start, cursor - start);
+        }
+      }
+
+      ScriptLibrary(): ScriptLibrary(std::make_pair("", 0)) {}
+      ~ScriptLibrary() = default;
+
+      ScriptLibrary(const ScriptLibrary&) = delete;
+      ScriptLibrary& operator=(const ScriptLibrary&) = delete;
+
+      // The script for a layout token, if there is one.
+      std::optional<std::pair<const uint8_t *, uint8_t>> program(char token) const {
+        if (token < '0' || token >= '0' + MAX_SCRIPTS || !_programs[token - '0'].present) {
+          return std::nullopt;
+        }
+
+        const Program& program = _programs[token - '0'];
+        return std::make_pair(_code->data() + program.offset, program.length);
+      }
+
+    private:
+      struct Program final {
+        uint32_t offset;
+        uint8_t length;
+        bool present;
+      };
+
+      struct Token final {
+        const char * text;
+        uint32_t length;
+
+        bool is(const char * other) const {
+          return strlen(other) == length && strncmp(text, other, length) == 0;
+        }
+      };
+
+      struct Label final {
+        Token name;
+        uint8_t offset;
+      };
+
+      // Splits text on spaces, a token at a time.
+      class Tokens final {
+        public:
+          Tokens(const char * text, uint32_t length): _text(text), _length(length), _cursor(0) {}
+
+          std::optional<Token> next() {
+            while (_cursor < _length && _text[_cursor] == ' ') {
+              _cursor++;
+            }
+
+            uint32_t start = _cursor;
+
+            while (_cursor < _length && _text[_cursor] != ' ') {
+              _cursor++;
+            }
+
+            return start == _cursor ? std::nullopt : std::make_optional(Token { _text + start, _cursor - start });
+          }
+
+        private:
+          const char * _text;
+          uint32_t _length;
+          uint32_t _cursor;
+      };
+
+      // Compiles `N: instructions...` into the script for token `N`.
+      void add(const char * text, uint32_t length) {
+        if (length < 2 || text[0] < '0' || text[0] >= '0' + MAX_SCRIPTS || text[1] != ':') {
+          xr_log_e(SCRIPT, "scripts start with their token, e.g '0:'");
+          return;
+        }
+
+        uint8_t index = text[0] - '0';
+        uint32_t offset = _code->size();
+        std::array<Label, MAX_LABELS> labels;
+        uint8_t label_count = 0;
+
+        // The first pass finds where every label is, the second writes out the instructions.
+        for (uint8_t pass = 0; pass < 2; pass++) {
+          Tokens tokens(text + 2, length - 2);
+          uint32_t size = 0;
+
+          while (auto token = tokens.next()) {
+            if (token->text[token->length - 1] == ':') {
+              if (pass == 0 && label_count == MAX_LABELS) {
+                return fail(index, offset, size);
+              }
+
+              if (pass == 0) {
+                labels[label_count++] = Label { Token { token->text, token->length - 1 }, static_cast<uint8_t>(size) };
+              }
+
+              continue;
+            }
+
+            auto op = find_op(*token);
+
+            if (op == std::nullopt) {
+              return fail(index, offset, size);
+            }
+
+            if (pass == 1) {
+              _code->push_back(*op);
+            }
+
+            size += 1;
+
+            for (uint8_t i = 0; i < operand_count(*op); i++) {
+              auto operand = tokens.next();
+              auto bytes = operand == std::nullopt ? 0 : encode(*op, i, *operand, labels, label_count, pass == 1);
+
+              if (bytes == 0) {
+                return fail(index, offset, size);
+              }
+
+              size += bytes;
+            }
+
+            if (size > Script::MAX_LENGTH) {
+              return fail(index, offset, size);
+            }
+          }
+
+          if (pass == 1) {
+            _programs[index] = Program { offset, static_cast<uint8_t>(size), true };
+          }
+        }
+      }
+
+      void fail(uint8_t index, uint32_t offset, uint32_t at) {
+        xr_log_e(SCRIPT, "unable to compile script %d (at byte %d)", index, at);
+        _code->resize(offset);
+        _programs[index].present = false;
+      }
+
+      static std::optional<Script::Op> find_op(const Token& token) {
+        constexpr const char * names[Script::Op::OP_COUNT] = {
+          "end", "step", "turn", "home", "move", "wait", "set", "add",
+          "jump", "loop", "shape", "color", "lethal", "killable", "emit",
+        };
+
+        for (uint8_t op = 0; op < Script::Op::OP_COUNT; op++) {
+          if (token.is(names[op])) {
+            return static_cast<Script::Op>(op);
+          }
+        }
+
+        return std::nullopt;
+      }
+
+      // How many operands each instruction is written with; most are a byte, but waits and values are two.
+      static uint8_t operand_count(Script::Op op) {
+        constexpr const uint8_t counts[Script::Op::OP_COUNT] = { 0, 0, 0, 0, 1, 1, 2, 2, 1, 2, 1, 3, 0, 0, 1 };
+        return counts[op];
+      }
+
+      enum OperandKind {
+        REGISTER,
+        BYTE,
+        WORD,
+        TARGET,
+      };
+
+      static OperandKind operand_kind(Script::Op op, uint8_t index) {
+        switch (op) {
+          case Script::Op::MOVE:
+            return OperandKind::REGISTER;
+          case Script::Op::WAIT:
+            return OperandKind::WORD;
+          case Script::Op::SET:
+          case Script::Op::ADD:
+            return index == 0 ? OperandKind::REGISTER : OperandKind::WORD;
+          case Script::Op::JUMP:
+            return OperandKind::TARGET;
+          case Script::Op::LOOP:
+            return index == 0 ? OperandKind::REGISTER : OperandKind::TARGET;
+          default:
+            return OperandKind::BYTE;
+        }
+      }
+
+      // Writes an operand (when `write` is set), returning how many bytes it takes or zero if it is not
+      // valid. Labels are only looked up when writing, since they can come after the jumps to them.
+      uint8_t encode(
+        Script::Op op,
+        uint8_t index,
+        const Token& token,
+        const std::array<Label, MAX_LABELS>& labels,
+        uint8_t label_count,
+        bool write
+      ) {
+        switch (operand_kind(op, index)) {
+          case OperandKind::REGISTER: {
+            if (token.length != 2 || token.text[0] != 'r' || token.text[1] < '0' || token.text[1] >= '0' + Script::REGISTERS) {
+              return 0;
+            }
+
+            if (write) {
+              _code->push_back(token.text[1] - '0');
+            }
+
+            return 1;
+          }
+          case OperandKind::TARGET: {
+            for (uint8_t i = 0; write && i < label_count; i++) {
+              if (labels[i].name.length == token.length && strncmp(labels[i].name.text, token.text, token.length) == 0) {
+                _code->push_back(labels[i].offset);
+                return 1;
+              }
+            }
+
+            return write ? 0 : 1;
+          }
+          case OperandKind::BYTE: {
+            auto value = parse_number(token);
+
+            if (value == std::nullopt || *value < 0 || *value > 255) {
+              return 0;
+            }
+
+            if (write) {
+              _code->push_back(*value);
+            }
+
+            return 1;
+          }
+          default: {
+            auto value = parse_number(token);
+
+            if (value == std::nullopt || *value < -32768 || *value > 65535) {
+              return 0;
+            }
+
+            if (write) {
+              _code->push_back(*value & 0xFF);
+              _code->push_back((*value >> 8) & 0xFF);
+            }
+
+            return 2;
+          }
+        }
+      }
+
+      static std::optional<int32_t> parse_number(const Token& token) {
+        bool negative = token.text[0] == '-';
+        int32_t value = 0;
+
+        if (token.length == (negative ? 1u : 0u) || token.length > 6) {
+          return std::nullopt;
+        }
+
+        for (uint32_t i = negative ? 1 : 0; i < token.length; i++) {
+          if (token.text[i] < '0' || token.text[i] > '9') {
+            return std::nullopt;
+          }
+
+          value = value * 10 + (token.text[i] - '0');
+        }
+
+        return negative ? -value : value;
+      }
+
+      std::unique_ptr<std::vector<uint8_t>> _code;
+      std::array<Program, MAX_SCRIPTS> _programs;
+  };
+}
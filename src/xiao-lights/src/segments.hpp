@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Arduino.h>
+#include "driver/rmt_tx.h"
+#include "soc/soc_caps.h"
+
+#include <memory>
+#include <vector>
+
+#include "framebuffer.hpp"
+#include "logging.hpp"
+
+namespace xr {
+  // A segment is a physical strip that displays a contiguous range of the logical track, starting at
+  // `offset`. Reversed segments are wired so that their first pixel shows the end of that range.
+  struct Segment final {
+    int16_t pin;
+    uint32_t offset;
+    uint32_t length;
+    bool reversed;
+
+    // Maps a logical position (that is known to be within this segment) onto this segment's strip.
+    uint32_t pixel(uint32_t position) const {
+      return reversed ? offset + length - 1 - position : position - offset;
+    }
+  };
+
+  // Owns the strip for a single segment, driven by an rmt transmit channel of its own: `start` hands the
+  // strip's bytes to the channel and returns straight away, so that every segment is transmitted at the
+  // same time (the esp32c3 has two such channels, so two segments at most).
+  //
+  // Strips are ws2812b (green, red, blue), whose bits are encoded by the channel as they are sent. The
+  // line is left low once a strip is sent, which is all the reset it needs before the next frame.
+  class SegmentOutput final {
+    public:
+      constexpr static const uint32_t MAX_SEGMENTS = SOC_RMT_TX_CANDIDATES_PER_GROUP;
+
+      explicit SegmentOutput(const Segment& segment):
+        _segment(segment),
+        _pixels(new std::vector<uint8_t>(segment.length * 3, 0)),
+        _channel(nullptr),
+        _encoder(nullptr) {
+        }
+      ~SegmentOutput() {
+        if (_channel != nullptr) {
+          rmt_disable(_channel);
+          rmt_del_channel(_channel);
+        }
+
+        if (_encoder != nullptr) {
+          rmt_del_encoder(_encoder);
+        }
+      }
+
+      SegmentOutput(const SegmentOutput&) = delete;
+      SegmentOutput& operator=(const SegmentOutput&) = delete;
+
+      // Claims a channel for our pin and clears the strip; segments without a channel stay dark.
+      void begin() {
+        rmt_tx_channel_config_t channel_config = {};
+        channel_config.gpio_num = static_cast<gpio_num_t>(_segment.pin);
+        channel_config.clk_src = RMT_CLK_SRC_DEFAULT;
+        channel_config.resolution_hz = RESOLUTION_HZ;
+        channel_config.mem_block_symbols = SOC_RMT_MEM_WORDS_PER_CHANNEL;
+        channel_config.trans_queue_depth = 1;
+
+        if (rmt_new_tx_channel(&channel_config, &_channel) != ESP_OK) {
+          xr_log_e(SEGMENT, "no rmt channel left for the segment on pin %d", _segment.pin);
+          _channel = nullptr;
+          return;
+        }
+
+        // 0.3us high then 0.9us low for a zero, the other way around for a one.
+        rmt_bytes_encoder_config_t encoder_config = {};
+        encoder_config.bit0 = rmt_symbol_word_t { 3, 1, 9, 0 };
+        encoder_config.bit1 = rmt_symbol_word_t { 9, 1, 3, 0 };
+        encoder_config.flags.msb_first = 1;
+
+        if (rmt_new_bytes_encoder(&encoder_config, &_encoder) != ESP_OK || rmt_enable(_channel) != ESP_OK) {
+          xr_log_e(SEGMENT, "unable to set up the rmt channel for the segment on pin %d", _segment.pin);
+          rmt_del_channel(_channel);
+          _channel = nullptr;
+          return;
+        }
+
+        start();
+        wait();
+      }
+
+      // Copies our range of the framebuffer into the strip's bytes.
+      void write(Framebuffer& framebuffer) {
+        framebuffer.render(_segment.offset, _segment.length, [this](uint32_t pos, uint8_t r, uint8_t g, uint8_t b) {
+          uint8_t * pixel = _pixels->data() + _segment.pixel(pos) * 3;
+          pixel[0] = g;
+          pixel[1] = r;
+          pixel[2] = b;
+        });
+      }
+
+      // Begins transmitting the strip; `wait` must be called before the next `write`.
+      void start() {
+        if (_channel == nullptr) {
+          return;
+        }
+
+        rmt_transmit_config_t transmit_config = {};
+        rmt_transmit(_channel, _encoder, _pixels->data(), _pixels->size(), &transmit_config);
+      }
+
+      void wait() {
+        if (_channel == nullptr) {
+          return;
+        }
+
+        rmt_tx_wait_all_done(_channel, -1);
+      }
+
+    private:
+      // 0.1us per tick.
+      constexpr static const uint32_t RESOLUTION_HZ = 10000000;
+
+      const Segment _segment;
+      std::unique_ptr<std::vector<uint8_t>> _pixels;
+      rmt_channel_handle_t _channel;
+      rmt_encoder_handle_t _encoder;
+  };
+}
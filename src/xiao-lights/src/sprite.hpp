@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "types.hpp"
+
+namespace xr {
+  // A single light of a sprite, relative to the sprite's position.
+  struct SpritePixel final {
+    int32_t offset;
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+  };
+
+  template <size_t N, size_t F = 1>
+  using SpriteFrames = std::array<std::array<SpritePixel, N>, F>;
+
+  // Masks describe the pixels of a sprite at compile time, as `FRAMES` (every frame having the same
+  // number of pixels, sorted by offset) shown for `MS_PER_FRAME` each.
+
+  template <uint8_t R, uint8_t G, uint8_t B>
+  struct PointMask final {
+    constexpr static const uint16_t MS_PER_FRAME = 0;
+    constexpr static const SpriteFrames<1> FRAMES = {{ {{ { 0, R, G, B } }} }};
+  };
+
+  // Two wings of `WINGS_HALF` lights on either side of an unlit eye.
+  template <uint32_t EYE_HALF, uint32_t WINGS_HALF, uint8_t R, uint8_t G, uint8_t B>
+  struct WingsMask final {
+    constexpr static const uint16_t MS_PER_FRAME = 0;
+    constexpr static const SpriteFrames<WINGS_HALF + WINGS_HALF> FRAMES = [] {
+      SpriteFrames<WINGS_HALF + WINGS_HALF> frames {};
+
+      for (uint32_t i = 0; i < WINGS_HALF + WINGS_HALF; i++) {
+        int32_t offset = i < WINGS_HALF
+          ? static_cast<int32_t>(i + EYE_HALF)
+          : -static_cast<int32_t>(i + EYE_HALF);
+
+        // The trailing wing is stored back to front so that every offset is ascending.
+        uint32_t index = i < WINGS_HALF ? WINGS_HALF + i : (WINGS_HALF + WINGS_HALF - 1) - i;
+        frames[0][index] = SpritePixel { offset, R, G, B };
+      }
+
+      return frames;
+    }();
+  };
+
+  // Renders and collides a mask. Everything that can be is derived from the mask at compile time,
+  // including a coverage map of every frame; collision checks are a single lookup and rendering is a
+  // straight copy of the lights that fall on the strip.
+  template <typename Mask>
+  struct Sprite final {
+    constexpr static const uint32_t LIGHT_COUNT = std::tuple_size<typename decltype(Mask::FRAMES)::value_type>::value;
+    constexpr static const uint32_t FRAME_COUNT = std::tuple_size<decltype(Mask::FRAMES)>::value;
+
+    constexpr static const int32_t MIN_OFFSET = [] {
+      int32_t result = Mask::FRAMES[0][0].offset;
+      for (uint32_t f = 0; f < FRAME_COUNT; f++) {
+        result = std::min(result, Mask::FRAMES[f][0].offset);
+      }
+      return result;
+    }();
+
+    constexpr static const int32_t MAX_OFFSET = [] {
+      int32_t result = Mask::FRAMES[0][LIGHT_COUNT - 1].offset;
+      for (uint32_t f = 0; f < FRAME_COUNT; f++) {
+        result = std::max(result, Mask::FRAMES[f][LIGHT_COUNT - 1].offset);
+      }
+      return result;
+    }();
+
+    constexpr static const uint32_t SPAN = MAX_OFFSET - MIN_OFFSET + 1;
+
+    constexpr static const std::array<std::array<bool, SPAN>, FRAME_COUNT> COVERAGE = [] {
+      std::array<std::array<bool, SPAN>, FRAME_COUNT> coverage {};
+
+      for (uint32_t f = 0; f < FRAME_COUNT; f++) {
+        for (uint32_t i = 0; i < LIGHT_COUNT; i++) {
+          coverage[f][Mask::FRAMES[f][i].offset - MIN_OFFSET] = true;
+        }
+      }
+
+      return coverage;
+    }();
+
+    static uint32_t frame_index(uint32_t time) {
+      return FRAME_COUNT > 1 && Mask::MS_PER_FRAME > 0 ? (time / Mask::MS_PER_FRAME) % FRAME_COUNT : 0;
+    }
+
+    // Whether the sprite at `position` has a light on `target`.
+    static bool covers(uint32_t position, uint32_t time, uint32_t target) {
+      int64_t offset = static_cast<int64_t>(target) - static_cast<int64_t>(position);
+
+      if (offset < MIN_OFFSET || offset > MAX_OFFSET) {
+        return false;
+      }
+
+      return COVERAGE[frame_index(time)][offset - MIN_OFFSET];
+    }
+
+    // Appends every light of the sprite at `position` that lands on the strip.
+    static void blit(uint32_t position, uint32_t time, std::vector<Light> * const out) {
+      const auto& pixels = Mask::FRAMES[frame_index(time)];
+
+      // Offsets are ascending, so anything hanging off of the start of the strip is at the front.
+      auto first = std::find_if(pixels.cbegin(), pixels.cend(), [position](const SpritePixel& pixel) {
+        return pixel.offset >= 0 || static_cast<uint32_t>(-pixel.offset) <= position;
+      });
+
+      for (auto pixel = first; pixel != pixels.cend(); pixel++) {
+        out->push_back(std::make_tuple(position + pixel->offset, pixel->red, pixel->green, pixel->blue));
+      }
+    }
+  };
+}
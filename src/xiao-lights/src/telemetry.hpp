@@ -0,0 +1,177 @@
+#pragma once
+
+#include <Arduino.h>
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <array>
+
+// Per-stage frame timing. Every stage of the main loop is timed with `XR_TELEMETRY_SCOPE` and aggregated
+// into a histogram that is periodically written to serial (see `Telemetry::emit`) as one line per stage:
+//
+// frame,stage=level count=212i,min=41i,avg=48i,max=97i,p99=80i
+//
+// Unless `XR_TELEMETRY` is defined, the scope macro expands to nothing and no timers are read.
+#ifdef XR_TELEMETRY
+#define XR_TELEMETRY_CONCAT_INNER(a, b) a##b
+#define XR_TELEMETRY_CONCAT(a, b) XR_TELEMETRY_CONCAT_INNER(a, b)
+#define XR_TELEMETRY_SCOPE(telemetry, stage) \
+  xr::Telemetry::Scope XR_TELEMETRY_CONCAT(_telemetry_scope_, __LINE__)(telemetry, stage)
+#else
+#define XR_TELEMETRY_SCOPE(telemetry, stage)
+#endif
+
+namespace xr {
+  enum TelemetryStage {
+    PARSE_INPUT,
+    LEVEL_FRAME,
+    BUILD_FRAMEBUFFER,
+    SHOW_PIXELS,
+    STAGE_COUNT,
+  };
+
+  // Accumulates microsecond samples into log-linear buckets; every power of two is split into four
+  // buckets, which bounds the error of the reported percentile to 25% while keeping the histogram at
+  // a fixed, small size.
+  class Histogram final {
+    public:
+      constexpr static const uint32_t BUCKET_COUNT = 96;
+
+      Histogram() { reset(); }
+      ~Histogram() = default;
+
+      void record(uint32_t micros) {
+        _count += 1;
+        _sum += micros;
+        _min = std::min(_min, micros);
+        _max = std::max(_max, micros);
+        _buckets[std::min(bucket(micros), BUCKET_COUNT - 1)] += 1;
+      }
+
+      void reset() {
+        _count = 0;
+        _sum = 0;
+        _min = UINT32_MAX;
+        _max = 0;
+        _buckets.fill(0);
+      }
+
+      uint32_t count() const { return _count; }
+      uint32_t min() const { return _count > 0 ? _min : 0; }
+      uint32_t max() const { return _max; }
+      uint32_t avg() const { return _count > 0 ? _sum / _count : 0; }
+
+      // Returns the upper bound of the bucket containing the given percentile.
+      uint32_t percentile(uint32_t pct) const {
+        uint64_t target = (static_cast<uint64_t>(_count) * pct + 99) / 100;
+        uint64_t seen = 0;
+
+        for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+          seen += _buckets[i];
+
+          if (seen >= target && seen > 0) {
+            return std::min(upper_bound(i), _max);
+          }
+        }
+
+        return _max;
+      }
+
+    private:
+      static uint32_t bucket(uint32_t value) {
+        if (value < 16) {
+          return value;
+        }
+
+        uint32_t msb = 31 - __builtin_clz(value);
+        return 16 + (msb - 4) * 4 + ((value >> (msb - 2)) & 3);
+      }
+
+      static uint32_t upper_bound(uint32_t index) {
+        if (index < 16) {
+          return index;
+        }
+
+        uint32_t msb = ((index - 16) / 4) + 4;
+        uint32_t sub = (index - 16) % 4;
+        return (1u << msb) + ((sub + 1) << (msb - 2)) - 1;
+      }
+
+      uint32_t _count;
+      uint64_t _sum;
+      uint32_t _min;
+      uint32_t _max;
+      std::array<uint32_t, BUCKET_COUNT> _buckets;
+  };
+
+  class Telemetry final {
+    public:
+      // Times the enclosing block, recording it against `stage` when it goes out of scope.
+      class Scope final {
+        public:
+          Scope(Telemetry& telemetry, TelemetryStage stage):
+            _telemetry(telemetry),
+            _stage(stage),
+            _start(esp_timer_get_time()) {
+            }
+          ~Scope() {
+            _telemetry.record(_stage, esp_timer_get_time() - _start);
+          }
+
+          Scope(const Scope&) = delete;
+          Scope& operator=(const Scope&) = delete;
+
+        private:
+          Telemetry& _telemetry;
+          TelemetryStage _stage;
+          int64_t _start;
+      };
+
+      Telemetry() = default;
+      ~Telemetry() = default;
+
+      Telemetry(const Telemetry&) = delete;
+      Telemetry& operator=(const Telemetry&) = delete;
+
+      void record(TelemetryStage stage, uint32_t micros) {
+        _stages[stage].record(micros);
+      }
+
+      // Writes one line per stage and resets every histogram.
+      void emit() {
+        for (uint32_t stage = 0; stage < STAGE_COUNT; stage++) {
+          Histogram& histogram = _stages[stage];
+
+          Serial.printf(
+            "frame,stage=%s count=%ui,min=%ui,avg=%ui,max=%ui,p99=%ui\n",
+            stage_name(static_cast<TelemetryStage>(stage)),
+            histogram.count(),
+            histogram.min(),
+            histogram.avg(),
+            histogram.max(),
+            histogram.percentile(99)
+          );
+
+          histogram.reset();
+        }
+      }
+
+    private:
+      static const char * stage_name(TelemetryStage stage) {
+        switch (stage) {
+          case TelemetryStage::PARSE_INPUT:
+            return "input";
+          case TelemetryStage::LEVEL_FRAME:
+            return "level";
+          case TelemetryStage::BUILD_FRAMEBUFFER:
+            return "framebuffer";
+          case TelemetryStage::SHOW_PIXELS:
+            return "show";
+          default:
+            return "unknown";
+        }
+      }
+
+      std::array<Histogram, STAGE_COUNT> _stages;
+  };
+}
@@ -1,10 +1,18 @@
 #pragma once
 
-#include "esp32-hal-log.h"
+#include "logging.hpp"
 
 namespace xr {
   struct Timer final {
     public:
+      // The state of a timer as plain data (see `Level::Snapshot`). Restoring a snapshot whose
+      // `last_time` is zero starts the timer counting down again from its next tick.
+      struct Snapshot final {
+        uint32_t interval;
+        uint32_t remaining;
+        uint32_t last_time;
+      };
+
       explicit Timer(uint32_t amount):
         _interval(amount),
         _remaining(amount),
@@ -33,7 +41,7 @@ namespace xr {
 
       const std::pair<Timer, bool> tick(uint32_t time) const noexcept {
         if (time < _last_time) {
-          log_e("[warning] - provided a time that is in the past (given %d, last %d)", time, _last_time);
+          xr_log_w(TIMER, "provided a time that is in the past (given %d, last %d)", time, _last_time);
 
           return std::make_pair(std::move(*this), false);
         }
@@ -59,6 +67,16 @@ namespace xr {
         return _remaining == 0;
       }
 
+      Snapshot snapshot() const {
+        return Snapshot { _interval, _remaining, _last_time };
+      }
+
+      void restore(const Snapshot& snapshot) const {
+        _interval = snapshot.interval;
+        _remaining = snapshot.remaining;
+        _last_time = snapshot.last_time;
+      }
+
     private:
       mutable uint32_t _interval;
       mutable uint32_t _remaining;
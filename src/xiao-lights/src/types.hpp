@@ -1,25 +1,77 @@
 #pragma once
 
+#include <array>
+#include <optional>
+#include <tuple>
+#include <variant>
+
 enum Direction {
   LEFT,
   RIGHT,
   IDLE
 };
 
+// The most controllers (and so players) that can take part in a single game.
+constexpr static const uint8_t MAX_PLAYERS = 8;
+
 using Light = std::tuple<uint32_t, uint8_t, uint8_t, uint8_t>;
 using ControllerInput = std::tuple<uint32_t, uint32_t, uint8_t>;
 
+// A single message from a controller; `sequence` and `time` (on the controller's clock) are zero for
+// controllers that do not send them.
+struct ControllerMessage final {
+  ControllerInput input;
+  uint32_t sequence;
+  uint32_t time;
+};
+
+// The input received from each player's controller (if any) for a single frame.
+using PlayerInputs = std::array<std::optional<ControllerInput>, MAX_PLAYERS>;
 
 struct PlayerMovement final {
+  uint8_t player;
   uint32_t position;
   bool attacking;
 };
 
+// Every player still in the game, after they have moved for the frame.
+struct PlayerMovements final {
+  std::array<PlayerMovement, MAX_PLAYERS> movements;
+  uint8_t count;
+};
+
 struct ObstacleCollision final {
+  uint8_t player;
+  uint32_t position;
+};
+
+// An obstacle at `position` was defeated by an attacking player.
+struct ObstacleDefeated final {
+  uint8_t player;
   uint32_t position;
 };
 
 struct GoalReached final {
+  uint32_t position;
+};
+
+// A player sent their first input, and is now in the game.
+struct PlayerJoined final {
+  uint8_t player;
+  uint32_t position;
+};
+
+struct AttackStarted final {
+  uint8_t player;
+  uint32_t position;
+};
+
+// A scripted obstacle asked for `count` sparks of its color (see `xr::Script`).
+struct ScriptSignal final {
+  uint32_t position;
+  uint8_t count;
+  std::tuple<uint8_t, uint8_t, uint8_t> color;
 };
 
-using FrameMessage = std::variant<PlayerMovement, ObstacleCollision, GoalReached>;
+// Anything that can happen to players and obstacles during a frame (see `xr::FrameEvents`).
+using FrameEvent = std::variant<ObstacleCollision, ObstacleDefeated, GoalReached, PlayerJoined, AttackStarted, ScriptSignal>;
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# Compiles levels written one per line (the format of `embed/levels.txt`) into an indexed level pack
+# (see `src/level_pack.hpp`), which the light host can read any level from without scanning the others.
+#
+#   python3 tools/pack_levels.py embed/levels.txt my-levels.pack
+#
+# This also runs as a PlatformIO pre script, compiling `embed/levels.txt` into the `embed/levels.pack`
+# that is embedded in our firmware.
+
+import os
+import struct
+import sys
+
+MAGIC = 0x504C5258
+VERSION = 1
+HEADER = struct.Struct("<IIII")
+ENTRY = struct.Struct("<II")
+
+
+def is_pack(data):
+    return len(data) >= HEADER.size and HEADER.unpack_from(data)[0:2] == (MAGIC, VERSION)
+
+
+def pack(text):
+    levels = [line for line in text.splitlines() if line.strip()]
+    offset = HEADER.size + ENTRY.size * len(levels)
+    index = []
+
+    for level in levels:
+        index.append(ENTRY.pack(offset, len(level)))
+        offset += len(level)
+
+    return HEADER.pack(MAGIC, VERSION, len(levels), 0) + b"".join(index) + b"".join(levels)
+
+
+def compile_file(source, destination):
+    with open(source, "rb") as levels:
+        data = pack(levels.read())
+
+    # Leave the output alone when nothing changed, so the firmware is not rebuilt needlessly.
+    if os.path.exists(destination):
+        with open(destination, "rb") as existing:
+            if existing.read() == data:
+                return data
+
+    with open(destination, "wb") as output:
+        output.write(data)
+
+    return data
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: %s <levels.txt> <output.pack>" % sys.argv[0], file=sys.stderr)
+        return 1
+
+    data = compile_file(sys.argv[1], sys.argv[2])
+    print("packed %d levels (%d bytes)" % (HEADER.unpack_from(data)[2], len(data)))
+    return 0
+
+
+# `Import` is only there when PlatformIO runs us as a pre script.
+try:
+    Import("env")  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
+else:
+    project = env.subst("$PROJECT_DIR")  # noqa: F821
+    compile_file(os.path.join(project, "embed", "levels.txt"), os.path.join(project, "embed", "levels.pack"))
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# Uploads levels (a file in the same format as `embed/levels.txt`, or a pack already compiled by
+# `pack_levels.py`) to a running light host over serial, without reflashing it. The new levels are played
+# as soon as the upload is committed.
+#
+#   python3 tools/upload_levels.py /dev/ttyACM0 embed/levels.txt
+#
+# Requires pyserial (`pip install pyserial`).
+
+import argparse
+import sys
+import time
+import zlib
+
+import serial
+
+import pack_levels
+
+CHUNK_SIZE = 240
+REPLY_TIMEOUT = 2.0
+MAX_ATTEMPTS = 5
+
+
+def command(port, line):
+    port.write((line + "\n").encode("ascii"))
+    deadline = time.monotonic() + REPLY_TIMEOUT
+
+    # Anything else the light host prints (e.g. logs) is skipped over.
+    while time.monotonic() < deadline:
+        reply = port.readline().decode("ascii", errors="replace").strip()
+
+        if reply.startswith("XRU OK"):
+            return True, int(reply.split()[2])
+
+        if reply.startswith("XRU ERR"):
+            return False, int(reply.split()[2])
+
+    return False, None
+
+
+def upload(port, data):
+    ok, _ = command(port, "XRU BEGIN %d %d" % (len(data), zlib.crc32(data)))
+
+    if not ok:
+        raise RuntimeError("light host refused the upload")
+
+    offset = 0
+    attempts = 0
+
+    while offset < len(data):
+        chunk = data[offset:offset + CHUNK_SIZE]
+        ok, expected = command(port, "XRU CHUNK %d %s" % (offset, chunk.hex()))
+
+        if ok:
+            offset = expected
+            attempts = 0
+            print("\r%d/%d bytes" % (offset, len(data)), end="", flush=True)
+            continue
+
+        attempts += 1
+
+        if attempts == MAX_ATTEMPTS:
+            command(port, "XRU ABORT")
+            raise RuntimeError("too many failed attempts at offset %d" % offset)
+
+        # Resume from wherever the light host says it is.
+        if expected is not None:
+            offset = expected
+
+    print()
+    ok, _ = command(port, "XRU COMMIT")
+
+    if not ok:
+        raise RuntimeError("light host was unable to commit the upload")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="upload a level pack to the light host")
+    parser.add_argument("port", help="serial port of the light host")
+    parser.add_argument("levels", help="level pack to upload")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    with open(args.levels, "rb") as levels:
+        data = levels.read()
+
+    if not pack_levels.is_pack(data):
+        data = pack_levels.pack(data)
+
+    with serial.Serial(args.port, args.baud, timeout=0.2) as port:
+        try:
+            upload(port, data)
+        except RuntimeError as error:
+            print("upload failed: %s" % error, file=sys.stderr)
+            return 1
+
+    print("uploaded %d bytes" % len(data))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())